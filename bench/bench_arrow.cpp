@@ -0,0 +1,87 @@
+// Cost per snapshot of the two MBP outputs: a CSV row from MBPFormatter
+// appended to a buffer, against a row of MBPArrowWriter's column buffers
+// (record batches written to /dev/null), with and without order counts.
+//
+//   make microbench && ./bench_arrow [snapshots]
+
+#include "../src/arrow_writer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+constexpr size_t WINDOW = 1024;
+
+std::vector<MBPSnapshot> make_snapshots() {
+    std::mt19937_64 rng(5);
+    std::vector<MBPSnapshot> snapshots(WINDOW);
+    for (size_t n = 0; n < WINDOW; ++n) {
+        MBPSnapshot& s = snapshots[n];
+        s.timestamp_ns = 1700000000000000000ULL + n * 1000;
+        for (int i = 0; i < 10; ++i) {
+            s.bid_px[i] = 1000000 - 25 * i - static_cast<int64_t>(rng() % 5);
+            s.ask_px[i] = 1000025 + 25 * i + static_cast<int64_t>(rng() % 5);
+            s.bid_sz[i] = 1 + rng() % 5000;
+            s.ask_sz[i] = 1 + rng() % 5000;
+            s.bid_ct[i] = 1 + rng() % 40;
+            s.ask_ct[i] = 1 + rng() % 40;
+        }
+    }
+    return snapshots;
+}
+
+template<typename Fn>
+double ns_per_snapshot(size_t count, Fn fn) {
+    double best = 1e30;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        auto start = std::chrono::steady_clock::now();
+        size_t checksum = fn();
+        auto end = std::chrono::steady_clock::now();
+        if (checksum == 1) std::printf(" ");
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / count);
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    std::vector<MBPSnapshot> snapshots = make_snapshots();
+    
+    std::printf("%zu snapshots\n", count);
+    for (bool order_counts : {false, true}) {
+        double csv = ns_per_snapshot(count, [&] {
+            MBPFormatter formatter(order_counts);
+            std::string out;
+            size_t bytes = 0;
+            for (size_t n = 0; n < count; ++n) {
+                out += formatter.format_snapshot(snapshots[n % WINDOW]);
+                if (out.size() > (1 << 20)) {
+                    bytes += out.size();
+                    out.clear();
+                }
+            }
+            return bytes + out.size();
+        });
+        double arrow = ns_per_snapshot(count, [&] {
+            MBPArrowWriter writer("/dev/null", order_counts);
+            for (size_t n = 0; n < count; ++n) {
+                writer.append(snapshots[n % WINDOW]);
+            }
+            writer.finish();
+            return static_cast<size_t>(writer.rows());
+        });
+        std::printf("  %-16s CSV row %7.1f ns, Arrow row %6.1f ns\n",
+                    order_counts ? "order counts" : "price/size only", csv, arrow);
+    }
+    return 0;
+}
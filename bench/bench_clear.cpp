@@ -0,0 +1,85 @@
+// Stall of OrderBook::clear() (an R event) on books of growing depth,
+// for both order id indexes. The book is refilled between clears, so each
+// clear starts from a warm book that reuses the pool and index left by the
+// previous one, as on a venue that clears several times a session.
+//
+//   make microbench && ./bench_clear [max_orders]
+
+#include "../src/order_book.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr size_t LEVELS_PER_SIDE = 2000;
+constexpr size_t MIN_CLEARS = 10;
+constexpr size_t ORDERS_PER_RUN = 20000000;    // clears = this / book size
+
+struct Add {
+    uint64_t order_id;
+    int64_t  price;
+    uint32_t size;
+    char     side;
+};
+
+std::vector<Add> make_book(size_t orders) {
+    std::mt19937_64 rng(3);
+    std::vector<Add> adds(orders);
+    uint64_t order_id = 6000000000000ULL;
+    for (Add& add : adds) {
+        order_id += 1 + rng() % 3;
+        bool bid = rng() & 1;
+        int64_t offset = static_cast<int64_t>(rng() % LEVELS_PER_SIDE) * 10000000;
+        add = {order_id, bid ? 100000000000 - offset : 100010000000 + offset,
+               static_cast<uint32_t>(1 + rng() % 500), bid ? 'B' : 'A'};
+    }
+    return adds;
+}
+
+double percentile(std::vector<double>& sorted, double p) {
+    size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t max_orders = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    
+    std::printf("%zu levels per side; clear() stall in microseconds\n", LEVELS_PER_SIDE);
+    std::printf("  %-6s %9s %7s %9s %9s %9s %9s\n",
+                "index", "orders", "clears", "p50", "p90", "p99", "max");
+    for (OrderIndexKind kind : {OrderIndexKind::Hash, OrderIndexKind::Dense}) {
+        for (size_t orders = 10000; orders <= max_orders; orders *= 10) {
+            std::vector<Add> adds = make_book(orders);
+            size_t clears = std::max(MIN_CLEARS, ORDERS_PER_RUN / orders);
+            
+            OrderBook book(kind);
+            std::vector<double> stalls;
+            for (size_t n = 0; n <= clears; ++n) {
+                for (const Add& add : adds) {
+                    book.add_order(add.order_id, add.price, add.size, add.side, 0);
+                }
+                auto start = std::chrono::steady_clock::now();
+                book.clear();
+                auto end = std::chrono::steady_clock::now();
+                if (n > 0) {    // the first clear frees a book built from cold
+                    stalls.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+                }
+            }
+            
+            std::sort(stalls.begin(), stalls.end());
+            std::printf("  %-6s %9zu %7zu %9.1f %9.1f %9.1f %9.1f\n",
+                        kind == OrderIndexKind::Hash ? "hash" : "dense", orders, stalls.size(),
+                        percentile(stalls, 0.5), percentile(stalls, 0.9),
+                        percentile(stalls, 0.99), stalls.back());
+        }
+    }
+    return 0;
+}
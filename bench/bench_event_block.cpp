@@ -0,0 +1,151 @@
+// Row-wise Event blocks against column-wise EventBlocks: parsing a file
+// into each (warm page cache), and BookReconstructor::on_events() over a
+// deep book with the sample's action mix (about 40% adds, 37% cancels,
+// 10% modifies, 13% trades and fills), where the block path prefetches
+// only the cancels and modifies found by its classification pass.
+//
+//   make microbench && ./bench_event_block [mbo.csv] [resting_orders] [events]
+
+#include "../src/reconstructor.hpp"
+#include "../src/csv_parser.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+constexpr size_t LEVELS_PER_SIDE = 50000;
+
+template<typename Fn>
+double best_seconds(Fn fn) {
+    double best = 1e30;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+void bench_parse(const char* filename) {
+    uint64_t events = 0;
+    double rows = best_seconds([&] {
+        FastCSVParser parser(filename);
+        std::vector<Event> block(EventBlock::CAPACITY);
+        size_t count;
+        events = 0;
+        while ((count = parser.parse_events(block.data(), block.size())) > 0) {
+            events += count;
+        }
+    });
+    double columns = best_seconds([&] {
+        FastCSVParser parser(filename);
+        auto block = std::make_unique<EventBlock>();
+        while (parser.parse_events(*block) > 0) {}
+    });
+    std::printf("parse %s, %llu events\n", filename, static_cast<unsigned long long>(events));
+    std::printf("  Event[]     %8.1f ns/event\n", rows * 1e9 / events);
+    std::printf("  EventBlock  %8.1f ns/event\n", columns * 1e9 / events);
+}
+
+struct Replay {
+    std::vector<Event> resting;     // adds that build the book first
+    std::vector<Event> events;
+};
+
+Replay make_replay(size_t resting_orders, size_t count) {
+    std::mt19937_64 rng(42);
+    Replay replay;
+    std::vector<Event> live;
+    uint64_t next_id = 1000000;
+    auto add = [&](std::vector<Event>& out) {
+        char side = (rng() & 1) ? 'A' : 'B';
+        int64_t offset = static_cast<int64_t>(rng() % LEVELS_PER_SIDE) + 1;
+        Event event(out.size(), 'A', side, side == 'B' ? 1000000 - offset : 1000000 + offset,
+                    100, next_id++);
+        out.push_back(event);
+        live.push_back(event);
+    };
+    for (size_t i = 0; i < resting_orders; ++i) {
+        add(replay.resting);
+    }
+    std::shuffle(live.begin(), live.end(), rng);
+    
+    while (replay.events.size() < count) {
+        unsigned roll = rng() % 100;
+        if (roll < 40 || live.empty()) {
+            add(replay.events);
+            std::swap(live.back(), live[rng() % live.size()]);
+        } else if (roll < 87) {
+            Event victim = live.back();
+            char action = roll < 77 ? 'C' : 'M';
+            if (action == 'C') live.pop_back();
+            replay.events.push_back(Event(replay.events.size(), action, victim.side,
+                                          int64_t{victim.price_raw}, 50, uint64_t{victim.order_id}));
+        } else {
+            // A stray trade and fill pair: no book change, no lookup.
+            char action = roll < 94 ? 'T' : 'F';
+            replay.events.push_back(Event(replay.events.size(), action, 'B', 1000000, 10, 1));
+        }
+    }
+    return replay;
+}
+
+template<typename Apply>
+double run_replay(const Replay& replay, Apply apply) {
+    BookListener listener;
+    double best = 1e30;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        BookReconstructor reconstructor(listener);
+        reconstructor.on_events(replay.resting.data(), replay.resting.size());
+        auto start = std::chrono::steady_clock::now();
+        apply(reconstructor);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t resting = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    size_t count = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 2000000;
+    
+    if (argc > 1) {
+        bench_parse(argv[1]);
+    }
+    
+    Replay replay = make_replay(resting, count);
+    std::vector<std::unique_ptr<EventBlock>> blocks;
+    for (size_t i = 0; i < replay.events.size(); ++i) {
+        if (blocks.empty() || blocks.back()->full()) {
+            blocks.push_back(std::make_unique<EventBlock>());
+        }
+        blocks.back()->push_back(replay.events[i]);
+    }
+    
+    double rows = run_replay(replay, [&](BookReconstructor& reconstructor) {
+        for (size_t base = 0; base < replay.events.size(); base += EventBlock::CAPACITY) {
+            size_t n = std::min(EventBlock::CAPACITY, replay.events.size() - base);
+            reconstructor.on_events(replay.events.data() + base, n);
+        }
+    });
+    double columns = run_replay(replay, [&](BookReconstructor& reconstructor) {
+        for (const auto& block : blocks) {
+            reconstructor.on_events(*block);
+        }
+    });
+    std::printf("apply %zu events on %zu resting orders\n", replay.events.size(), resting);
+    std::printf("  Event[]     %8.1f ns/event\n", rows * 1e9 / replay.events.size());
+    std::printf("  EventBlock  %8.1f ns/event\n", columns * 1e9 / replay.events.size());
+    return 0;
+}
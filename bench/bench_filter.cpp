@@ -0,0 +1,150 @@
+// Parser throughput with a RecordFilter: every record parsed, against a
+// narrow time window and a single action, and with stop_after() ending
+// the input at 10% of the time range, next to a bare
+// memchr pass over the file (the bandwidth ceiling for any parser that
+// must find every newline). Warm page cache; without a file argument a
+// synthetic MBO file is written to /tmp first.
+//
+//   make microbench && ./bench_filter [mbo.csv]
+
+#include "../src/csv_parser.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+constexpr size_t SYNTHETIC_ROWS = 2000000;
+constexpr uint64_t FIRST_TIMESTAMP = 1700000000000000000ULL;
+constexpr uint64_t TIMESTAMP_STEP = 10000;
+
+void write_synthetic(const char* path) {
+    FILE* file = std::fopen(path, "w");
+    if (!file) {
+        std::perror(path);
+        std::exit(1);
+    }
+    std::fprintf(file, "ts_event,action,side,price,size,order_id,flags,ts_recv,ts_in_delta,sequence\n");
+    std::mt19937_64 rng(9);
+    const char actions[] = "AAAACCCCMTF";
+    for (size_t i = 0; i < SYNTHETIC_ROWS; ++i) {
+        uint64_t ts = FIRST_TIMESTAMP + i * TIMESTAMP_STEP;
+        std::fprintf(file, "%llu,%c,%c,%llu.%02llu,%llu,%llu,128,%llu,%llu,%zu\n",
+                     static_cast<unsigned long long>(ts), actions[rng() % (sizeof(actions) - 1)],
+                     rng() & 1 ? 'B' : 'A', static_cast<unsigned long long>(90 + rng() % 20),
+                     static_cast<unsigned long long>(rng() % 100),
+                     static_cast<unsigned long long>(1 + rng() % 500),
+                     static_cast<unsigned long long>(100000 + rng() % 1000000),
+                     static_cast<unsigned long long>(ts + 100), static_cast<unsigned long long>(rng() % 1000), i);
+    }
+    std::fclose(file);
+}
+
+template<typename Fn>
+double best_seconds(Fn fn) {
+    double best = 1e30;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+// Kept records and a checksum over them.
+size_t parse(const char* path, const RecordFilter* filter, uint64_t stop_after, uint64_t& checksum) {
+    FastCSVParser parser(path);
+    if (filter) {
+        parser.set_filter(*filter);
+    }
+    parser.stop_after(stop_after);
+    auto block = std::make_unique<EventBlock>();
+    size_t kept = 0;
+    checksum = 0;
+    while (parser.parse_events(*block) > 0) {
+        kept += block->count;
+        for (size_t i = 0; i < block->count; ++i) {
+            checksum += block->order_ids[i] ^ block->sizes[i];
+        }
+    }
+    return kept;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string path = argc > 1 ? argv[1] : "/tmp/bench_filter_mbo.csv";
+    if (argc <= 1) {
+        write_synthetic(path.c_str());
+    }
+    
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == -1) {
+        std::perror(path.c_str());
+        return 1;
+    }
+    double megabytes = sb.st_size / 1e6;
+    
+    // The time range, from a first pass that keeps everything.
+    uint64_t first = UINT64_MAX, last = 0;
+    {
+        FastCSVParser parser(path.c_str());
+        Event event;
+        while (parser.parse_next_event(event)) {
+            first = std::min(first, event.timestamp_ns);
+            last = std::max(last, event.timestamp_ns);
+        }
+    }
+    uint64_t span = last - first;
+    std::printf("%s: %.1f MB, best of %d, warm cache\n", path.c_str(), megabytes, REPETITIONS);
+    
+    size_t lines = 0;
+    double scan = best_seconds([&] {
+        int fd = open(path.c_str(), O_RDONLY);
+        char* data = static_cast<char*>(mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+        lines = 0;
+        for (const char* p = data; (p = static_cast<const char*>(
+                 std::memchr(p, '\n', data + sb.st_size - p))) != nullptr; ++p) {
+            ++lines;
+        }
+        munmap(data, sb.st_size);
+        close(fd);
+    });
+    std::printf("  %-22s %8.1f MB/s  (%zu lines)\n", "memchr newlines", megabytes / scan, lines);
+    
+    struct Case {
+        const char* label;
+        bool filtered;
+        RecordFilter filter;
+        uint64_t stop_after;
+    };
+    Case cases[] = {
+        {"no filter", false, RecordFilter(), UINT64_MAX},
+        {"1% time window", true, RecordFilter().between(first + span / 2, first + span / 2 + span / 100),
+         UINT64_MAX},
+        {"trades only (T)", true, RecordFilter().only_actions("T"), UINT64_MAX},
+        {"stop at 10%", false, RecordFilter(), first + span / 10},
+    };
+    for (const Case& c : cases) {
+        uint64_t checksum = 0;
+        size_t kept = 0;
+        double seconds = best_seconds([&] {
+            kept = parse(path.c_str(), c.filtered ? &c.filter : nullptr, c.stop_after, checksum);
+        });
+        std::printf("  %-22s %8.1f MB/s  (%zu kept, checksum %llx)\n", c.label, megabytes / seconds,
+                    kept, static_cast<unsigned long long>(checksum));
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Input throughput of the mmap parser against the io_uring one, with the
+// file evicted from the page cache before every run (cold) and with it
+// fully cached (warm). Eviction uses POSIX_FADV_DONTNEED, so no root is
+// needed, but only clean pages are dropped: sync after writing the file.
+//
+//   make microbench && ./bench_io <large_mbo.csv>
+
+#include "../src/csv_parser.hpp"
+#include "../src/uring_io.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+constexpr size_t EVENT_BLOCK_SIZE = 4096;
+
+void evict(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+template<typename Parser>
+double run(const char* filename, uint64_t& checksum) {
+    std::vector<Event> block(EVENT_BLOCK_SIZE);
+    auto start = std::chrono::steady_clock::now();
+    Parser parser(filename);
+    size_t count;
+    checksum = 0;
+    while ((count = parser.parse_events(block.data(), block.size())) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            checksum += block[i].order_id ^ block[i].size;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+template<typename Parser>
+void measure(const char* label, const char* filename, double megabytes, bool cold) {
+    double best = 1e30;
+    uint64_t checksum = 0;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        if (cold) evict(filename);
+        double seconds = run<Parser>(filename, checksum);
+        if (seconds < best) best = seconds;
+    }
+    std::printf("  %-10s %-5s %8.3f s  %8.1f MB/s  (checksum %llx)\n", label, cold ? "cold" : "warm",
+                best, megabytes / best, static_cast<unsigned long long>(checksum));
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <mbo.csv>\n", argv[0]);
+        return 1;
+    }
+    const char* filename = argv[1];
+    
+    struct stat sb;
+    if (stat(filename, &sb) == -1) {
+        std::perror(filename);
+        return 1;
+    }
+    double megabytes = sb.st_size / 1e6;
+    std::printf("%s: %.1f MB, best of %d\n", filename, megabytes, REPETITIONS);
+    
+    measure<FastCSVParser>("mmap", filename, megabytes, true);
+    measure<UringCSVParser>("io_uring", filename, megabytes, true);
+    
+    uint64_t checksum;
+    run<FastCSVParser>(filename, checksum);   // warm the cache
+    measure<FastCSVParser>("mmap", filename, megabytes, false);
+    measure<UringCSVParser>("io_uring", filename, megabytes, false);
+    return 0;
+}
@@ -0,0 +1,120 @@
+// L3 dump cost on a 1M-order book: what the apply thread pays per dump
+// (L3Dumper::dump, i.e. taking the book image) against the queue walk,
+// encode and write that the writer thread does for it, and the latency of
+// the events applied while that write is in progress next to those with no
+// dump running. On a single CPU the writer's time slices land in the tail.
+//
+//   make microbench && ./bench_l3_dump [resting_orders] [output_path]
+
+#include "../src/l3_dump.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int DUMPS = 6;
+constexpr size_t EVENTS = 50000;      // timed before and after each dump
+constexpr size_t LEVELS = 5000;       // per side
+
+int64_t random_price(std::mt19937_64& rng, char side) {
+    int64_t offset = static_cast<int64_t>(rng() % LEVELS) + 1;
+    return side == 'B' ? 1000000 - offset : 1000000 + offset;
+}
+
+struct Resting {
+    uint64_t id;
+    int64_t price;
+};
+
+void fill_book(OrderBook& book, std::vector<Resting>& live, size_t orders, std::mt19937_64& rng) {
+    for (size_t i = 0; i < orders; ++i) {
+        char side = (i & 1) ? 'A' : 'B';
+        int64_t price = random_price(rng, side);
+        book.add_order(1000000 + i, price, 100, side, i);
+        live.push_back({1000000 + i, price});
+    }
+}
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Applies EVENTS cancels, replacing adds and resizes anywhere in the book,
+// adding each one's time in microseconds to latencies.
+void apply_events(OrderBook& book, std::vector<Resting>& live, uint64_t& next_id,
+                  std::mt19937_64& rng, std::vector<double>& latencies) {
+    for (size_t i = 0; i < EVENTS; ++i) {
+        Resting& order = live[rng() % live.size()];
+        char side = (next_id & 1) ? 'A' : 'B';
+        int64_t price = random_price(rng, side);
+        uint32_t size = 1 + rng() % 200;
+        auto start = std::chrono::steady_clock::now();
+        if (i % 2 == 0) {
+            book.modify_order(order.id, order.price, size);
+        } else {
+            book.cancel_order(order.id);
+            book.add_order(next_id, price, 100, side, next_id);
+            order = {next_id++, price};
+        }
+        latencies.push_back(ms_since(start) * 1000);
+    }
+}
+
+void print_latencies(const char* when, std::vector<double>& latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("  events %s: p99.9 %.2f us, p99.99 %.2f us, max %.1f us\n", when,
+                latencies[latencies.size() * 999 / 1000], latencies[latencies.size() * 9999 / 10000],
+                latencies.back());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t orders = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const char* path = argc > 2 ? argv[2] : "/tmp/bench_l3_dump.bin";
+    
+    std::mt19937_64 rng(7);
+    std::vector<Resting> live;
+    auto book = std::make_unique<OrderBook>();
+    fill_book(*book, live, orders, rng);
+    uint64_t next_id = 1000000 + orders;
+    std::printf("%zu resting orders, %zu levels\n", book->get_active_orders(), book->get_price_levels());
+    
+    L3Dumper dumper(path);
+    double cold_ms = 0;
+    double warm_ms = 1e30;
+    std::vector<double> idle;
+    std::vector<double> dumping;
+    for (int i = 0; i < DUMPS; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));   // let the writer drain
+        apply_events(*book, live, next_id, rng, idle);
+        
+        auto start = std::chrono::steady_clock::now();
+        dumper.dump(*book, i + 1);
+        double ms = ms_since(start);
+        if (i == 0) {
+            cold_ms = ms;
+        } else {
+            warm_ms = std::min(warm_ms, ms);
+        }
+        apply_events(*book, live, next_id, rng, dumping);
+    }
+    auto start = std::chrono::steady_clock::now();
+    dumper.finish();
+    double drain_ms = ms_since(start);
+    
+    std::printf("  dump() on the apply thread: %.3f ms first, %.3f ms at best after\n", cold_ms, warm_ms);
+    print_latencies("with no dump running", idle);
+    print_latencies("while a dump is written", dumping);
+    std::printf("  writer thread finishing the last dump: %.2f ms\n", drain_ms);
+    std::remove(path);
+    return 0;
+}
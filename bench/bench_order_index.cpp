@@ -0,0 +1,155 @@
+// OrderIdIndex (hash vs dense window) against a bare robin_hood map on
+// order-id traces: each order is inserted, looked up once (modify) and
+// erased (cancel). Pass an MBO CSV to replay its A/M/C order ids instead
+// of the synthetic distributions.
+//
+//   make microbench && ./bench_order_index [mbo.csv]
+
+#include "../src/order_index.hpp"
+#include "../src/csv_parser.hpp"
+#include "../include/robin_hood.h"
+#include <chrono>
+#include <cstdio>
+#include <queue>
+#include <random>
+#include <vector>
+#include <functional>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+
+struct Op {
+    char     action;   // A insert, M find, C find + erase
+    uint64_t order_id;
+};
+
+// Orders arrive from `streams` independent id sequences spaced far apart;
+// lifetimes are exponential around `mean_live` steps with a long-lived tail.
+std::vector<Op> make_trace(size_t orders, size_t mean_live, int streams, bool random_ids) {
+    std::mt19937_64 rng(11);
+    std::exponential_distribution<double> lifetime(1.0 / mean_live);
+    std::vector<uint64_t> next_id(streams);
+    for (int s = 0; s < streams; ++s) {
+        next_id[s] = 6000000000000ULL + static_cast<uint64_t>(s) * (1ULL << 40);
+    }
+    
+    using Expiry = std::pair<uint64_t, uint64_t>;   // (step, order_id)
+    std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry>> expiries;
+    std::vector<Op> ops;
+    ops.reserve(orders * 3);
+    
+    for (uint64_t step = 0; step < orders; ++step) {
+        uint64_t id;
+        if (random_ids) {
+            id = rng();
+        } else {
+            int s = static_cast<int>(rng() % streams);
+            next_id[s] += 1 + rng() % 3;
+            id = next_id[s];
+        }
+        ops.push_back({'A', id});
+        
+        uint64_t life = static_cast<uint64_t>(lifetime(rng));
+        if (rng() % 100 == 0) life *= 50;
+        expiries.push({step + 1 + life, id});
+        
+        while (!expiries.empty() && expiries.top().first <= step) {
+            ops.push_back({'M', expiries.top().second});
+            ops.push_back({'C', expiries.top().second});
+            expiries.pop();
+        }
+    }
+    return ops;
+}
+
+std::vector<Op> load_trace(const char* filename) {
+    FastCSVParser parser(filename);
+    std::vector<Op> ops;
+    Event event;
+    while (parser.parse_next_event(event)) {
+        if (event.action == 'A' || event.action == 'M' || event.action == 'C') {
+            ops.push_back({event.action, event.order_id});
+        }
+    }
+    return ops;
+}
+
+template<typename Index>
+double replay(const std::vector<Op>& ops, Index& index, uint64_t& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    OrderIndex next = 0;
+    for (const Op& op : ops) {
+        if (op.action == 'A') {
+            index.insert(op.order_id, next++);
+        } else {
+            checksum += index.find(op.order_id);
+            if (op.action == 'C') index.erase(op.order_id);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// Adapts the bare robin_hood map to the OrderIdIndex calls used above.
+struct RobinHoodIndex {
+    robin_hood::unordered_flat_map<uint64_t, OrderIndex> map;
+    
+    RobinHoodIndex() { map.reserve(10000); }
+    void insert(uint64_t id, OrderIndex idx) { map[id] = idx; }
+    OrderIndex find(uint64_t id) const {
+        auto it = map.find(id);
+        return it == map.end() ? NULL_ORDER : it->second;
+    }
+    void erase(uint64_t id) { map.erase(id); }
+};
+
+template<typename MakeIndex>
+double best_of(const std::vector<Op>& ops, MakeIndex make, uint64_t& checksum) {
+    double best = 1e30;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        auto index = make();
+        best = std::min(best, replay(ops, *index, checksum));
+    }
+    return best;
+}
+
+void run(const char* name, const std::vector<Op>& ops) {
+    uint64_t checksum = 0;
+    double robin = best_of(ops, [] { return std::make_unique<RobinHoodIndex>(); }, checksum);
+    double hash = best_of(ops, [] { return std::make_unique<OrderIdIndex>(OrderIndexKind::Hash); }, checksum);
+    
+    size_t spilled = 0;
+    double dense = best_of(ops, [] { return std::make_unique<OrderIdIndex>(OrderIndexKind::Dense); }, checksum);
+    {
+        OrderIdIndex probe(OrderIndexKind::Dense);
+        uint64_t ignored = 0;
+        replay(ops, probe, ignored);
+        spilled = probe.fallback_size();
+    }
+    
+    printf("%-28s %10zu %9.1f %9.1f %9.1f %8.2fx %9zu\n", name, ops.size(),
+           ops.size() / robin / 1e6, ops.size() / hash / 1e6, ops.size() / dense / 1e6,
+           robin / dense, spilled);
+    if (checksum == 42) printf(" ");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    printf("%-28s %10s %9s %9s %9s %9s %9s\n", "trace (Mops/s)", "ops", "robin_hood",
+           "hash", "dense", "speedup", "fallback");
+    
+    if (argc > 1) {
+        run(argv[1], load_trace(argv[1]));
+        return 0;
+    }
+    
+    run("sequential, 1M live", make_trace(4000000, 1000000, 1, false));
+    run("sequential, 10k live", make_trace(4000000, 10000, 1, false));
+    run("4 interleaved streams", make_trace(4000000, 1000000, 4, false));
+    run("random 64-bit ids", make_trace(4000000, 1000000, 1, true));
+    return 0;
+}
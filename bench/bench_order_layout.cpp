@@ -0,0 +1,85 @@
+// Order footprint and cancel/fill throughput on a 1M-order book with the
+// hot Order / cold OrderInfo split.
+//
+//   make microbench && ./bench_order_layout [resting_orders]
+
+#include "../src/order_book.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+
+// Fills a book with `orders` resting orders of size 100 spread over
+// `levels` prices per side; returns the ids in a shuffled order.
+std::vector<uint64_t> fill_book(OrderBook& book, size_t orders, size_t levels) {
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> ids(orders);
+    for (size_t i = 0; i < orders; ++i) {
+        char side = (i & 1) ? 'A' : 'B';
+        int64_t offset = static_cast<int64_t>(rng() % levels) + 1;
+        int64_t price = side == 'B' ? 1000000 - offset : 1000000 + offset;
+        ids[i] = 1000000 + i;
+        book.add_order(ids[i], price, 100, side, i);
+    }
+    std::shuffle(ids.begin(), ids.end(), rng);
+    return ids;
+}
+
+double bench_cancels(size_t orders) {
+    auto book = std::make_unique<OrderBook>();
+    auto ids = fill_book(*book, orders, 5000);
+    ids.resize(ids.size() / 2);
+    
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t id : ids) {
+        book->cancel_order(id);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return ids.size() / std::chrono::duration<double>(end - start).count();
+}
+
+double bench_fills(size_t orders) {
+    auto book = std::make_unique<OrderBook>();
+    fill_book(*book, orders, 200);
+    
+    // Sweep the best ask with trades that each consume ~4 resting orders.
+    size_t filled = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (filled < orders / 4) {
+        auto [ask_px, ask_sz] = book->get_best_ask();
+        if (ask_sz == 0) break;
+        book->execute_trade(ask_px, 400, 'B');
+        filled += 4;
+    }
+    auto end = std::chrono::steady_clock::now();
+    return filled / std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t orders = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    
+    printf("sizeof(Order)     = %zu bytes (hot, per fill/cancel)\n", sizeof(Order));
+    printf("sizeof(OrderInfo) = %zu bytes (cold side table)\n", sizeof(OrderInfo));
+    printf("hot footprint of %zu live orders: %.1f MiB\n", orders, 
+           orders * sizeof(Order) / (1024.0 * 1024.0));
+    
+    double cancels = 0.0, fills = 0.0;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        cancels = std::max(cancels, bench_cancels(orders));
+        fills = std::max(fills, bench_fills(orders));
+    }
+    printf("cancel throughput: %.2f M orders/s (best of %d)\n", cancels / 1e6, REPETITIONS);
+    printf("fill throughput:   %.2f M orders/s (best of %d)\n", fills / 1e6, REPETITIONS);
+    return 0;
+}
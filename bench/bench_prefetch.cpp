@@ -0,0 +1,109 @@
+// Cancel/modify throughput on a deep book with and without lookahead
+// prefetching of order lookups (ActionEngine::prefetch_event).
+//
+//   make microbench && ./bench_prefetch [resting_orders] [events] [levels_per_side]
+
+#include "../src/order_book.hpp"
+#include "../src/action_engine.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+
+struct RestingOrder {
+    uint64_t order_id;
+    int64_t  price_raw;
+    char     side;
+};
+
+std::vector<RestingOrder> make_book(size_t orders, size_t levels, std::mt19937_64& rng) {
+    std::vector<RestingOrder> book(orders);
+    for (size_t i = 0; i < orders; ++i) {
+        char side = (i & 1) ? 'A' : 'B';
+        int64_t offset = static_cast<int64_t>(rng() % levels) + 1;
+        book[i] = {1000000 + i, side == 'B' ? 1000000 - offset : 1000000 + offset, side};
+    }
+    // Insert in random order so pooled Orders are scattered relative to ids.
+    std::shuffle(book.begin(), book.end(), rng);
+    return book;
+}
+
+std::vector<Event> make_events(const std::vector<RestingOrder>& book, size_t count, 
+                               std::mt19937_64& rng) {
+    std::vector<size_t> victims(book.size());
+    for (size_t i = 0; i < victims.size(); ++i) victims[i] = i;
+    std::shuffle(victims.begin(), victims.end(), rng);
+    
+    std::vector<Event> events;
+    events.reserve(count);
+    for (size_t i = 0; i < count && i < victims.size(); ++i) {
+        const RestingOrder& o = book[victims[i]];
+        char action = (rng() & 1) ? 'C' : 'M';
+        events.emplace_back(i, action, o.side, o.price_raw, 50 + (rng() % 50), o.order_id);
+    }
+    return events;
+}
+
+double run(const std::vector<RestingOrder>& resting, const std::vector<Event>& events, 
+           size_t distance, size_t block_size) {
+    auto book = std::make_unique<OrderBook>();
+    ActionEngine engine(*book);
+    for (const RestingOrder& o : resting) {
+        book->add_order(o.order_id, o.price_raw, 100, o.side, 0);
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    for (size_t base = 0; base < events.size(); base += block_size) {
+        size_t count = std::min(block_size, events.size() - base);
+        const Event* block = events.data() + base;
+        size_t lead = std::min(distance, count);
+        for (size_t i = 0; i < lead; ++i) {
+            engine.prefetch_event(block[i]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (i + lead < count) {
+                engine.prefetch_event(block[i + lead]);
+            }
+            engine.process_event(block[i]);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t resting = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 500000;
+    size_t levels = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 50000;
+    
+    std::mt19937_64 rng(42);
+    auto book = make_book(resting, levels, rng);
+    auto events = make_events(book, count, rng);
+    
+    printf("resting orders: %zu over %zu levels/side, cancel/modify events: %zu (best of %d)\n", 
+           resting, levels, events.size(), REPETITIONS);
+    printf("%-10s %12s %12s %9s\n", "distance", "seconds", "Mevents/s", "speedup");
+    
+    double baseline = 0.0;
+    for (size_t distance : {0, 2, 4, 8, 16, 32}) {
+        double secs = run(book, events, distance, 4096);
+        for (int rep = 1; rep < REPETITIONS; ++rep) {
+            secs = std::min(secs, run(book, events, distance, 4096));
+        }
+        if (distance == 0) baseline = secs;
+        printf("%-10zu %12.4f %12.2f %8.2fx\n", distance, secs, 
+               events.size() / secs / 1e6, baseline / secs);
+    }
+    return 0;
+}
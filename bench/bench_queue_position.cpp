@@ -0,0 +1,130 @@
+// Cost of queue-position tracking on a 1M-order book: a mix of adds,
+// cancels, price moves and fills with no watched orders, with 64
+// watched orders spread over the book, and with 64 crowded onto the levels
+// the flow hits. Also the cost of a position query.
+//
+//   make microbench && ./bench_queue_position [resting_orders] [operations]
+
+#include "../src/order_book.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+constexpr size_t LEVELS = 200;
+constexpr size_t WATCHED = 64;
+
+enum class Watching { None, Spread, Crowded };
+
+double ops_per_second(size_t orders, size_t operations, Watching watching) {
+    auto book = std::make_unique<OrderBook>();
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> live;
+    live.reserve(orders + operations);
+    uint64_t next_id = 1;
+    
+    auto add = [&](int64_t offset) {
+        char side = (next_id & 1) ? 'A' : 'B';
+        int64_t price = side == 'B' ? 1000000 - offset : 1000000 + offset;
+        book->add_order(next_id, price, 100, side, next_id);
+        live.push_back(next_id++);
+    };
+    for (size_t i = 0; i < orders; ++i) {
+        add(static_cast<int64_t>(rng() % LEVELS) + 1);
+    }
+    
+    if (watching == Watching::Spread) {
+        for (size_t i = 0; i < WATCHED; ++i) {
+            book->watch_order(live[rng() % live.size()]);
+        }
+    } else if (watching == Watching::Crowded) {
+        // Orders about to arrive at the two levels nearest the touch.
+        for (size_t i = 0; i < WATCHED; ++i) {
+            book->watch_order(next_id + i);
+        }
+        for (size_t i = 0; i < WATCHED; ++i) {
+            add(1 + static_cast<int64_t>(i & 1));
+        }
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+        switch (rng() % 4) {
+            case 0:
+                add(static_cast<int64_t>(rng() % LEVELS) + 1);
+                break;
+            case 1: {
+                size_t pick = rng() % live.size();
+                book->cancel_order(live[pick]);
+                live[pick] = live.back();
+                live.pop_back();
+                break;
+            }
+            case 2: {
+                // Same-side move to a random level: re-queued at the back.
+                uint64_t id = live[rng() % live.size()];
+                int64_t offset = static_cast<int64_t>(rng() % LEVELS) + 1;
+                book->modify_order(id, (id & 1) ? 1000000 + offset : 1000000 - offset, 50);
+                break;
+            }
+            default: {
+                auto [ask_px, ask_sz] = book->get_best_ask();
+                if (ask_sz > 0) book->execute_trade(ask_px, 150, 'B');
+                break;
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return operations / std::chrono::duration<double>(end - start).count();
+}
+
+double query_ns(size_t queries) {
+    OrderBook book;
+    for (uint64_t id = 1; id <= WATCHED; ++id) {
+        book.watch_order(id);
+        book.add_order(id, 1000, 100, 'B', id);
+    }
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i) {
+        checksum += book.queue_position(1 + i % WATCHED)->size_ahead;
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (checksum == 1) std::printf(" ");
+    return std::chrono::duration<double, std::nano>(end - start).count() / queries;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t orders = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t operations = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000000;
+    
+    const struct {
+        const char* name;
+        Watching watching;
+    } cases[] = {
+        {"no watched orders", Watching::None},
+        {"64 watched, spread over the book", Watching::Spread},
+        {"64 watched at the touch", Watching::Crowded},
+    };
+    
+    std::printf("%zu resting orders, %zu operations\n", orders, operations);
+    for (const auto& c : cases) {
+        double best = 0;
+        for (int rep = 0; rep < REPETITIONS; ++rep) {
+            best = std::max(best, ops_per_second(orders, operations, c.watching));
+        }
+        std::printf("  %-34s %6.2f M ops/s\n", c.name, best / 1e6);
+    }
+    std::printf("  queue_position() query: %.1f ns\n", query_ns(10000000));
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Worst-case per-event latency while a book ramps to millions of live
+// orders: robin_hood (reserve(10000), as order_map_ used to be) against the
+// incrementally resized OrderIdIndex, then end-to-end OrderBook::add_order.
+//
+//   make microbench && ./bench_rehash [live_orders]
+
+#include "../src/order_book.hpp"
+#include "../include/robin_hood.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LatencyStats {
+    std::vector<uint32_t> samples_ns;
+    
+    void report(const char* name) {
+        std::sort(samples_ns.begin(), samples_ns.end());
+        size_t n = samples_ns.size();
+        size_t over_100us = static_cast<size_t>(
+            samples_ns.end() - std::upper_bound(samples_ns.begin(), samples_ns.end(), 100000u));
+        printf("%-24s %9u %9u %9u %11.1f %9zu\n", name, samples_ns[n / 2],
+               samples_ns[n * 999 / 1000], samples_ns[n * 99999 / 100000],
+               samples_ns.back() / 1000.0, over_100us);
+    }
+};
+
+// Ramps to `live` orders with near-sequential ids; every fourth step also
+// cancels an older order so the table sees churn while it grows.
+template<typename Insert, typename Erase>
+LatencyStats ramp(size_t live, Insert insert, Erase erase) {
+    LatencyStats stats;
+    stats.samples_ns.reserve(live + live / 3);
+    uint64_t next_id = 6000000000000ULL;
+    uint64_t cancel_id = next_id;
+    
+    for (size_t i = 0; i < live + live / 3; ++i) {
+        auto start = Clock::now();
+        if (i % 4 == 3) {
+            erase(cancel_id);
+            cancel_id += 6;
+        } else {
+            insert(next_id, static_cast<OrderIndex>(i));
+            next_id += 2;
+        }
+        auto end = Clock::now();
+        stats.samples_ns.push_back(static_cast<uint32_t>(
+            std::min<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                              UINT32_MAX)));
+    }
+    return stats;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t live = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    
+    printf("ramp to ~%zu live orders (ns; max in us)\n", live);
+    printf("%-24s %9s %9s %9s %11s %9s\n", "index", "p50", "p99.9", "p99.999", "max(us)", ">100us");
+    
+    {
+        robin_hood::unordered_flat_map<uint64_t, OrderIndex> map;
+        map.reserve(10000);
+        ramp(live, [&](uint64_t id, OrderIndex idx) { map[id] = idx; },
+             [&](uint64_t id) { map.erase(id); }).report("robin_hood");
+    }
+    {
+        OrderIdIndex index(OrderIndexKind::Hash);
+        ramp(live, [&](uint64_t id, OrderIndex idx) { index.insert(id, idx); },
+             [&](uint64_t id) { index.erase(id); }).report("OrderIdIndex hash");
+    }
+    {
+        OrderIdIndex index(OrderIndexKind::Dense);
+        ramp(live, [&](uint64_t id, OrderIndex idx) { index.insert(id, idx); },
+             [&](uint64_t id) { index.erase(id); }).report("OrderIdIndex dense");
+    }
+    {
+        auto book = std::make_unique<OrderBook>();
+        ramp(live, [&](uint64_t id, OrderIndex idx) { 
+                 book->add_order(id, 1000000 - (idx % 5000), 100, 'B', idx); 
+             },
+             [&](uint64_t id) { book->cancel_order(id); }).report("OrderBook add/cancel");
+    }
+    return 0;
+}
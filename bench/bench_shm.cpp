@@ -0,0 +1,115 @@
+// Shared-memory MBP feed: cost of publish + read on one thread, and the
+// publisher-to-reader handoff latency with the reader spinning on its own
+// thread (and its own mapping of the segment). The handoff numbers need a
+// core per side; on a single core they measure the scheduler instead.
+//
+//   make microbench && ./bench_shm [snapshots] [publish_interval_ns]
+
+#include "../src/shm_publisher.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace mbp_reconstructor;
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+constexpr const char* FEED_NAME = "/mbp_bench_shm";
+
+uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+double publish_read_ns(size_t count) {
+    ShmPublisher publisher(FEED_NAME);
+    ShmSubscriber subscriber(FEED_NAME);
+    MBPSnapshot snapshot, received;
+    uint64_t checksum = 0;
+    
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        snapshot.timestamp_ns = i;
+        snapshot.bid_sz[0] = i;
+        publisher.publish(snapshot);
+        if (subscriber.read_next(received) == ShmSubscriber::ReadResult::Ok) {
+            checksum += received.bid_sz[0];
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (checksum != count * (count - 1) / 2) {
+        std::fprintf(stderr, "read back the wrong snapshots\n");
+    }
+    return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+void handoff_latency(size_t count, uint64_t interval_ns) {
+    ShmPublisher publisher(FEED_NAME, 1 << 16);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    std::atomic<bool> ready{false};
+    std::atomic<bool> done{false};
+    size_t overruns = 0;
+    
+    std::thread reader([&] {
+        ShmSubscriber subscriber(FEED_NAME);
+        ready.store(true);
+        MBPSnapshot received;
+        while (true) {
+            auto result = subscriber.read_next(received);
+            if (result == ShmSubscriber::ReadResult::Ok) {
+                latencies.push_back(now_ns() - received.timestamp_ns);
+            } else if (result == ShmSubscriber::ReadResult::Overrun) {
+                ++overruns;
+            } else if (done.load(std::memory_order_acquire)) {
+                break;
+            }
+        }
+    });
+    while (!ready.load()) std::this_thread::yield();
+    
+    MBPSnapshot snapshot;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t due = now_ns() + interval_ns;
+        while (now_ns() < due) {}
+        snapshot.timestamp_ns = now_ns();
+        publisher.publish(snapshot);
+    }
+    done.store(true, std::memory_order_release);
+    reader.join();
+    
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) {
+        return latencies.empty() ? 0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+    std::printf("  handoff (%llu ns apart): p50 %llu ns  p99 %llu ns  p99.9 %llu ns  max %llu ns"
+                "  (%zu overruns)\n",
+                static_cast<unsigned long long>(interval_ns),
+                static_cast<unsigned long long>(pct(0.50)), static_cast<unsigned long long>(pct(0.99)),
+                static_cast<unsigned long long>(pct(0.999)), static_cast<unsigned long long>(pct(1.0)),
+                overruns);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    uint64_t interval_ns = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000;
+    
+    std::printf("%zu snapshots of %zu bytes, %u hardware threads\n",
+                count, sizeof(MBPSnapshot), std::thread::hardware_concurrency());
+    
+    double best = 1e30;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        best = std::min(best, publish_read_ns(count));
+    }
+    std::printf("  publish + read_next, same thread: %.1f ns\n", best);
+    
+    handoff_latency(std::min<size_t>(count, 200000), interval_ns);
+    return 0;
+}
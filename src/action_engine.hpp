@@ -20,6 +20,8 @@ private:
     TradeState trade_state_;
     std::optional<TradeInfo> pending_trade_;
     uint64_t last_trade_id_;
+    TradeInfo executed_trade_;
+    bool trade_executed_;
     
     uint64_t actions_processed_;
     uint64_t trades_aggregated_;
@@ -30,12 +32,13 @@ private:
 public:
     explicit ActionEngine(OrderBook& book) 
         : order_book_(book), trade_state_(TradeState::IDLE), 
-          last_trade_id_(0), actions_processed_(0), 
+          last_trade_id_(0), trade_executed_(false), actions_processed_(0), 
           trades_aggregated_(0), errors_encountered_(0),
           first_clear_seen_(false) {}
     
     bool process_event(const Event& event) {
         ++actions_processed_;
+        trade_executed_ = false;
         
         switch (event.action) {
             case 'A':
@@ -58,6 +61,30 @@ public:
         }
     }
     
+    // Issued K events ahead of process_event() when events arrive in blocks.
+    void prefetch_event(const Event& event) const noexcept {
+        if (looks_up_order(event.action, event.side)) {
+            order_book_.prefetch_order(event.order_id);
+        }
+    }
+    
+    // Whether a record finds a resting order by id: a cancel, or a modify
+    // on a book side (process_event() ignores modifies with side N).
+    // Branch-free, so a pass over a block's columns vectorizes.
+    static bool looks_up_order(char action, char side) noexcept {
+        return (action == 'C') | ((action == 'M') & (side != 'N'));
+    }
+    
+    void prefetch_order(uint64_t order_id) const noexcept {
+        order_book_.prefetch_order(order_id);
+    }
+    
+    // The trade the last process_event() call executed against the book
+    // (the C that completed a T+F+C sequence), or nullptr.
+    const TradeInfo* executed_trade() const noexcept {
+        return trade_executed_ ? &executed_trade_ : nullptr;
+    }
+    
     uint64_t get_actions_processed() const { return actions_processed_; }
     uint64_t get_trades_aggregated() const { return trades_aggregated_; }
     uint64_t get_errors_encountered() const { return errors_encountered_; }
@@ -167,16 +194,22 @@ private:
             return false;
         }
         
+        // A plain local rather than the optional's storage, which GCC
+        // cannot prove initialized across the inlined trade walk.
+        TradeInfo trade = *pending_trade_;
         bool success = order_book_.execute_trade(
-            pending_trade_->price_raw,
-            pending_trade_->size,
-            pending_trade_->side
+            trade.price_raw,
+            trade.size,
+            trade.side,
+            &trade.orders_filled
         );
         
         if (!success) {
             ++errors_encountered_;
         } else {
             ++trades_aggregated_;
+            executed_trade_ = trade;
+            trade_executed_ = true;
         }
         
         trade_state_ = TradeState::IDLE;
@@ -0,0 +1,579 @@
+#pragma once
+
+#include "order.hpp"
+#include "snapshot.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mbp_reconstructor {
+
+// Apache Arrow IPC output, written without the Arrow libraries: the
+// FlatBuffers metadata is encoded here, and the column buffers go to the
+// file as they are. Files load with pyarrow.ipc / pyarrow.feather /
+// polars.read_ipc with no parsing, and can be memory-mapped.
+namespace arrow_ipc {
+
+// Little-endian, as Arrow and FlatBuffers both are (x86-64, aarch64).
+template<typename T>
+void store(uint8_t* at, T value) noexcept { std::memcpy(at, &value, sizeof(T)); }
+
+// Writes a FlatBuffer front to back, so every table, string and vector a
+// table refers to comes after it, as FlatBuffers' unsigned offsets need.
+// table() leaves its references zero; fill each in with link() once its
+// target is written. Enough for the Arrow metadata, not a general builder.
+class FlatBuilder {
+public:
+    // A table field: size 1, 2, 4 or 8 with its value, or size 0 for a
+    // reference.
+    struct Slot {
+        uint16_t id;
+        uint8_t  size;
+        uint64_t value;
+    };
+    
+    struct Table {
+        size_t at;
+        std::vector<size_t> references;     // the size-0 slots, in order
+    };
+    
+private:
+    std::vector<uint8_t> buf_;
+    
+public:
+    FlatBuilder() : buf_(4, 0) {}          // the root offset, set by finish()
+    
+    // The vtable goes right in front of the table.
+    Table table(std::initializer_list<Slot> slots) {
+        uint16_t fields = 0;
+        for (const Slot& slot : slots) {
+            fields = std::max<uint16_t>(fields, slot.id + 1);
+        }
+        
+        // Widest fields first after the vtable offset; the table starts
+        // 8-aligned, so each field is aligned to its size.
+        std::vector<uint16_t> field_offsets(fields, 0);
+        size_t table_size = 4;
+        for (size_t width : {8, 4, 2, 1}) {
+            for (const Slot& slot : slots) {
+                if (slot_width(slot) != width) continue;
+                table_size = (table_size + width - 1) / width * width;
+                field_offsets[slot.id] = static_cast<uint16_t>(table_size);
+                table_size += width;
+            }
+        }
+        
+        size_t vtable_size = 4 + 2 * fields;
+        resize((buf_.size() + vtable_size + 7) / 8 * 8 - vtable_size);
+        size_t vtable = buf_.size();
+        size_t at = vtable + vtable_size;
+        resize(at + table_size);
+        store<uint16_t>(&buf_[vtable], static_cast<uint16_t>(vtable_size));
+        store<uint16_t>(&buf_[vtable + 2], static_cast<uint16_t>(table_size));
+        for (uint16_t id = 0; id < fields; ++id) {
+            store<uint16_t>(&buf_[vtable + 4 + 2 * id], field_offsets[id]);
+        }
+        store<int32_t>(&buf_[at], static_cast<int32_t>(at - vtable));
+        
+        Table table{at, {}};
+        for (const Slot& slot : slots) {
+            uint8_t* field = &buf_[at + field_offsets[slot.id]];
+            switch (slot.size) {
+                case 0: table.references.push_back(at + field_offsets[slot.id]); break;
+                case 1: store<uint8_t>(field, static_cast<uint8_t>(slot.value)); break;
+                case 2: store<uint16_t>(field, static_cast<uint16_t>(slot.value)); break;
+                case 4: store<uint32_t>(field, static_cast<uint32_t>(slot.value)); break;
+                default: store<uint64_t>(field, slot.value); break;
+            }
+        }
+        return table;
+    }
+    
+    size_t string(std::string_view text) {
+        resize((buf_.size() + 3) / 4 * 4);
+        size_t at = buf_.size();
+        resize(at + 4 + text.size() + 1);
+        store<uint32_t>(&buf_[at], static_cast<uint32_t>(text.size()));
+        std::memcpy(&buf_[at + 4], text.data(), text.size());
+        return at;
+    }
+    
+    // A vector of 8-aligned structs.
+    size_t struct_vector(const void* data, size_t count, size_t struct_size) {
+        resize((buf_.size() + 4 + 7) / 8 * 8 - 4);
+        size_t at = buf_.size();
+        resize(at + 4 + count * struct_size);
+        store<uint32_t>(&buf_[at], static_cast<uint32_t>(count));
+        if (count > 0) {
+            std::memcpy(&buf_[at + 4], data, count * struct_size);
+        }
+        return at;
+    }
+    
+    // A vector of count references, element i at element(vector, i).
+    size_t reference_vector(size_t count) {
+        resize((buf_.size() + 3) / 4 * 4);
+        size_t at = buf_.size();
+        resize(at + 4 + 4 * count);
+        store<uint32_t>(&buf_[at], static_cast<uint32_t>(count));
+        return at;
+    }
+    
+    static size_t element(size_t vector, size_t i) noexcept { return vector + 4 + 4 * i; }
+    
+    void link(size_t reference, size_t target) {
+        store<uint32_t>(&buf_[reference], static_cast<uint32_t>(target - reference));
+    }
+    
+    // Sets the root table; the result is padded to a multiple of 8.
+    std::vector<uint8_t> finish(size_t root) {
+        link(0, root);
+        resize((buf_.size() + 7) / 8 * 8);
+        return std::move(buf_);
+    }
+    
+private:
+    static size_t slot_width(const Slot& slot) noexcept { return slot.size == 0 ? 4 : slot.size; }
+    
+    void resize(size_t size) { buf_.resize(size, 0); }
+};
+
+// The column types the writers need. Char is a one-character Utf8
+// string, for trade sides.
+enum class ColumnType : uint8_t { TimestampNs, UInt32, UInt64, Float64, Char };
+
+struct Column {
+    std::string name;
+    ColumnType  type;
+    bool        nullable = false;
+};
+
+inline size_t value_width(ColumnType type) noexcept {
+    switch (type) {
+        case ColumnType::UInt32: return 4;
+        case ColumnType::Char:   return 1;
+        default:                 return 8;
+    }
+}
+
+// Identifiers from the Arrow format's Schema.fbs, Message.fbs and File.fbs.
+constexpr uint16_t METADATA_V5 = 4;
+constexpr uint8_t  HEADER_SCHEMA = 1;
+constexpr uint8_t  HEADER_RECORD_BATCH = 3;
+constexpr uint8_t  TYPE_INT = 2;
+constexpr uint8_t  TYPE_FLOATING_POINT = 3;
+constexpr uint8_t  TYPE_UTF8 = 5;
+constexpr uint8_t  TYPE_TIMESTAMP = 10;
+constexpr uint16_t PRECISION_DOUBLE = 2;
+constexpr uint16_t TIME_UNIT_NANOSECOND = 3;
+
+struct FieldNode {
+    int64_t length;
+    int64_t null_count;
+};
+
+struct BufferRef {
+    int64_t offset;                     // from the start of the message body
+    int64_t length;
+};
+
+struct Block {
+    int64_t offset;                     // of the message in the file
+    int32_t metadata_length;            // with its prefix and padding
+    int32_t padding;
+    int64_t body_length;
+};
+
+inline size_t add_type(FlatBuilder& fb, ColumnType type) {
+    switch (type) {
+        case ColumnType::TimestampNs: {
+            FlatBuilder::Table timestamp = fb.table({{0, 2, TIME_UNIT_NANOSECOND}, {1, 0, 0}});
+            fb.link(timestamp.references[0], fb.string("UTC"));
+            return timestamp.at;
+        }
+        case ColumnType::UInt32:
+            return fb.table({{0, 4, 32}, {1, 1, 0}}).at;
+        case ColumnType::UInt64:
+            return fb.table({{0, 4, 64}, {1, 1, 0}}).at;
+        case ColumnType::Float64:
+            return fb.table({{0, 2, PRECISION_DOUBLE}}).at;
+        default:
+            return fb.table({}).at;
+    }
+}
+
+inline uint8_t type_id(ColumnType type) noexcept {
+    switch (type) {
+        case ColumnType::TimestampNs: return TYPE_TIMESTAMP;
+        case ColumnType::Float64:     return TYPE_FLOATING_POINT;
+        case ColumnType::Char:        return TYPE_UTF8;
+        default:                      return TYPE_INT;
+    }
+}
+
+inline size_t add_schema(FlatBuilder& fb, const std::vector<Column>& columns) {
+    FlatBuilder::Table schema = fb.table({{1, 0, 0}});
+    size_t fields = fb.reference_vector(columns.size());
+    fb.link(schema.references[0], fields);
+    
+    for (size_t i = 0; i < columns.size(); ++i) {
+        const Column& column = columns[i];
+        // name, nullable, type (a union: its type id, then the table), children
+        FlatBuilder::Table field = fb.table({{0, 0, 0}, {1, 1, column.nullable},
+                                             {2, 1, type_id(column.type)}, {3, 0, 0}, {5, 0, 0}});
+        fb.link(FlatBuilder::element(fields, i), field.at);
+        fb.link(field.references[0], fb.string(column.name));
+        fb.link(field.references[1], add_type(fb, column.type));
+        fb.link(field.references[2], fb.reference_vector(0));
+    }
+    return schema.at;
+}
+
+inline std::vector<uint8_t> schema_message(const std::vector<Column>& columns) {
+    FlatBuilder fb;
+    FlatBuilder::Table message = fb.table({{0, 2, METADATA_V5}, {1, 1, HEADER_SCHEMA},
+                                           {2, 0, 0}, {3, 8, 0}});
+    fb.link(message.references[0], add_schema(fb, columns));
+    return fb.finish(message.at);
+}
+
+inline std::vector<uint8_t> record_batch_message(int64_t length, const std::vector<FieldNode>& nodes,
+                                                 const std::vector<BufferRef>& buffers,
+                                                 int64_t body_length) {
+    FlatBuilder fb;
+    FlatBuilder::Table message = fb.table({{0, 2, METADATA_V5}, {1, 1, HEADER_RECORD_BATCH},
+                                           {2, 0, 0}, {3, 8, static_cast<uint64_t>(body_length)}});
+    FlatBuilder::Table batch = fb.table({{0, 8, static_cast<uint64_t>(length)}, {1, 0, 0}, {2, 0, 0}});
+    fb.link(message.references[0], batch.at);
+    fb.link(batch.references[0], fb.struct_vector(nodes.data(), nodes.size(), sizeof(FieldNode)));
+    fb.link(batch.references[1], fb.struct_vector(buffers.data(), buffers.size(), sizeof(BufferRef)));
+    return fb.finish(message.at);
+}
+
+inline std::vector<uint8_t> footer(const std::vector<Column>& columns, const std::vector<Block>& batches) {
+    FlatBuilder fb;
+    FlatBuilder::Table footer = fb.table({{0, 2, METADATA_V5}, {1, 0, 0}, {2, 0, 0}, {3, 0, 0}});
+    fb.link(footer.references[0], add_schema(fb, columns));
+    fb.link(footer.references[1], fb.struct_vector(nullptr, 0, sizeof(Block)));
+    fb.link(footer.references[2], fb.struct_vector(batches.data(), batches.size(), sizeof(Block)));
+    return fb.finish(footer.at);
+}
+
+} // namespace arrow_ipc
+
+// Writes rows of fixed columns as Arrow record batches, filled in place:
+// store each column's value at values<T>(column)[row()], set_null() the
+// nullable ones that have none, then commit_row(). Every batch_rows rows
+// the batch goes out, its buffers written straight from the column
+// storage. The file format (Feather v2, with a footer for random access)
+// by default, or the stream format.
+class ArrowWriter {
+public:
+    static constexpr size_t DEFAULT_BATCH_ROWS = 65536;
+    
+private:
+    struct ColumnData {
+        std::vector<uint8_t> values;
+        std::vector<uint8_t> validity;  // nullable columns only
+        int64_t null_count = 0;
+    };
+    
+    static constexpr char MAGIC[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+    static constexpr uint32_t CONTINUATION = 0xFFFFFFFF;
+    
+    std::string path_;
+    int fd_;
+    bool stream_;
+    std::vector<arrow_ipc::Column> columns_;
+    std::vector<ColumnData> data_;
+    std::vector<int32_t> char_offsets_; // 0, 1, 2, ...: every Char column's offsets
+    size_t batch_rows_;
+    size_t row_;
+    uint64_t rows_;
+    uint64_t offset_;                   // bytes written so far
+    std::vector<arrow_ipc::Block> batches_;
+    bool finished_;
+    
+public:
+    ArrowWriter(const std::string& path, std::vector<arrow_ipc::Column> columns,
+                bool stream = false, size_t batch_rows = DEFAULT_BATCH_ROWS)
+        : path_(path), fd_(-1), stream_(stream), columns_(std::move(columns)),
+          batch_rows_(std::max<size_t>(batch_rows, 1)), row_(0), rows_(0), offset_(0),
+          finished_(false) {
+        data_.resize(columns_.size());
+        for (size_t i = 0; i < columns_.size(); ++i) {
+            data_[i].values.resize(batch_rows_ * arrow_ipc::value_width(columns_[i].type));
+            if (columns_[i].nullable) {
+                data_[i].validity.assign((batch_rows_ + 7) / 8, 0xFF);
+            }
+            if (columns_[i].type == arrow_ipc::ColumnType::Char && char_offsets_.empty()) {
+                char_offsets_.resize(batch_rows_ + 1);
+                for (size_t row = 0; row <= batch_rows_; ++row) {
+                    char_offsets_[row] = static_cast<int32_t>(row);
+                }
+            }
+        }
+        
+        fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ == -1) {
+            throw std::runtime_error("Failed to create " + path_);
+        }
+        if (!stream_) {
+            write_all(MAGIC, sizeof(MAGIC));
+        }
+        write_message(arrow_ipc::schema_message(columns_));
+    }
+    
+    ~ArrowWriter() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+    
+    ArrowWriter(const ArrowWriter&) = delete;
+    ArrowWriter& operator=(const ArrowWriter&) = delete;
+    
+    template<typename T>
+    T* values(size_t column) noexcept { return reinterpret_cast<T*>(data_[column].values.data()); }
+    
+    size_t row() const noexcept { return row_; }
+    
+    void set_null(size_t column) noexcept {
+        ColumnData& data = data_[column];
+        data.validity[row_ >> 3] &= static_cast<uint8_t>(~(1u << (row_ & 7)));
+        ++data.null_count;
+    }
+    
+    void commit_row() {
+        ++rows_;
+        if (++row_ == batch_rows_) {
+            write_batch();
+        }
+    }
+    
+    // Writes the rows in progress and the end of the stream (and file
+    // footer), and closes the file.
+    void finish() {
+        if (finished_) return;
+        finished_ = true;
+        
+        write_batch();
+        uint32_t end_of_stream[2] = {CONTINUATION, 0};
+        write_all(end_of_stream, sizeof(end_of_stream));
+        if (!stream_) {
+            std::vector<uint8_t> footer = arrow_ipc::footer(columns_, batches_);
+            int32_t footer_length = static_cast<int32_t>(footer.size());
+            write_all(footer.data(), footer.size());
+            write_all(&footer_length, sizeof(footer_length));
+            write_all(MAGIC, 6);
+        }
+        close(fd_);
+        fd_ = -1;
+    }
+    
+    uint64_t rows() const noexcept { return rows_; }
+    uint64_t batches() const noexcept { return batches_.size(); }
+    
+private:
+    static size_t padded(size_t size) noexcept { return (size + 7) / 8 * 8; }
+    
+    void write_batch() {
+        if (row_ == 0) return;
+        
+        struct Piece {
+            const void* data;
+            size_t size;
+        };
+        std::vector<arrow_ipc::FieldNode> nodes;
+        std::vector<arrow_ipc::BufferRef> buffers;
+        std::vector<Piece> pieces;
+        int64_t body_length = 0;
+        auto add_buffer = [&](const void* data, size_t size) {
+            buffers.push_back({body_length, static_cast<int64_t>(size)});
+            pieces.push_back({data, size});
+            body_length += static_cast<int64_t>(padded(size));
+        };
+        
+        int64_t length = static_cast<int64_t>(row_);
+        for (size_t i = 0; i < columns_.size(); ++i) {
+            const ColumnData& data = data_[i];
+            nodes.push_back({length, data.null_count});
+            // No validity bitmap when there are no nulls.
+            add_buffer(data.validity.data(), data.null_count > 0 ? (row_ + 7) / 8 : 0);
+            if (columns_[i].type == arrow_ipc::ColumnType::Char) {
+                add_buffer(char_offsets_.data(), (row_ + 1) * sizeof(int32_t));
+            }
+            add_buffer(data.values.data(), row_ * arrow_ipc::value_width(columns_[i].type));
+        }
+        
+        arrow_ipc::Block block{static_cast<int64_t>(offset_), 0, 0, body_length};
+        block.metadata_length = static_cast<int32_t>(
+            write_message(arrow_ipc::record_batch_message(length, nodes, buffers, body_length)));
+        static constexpr uint8_t zeros[8] = {};
+        for (const Piece& piece : pieces) {
+            write_all(piece.data, piece.size);
+            write_all(zeros, padded(piece.size) - piece.size);
+        }
+        batches_.push_back(block);
+        
+        row_ = 0;
+        for (ColumnData& data : data_) {
+            if (data.null_count > 0) {
+                std::fill(data.validity.begin(), data.validity.end(), 0xFF);
+                data.null_count = 0;
+            }
+        }
+    }
+    
+    // The encapsulated form: continuation marker, length, metadata padded
+    // to 8. Returns the bytes written.
+    size_t write_message(const std::vector<uint8_t>& metadata) {
+        uint32_t prefix[2] = {CONTINUATION, static_cast<uint32_t>(metadata.size())};
+        write_all(prefix, sizeof(prefix));
+        write_all(metadata.data(), metadata.size());
+        return sizeof(prefix) + metadata.size();
+    }
+    
+    void write_all(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = ::write(fd_, bytes + written, size - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Failed to write " + path_);
+            }
+            written += static_cast<size_t>(n);
+        }
+        offset_ += size;
+    }
+};
+
+// MBP-10 snapshots as Arrow columns named as in the CSV header
+// (CSVHeader::generate_mbp_header): ts_event a UTC nanosecond timestamp,
+// prices float64 and null on an empty level, sizes uint64, order counts
+// uint32, and the derived fields float64, null where the CSV leaves them
+// empty.
+class MBPArrowWriter {
+private:
+    bool order_counts_;
+    bool derived_;
+    ArrowWriter writer_;
+    
+public:
+    MBPArrowWriter(const std::string& path, bool order_counts = false, bool derived = false,
+                   bool stream = false, size_t batch_rows = ArrowWriter::DEFAULT_BATCH_ROWS)
+        : order_counts_(order_counts), derived_(derived),
+          writer_(path, columns(order_counts, derived), stream, batch_rows) {}
+    
+    void append(const MBPSnapshot& snapshot, const DerivedFields* derived = nullptr) {
+        size_t row = writer_.row();
+        writer_.values<uint64_t>(0)[row] = snapshot.timestamp_ns;
+        size_t column = 1;
+        append_side(snapshot.bid_px, snapshot.bid_sz, snapshot.bid_ct, column, row);
+        append_side(snapshot.ask_px, snapshot.ask_sz, snapshot.ask_ct, column, row);
+        
+        if (derived_) {
+            if (derived && derived->two_sided) {
+                writer_.values<double>(column)[row] = derived->mid;
+                writer_.values<double>(column + 1)[row] = derived->microprice;
+                writer_.values<double>(column + 2)[row] = derived->spread_raw / 100.0;
+            } else {
+                for (size_t i = column; i < column + 3; ++i) {
+                    writer_.values<double>(i)[row] = 0.0;
+                    writer_.set_null(i);
+                }
+            }
+            writer_.values<double>(column + 3)[row] = derived ? derived->imbalance : 0.0;
+        }
+        writer_.commit_row();
+    }
+    
+    void finish() { writer_.finish(); }
+    uint64_t rows() const noexcept { return writer_.rows(); }
+    
+    static std::vector<arrow_ipc::Column> columns(bool order_counts, bool derived) {
+        using arrow_ipc::ColumnType;
+        std::vector<arrow_ipc::Column> columns;
+        columns.push_back({"ts_event", ColumnType::TimestampNs, false});
+        for (const char* side : {"bid", "ask"}) {
+            for (int i = 0; i < 10; ++i) {
+                std::string level = "_" + CSVHeader::format_level_index(i);
+                columns.push_back({side + std::string("_px") + level, ColumnType::Float64, true});
+                columns.push_back({side + std::string("_sz") + level, ColumnType::UInt64, false});
+                if (order_counts) {
+                    columns.push_back({side + std::string("_ct") + level, ColumnType::UInt32, false});
+                }
+            }
+        }
+        if (derived) {
+            for (const char* name : {"mid", "microprice", "spread"}) {
+                columns.push_back({name, ColumnType::Float64, true});
+            }
+            columns.push_back({"imbalance", ColumnType::Float64, false});
+        }
+        return columns;
+    }
+    
+private:
+    void append_side(const int64_t* px, const uint64_t* sz, const uint32_t* ct,
+                     size_t& column, size_t row) {
+        for (int i = 0; i < 10; ++i) {
+            writer_.values<double>(column)[row] = px[i] / 100.0;
+            if (px[i] == 0) {
+                writer_.set_null(column);
+            }
+            writer_.values<uint64_t>(column + 1)[row] = sz[i];
+            column += 2;
+            if (order_counts_) {
+                writer_.values<uint32_t>(column++)[row] = ct[i];
+            }
+        }
+    }
+};
+
+// Aggregated trades as Arrow columns named as in the trades CSV
+// (CSVHeader::generate_trade_header).
+class TradeArrowWriter {
+private:
+    ArrowWriter writer_;
+    
+public:
+    explicit TradeArrowWriter(const std::string& path, bool stream = false,
+                              size_t batch_rows = ArrowWriter::DEFAULT_BATCH_ROWS)
+        : writer_(path, columns(), stream, batch_rows) {}
+    
+    void append(const TradeInfo& trade) {
+        size_t row = writer_.row();
+        writer_.values<uint64_t>(0)[row] = trade.timestamp_ns;
+        writer_.values<double>(1)[row] = trade.price_raw / 100.0;
+        writer_.values<uint32_t>(2)[row] = trade.size;
+        writer_.values<char>(3)[row] = trade.side;
+        writer_.values<uint32_t>(4)[row] = trade.orders_filled;
+        writer_.commit_row();
+    }
+    
+    void finish() { writer_.finish(); }
+    uint64_t rows() const noexcept { return writer_.rows(); }
+    
+    static std::vector<arrow_ipc::Column> columns() {
+        using arrow_ipc::ColumnType;
+        return {{"ts_event", ColumnType::TimestampNs, false},
+                {"price", ColumnType::Float64, false},
+                {"size", ColumnType::UInt32, false},
+                {"side", ColumnType::Char, false},
+                {"orders_filled", ColumnType::UInt32, false}};
+    }
+};
+
+} // namespace mbp_reconstructor
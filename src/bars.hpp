@@ -0,0 +1,227 @@
+#pragma once
+
+#include "order.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace mbp_reconstructor {
+
+// One interval of trades and top-of-book quotes.
+struct Bar {
+    uint64_t start_ns = 0;          // the interval is [start_ns, start_ns + interval)
+    uint32_t trades = 0;            // trade fields are unset when 0
+    int64_t  open_raw = 0;
+    int64_t  high_raw = 0;
+    int64_t  low_raw = 0;
+    int64_t  close_raw = 0;
+    uint64_t volume = 0;
+    double   vwap = 0.0;
+    bool     quoted = false;        // two-sided at some point; spread fields unset otherwise
+    bool     two_sided_close = false;
+    double   mid_close = 0.0;       // as of the end of the interval, if two_sided_close
+    double   spread_avg_raw = 0.0;  // time-weighted over the two-sided part of the interval
+    int64_t  spread_min_raw = 0;
+    int64_t  spread_max_raw = 0;
+};
+
+// Builds time bars inline from the aggregated trades (BookListener::on_trade)
+// and level-0 changes (on_book_change with a level-0 bit in the mask), both
+// fed in timestamp order. The quote statistics assume every level-0 change
+// is seen, so the book changes must not be sampled or conflated. Each call closes the bar in progress when its
+// timestamp is past that bar's interval and returns it, so bars come out
+// as the replay goes with no second pass. Intervals without a trade or
+// quote change produce no bar.
+class BarBuilder {
+private:
+    uint64_t interval_ns_;
+    bool open_;                     // a bar is in progress
+    Bar bar_;
+    Bar completed_;
+    double notional_;               // sum of price_raw * size
+    
+    // The quote in force, carried across bars.
+    bool two_sided_;
+    int64_t bid_raw_;
+    int64_t ask_raw_;
+    uint64_t quote_since_ns_;       // start of the current quote's stretch within bar_
+    double spread_area_;            // spread_raw * ns over bar_
+    uint64_t two_sided_ns_;
+    
+public:
+    explicit BarBuilder(uint64_t interval_ns)
+        : interval_ns_(interval_ns), open_(false), notional_(0.0),
+          two_sided_(false), bid_raw_(0), ask_raw_(0), quote_since_ns_(0),
+          spread_area_(0.0), two_sided_ns_(0) {}
+    
+    uint64_t interval_ns() const noexcept { return interval_ns_; }
+    
+    // Each returns the bar the timestamp closed, if any, valid until the
+    // next call.
+    const Bar* on_trade(const TradeInfo& trade) {
+        const Bar* closed = advance(trade.timestamp_ns);
+        
+        if (bar_.trades == 0) {
+            bar_.open_raw = bar_.high_raw = bar_.low_raw = trade.price_raw;
+        } else {
+            bar_.high_raw = std::max(bar_.high_raw, trade.price_raw);
+            bar_.low_raw = std::min(bar_.low_raw, trade.price_raw);
+        }
+        bar_.close_raw = trade.price_raw;
+        bar_.volume += trade.size;
+        ++bar_.trades;
+        notional_ += static_cast<double>(trade.price_raw) * trade.size;
+        
+        return closed;
+    }
+    
+    const Bar* on_quote(const MBPSnapshot& snapshot) {
+        uint64_t ts = snapshot.timestamp_ns;
+        const Bar* closed = advance(ts);
+        
+        accumulate_spread(ts);
+        two_sided_ = snapshot.bid_sz[0] != 0 && snapshot.ask_sz[0] != 0;
+        bid_raw_ = snapshot.bid_px[0];
+        ask_raw_ = snapshot.ask_px[0];
+        if (two_sided_) {
+            note_spread();
+        }
+        
+        return closed;
+    }
+    
+    // Closes the bar in progress at the end of the input.
+    const Bar* finish() {
+        if (!open_) return nullptr;
+        close_bar();
+        return &completed_;
+    }
+    
+private:
+    const Bar* advance(uint64_t ts) {
+        const Bar* closed = nullptr;
+        if (open_ && ts >= bar_.start_ns + interval_ns_) {
+            close_bar();
+            closed = &completed_;
+        }
+        if (!open_) {
+            open_bar(ts / interval_ns_ * interval_ns_);
+        }
+        return closed;
+    }
+    
+    void open_bar(uint64_t start_ns) {
+        bar_ = Bar{};
+        bar_.start_ns = start_ns;
+        notional_ = 0.0;
+        quote_since_ns_ = start_ns;
+        spread_area_ = 0.0;
+        two_sided_ns_ = 0;
+        if (two_sided_) {
+            note_spread();
+        }
+        open_ = true;
+    }
+    
+    void close_bar() {
+        accumulate_spread(bar_.start_ns + interval_ns_);
+        
+        if (bar_.trades > 0) {
+            bar_.vwap = notional_ / bar_.volume / 100.0;
+        }
+        if (two_sided_) {
+            bar_.two_sided_close = true;
+            bar_.mid_close = (bid_raw_ + ask_raw_) / 200.0;
+        }
+        if (two_sided_ns_ > 0) {
+            bar_.spread_avg_raw = spread_area_ / two_sided_ns_;
+        }
+        
+        completed_ = bar_;
+        open_ = false;
+    }
+    
+    // Credits the quote in force up to ts. An out-of-order ts_event
+    // earlier than the stretch start leaves the clock where it is, so no
+    // stretch is credited twice.
+    void accumulate_spread(uint64_t ts) {
+        if (ts <= quote_since_ns_) return;
+        if (two_sided_) {
+            spread_area_ += static_cast<double>(ask_raw_ - bid_raw_) * (ts - quote_since_ns_);
+            two_sided_ns_ += ts - quote_since_ns_;
+        }
+        quote_since_ns_ = ts;
+    }
+    
+    void note_spread() {
+        int64_t spread = ask_raw_ - bid_raw_;
+        if (!bar_.quoted) {
+            bar_.spread_min_raw = bar_.spread_max_raw = spread;
+            bar_.quoted = true;
+        } else {
+            bar_.spread_min_raw = std::min(bar_.spread_min_raw, spread);
+            bar_.spread_max_raw = std::max(bar_.spread_max_raw, spread);
+        }
+    }
+};
+
+// One CSV row per bar (CSVHeader::generate_bar_header), prices in the MBP
+// rows' format.
+class BarFormatter {
+private:
+    char buffer_[64];
+    
+public:
+    std::string format_bar(const Bar& bar) {
+        std::string result;
+        result.reserve(128);
+        
+        result += std::to_string(bar.start_ns);
+        if (bar.trades > 0) {
+            result += ',';
+            result += MBPFormatter::price_to_string(bar.open_raw);
+            result += ',';
+            result += MBPFormatter::price_to_string(bar.high_raw);
+            result += ',';
+            result += MBPFormatter::price_to_string(bar.low_raw);
+            result += ',';
+            result += MBPFormatter::price_to_string(bar.close_raw);
+        } else {
+            result += ",,,,";
+        }
+        result += ',';
+        result += std::to_string(bar.volume);
+        result += ',';
+        result += std::to_string(bar.trades);
+        result += ',';
+        if (bar.trades > 0) {
+            append_double("%.4f", bar.vwap, result);
+        }
+        result += ',';
+        if (bar.two_sided_close) {
+            append_double("%.3f", bar.mid_close, result);
+        }
+        if (bar.quoted) {
+            result += ',';
+            append_double("%.4f", bar.spread_avg_raw / 100.0, result);
+            result += ',';
+            result += MBPFormatter::price_to_string(bar.spread_min_raw);
+            result += ',';
+            result += MBPFormatter::price_to_string(bar.spread_max_raw);
+        } else {
+            result += ",,,";
+        }
+        result += '\n';
+        return result;
+    }
+    
+private:
+    void append_double(const char* format, double value, std::string& result) {
+        int n = snprintf(buffer_, sizeof(buffer_), format, value);
+        result.append(buffer_, n);
+    }
+};
+
+} // namespace mbp_reconstructor
@@ -0,0 +1,364 @@
+#pragma once
+
+#include "stream_parser.hpp"
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef MBP_HAVE_ZSTD
+#include <zstd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace mbp_reconstructor {
+
+enum class Compression { None, Gzip, Zstd };
+
+// Sniffs the magic bytes of a regular file; pipes and stdin can't be
+// peeked without consuming them, so those go by the file extension.
+inline Compression detect_compression(const char* path) {
+    auto has_suffix = [path](const char* suffix) {
+        size_t n = std::strlen(path), m = std::strlen(suffix);
+        return n >= m && std::strcmp(path + n - m, suffix) == 0;
+    };
+    
+    unsigned char magic[4] = {};
+    int fd = std::strcmp(path, "-") == 0 ? -1 : open(path, O_RDONLY);
+    if (fd != -1) {
+        struct stat sb;
+        bool regular = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+        ssize_t n = regular ? pread(fd, magic, sizeof(magic), 0) : -1;
+        close(fd);
+        if (n >= 0) {
+            if (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) return Compression::Gzip;
+            if (n == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) {
+                return Compression::Zstd;
+            }
+            return Compression::None;
+        }
+    }
+    
+    if (has_suffix(".gz")) return Compression::Gzip;
+    if (has_suffix(".zst")) return Compression::Zstd;
+    return Compression::None;
+}
+
+// Inflates gzip (or zlib) input, including files of several concatenated
+// gzip members as written by pigz or by appending to a .gz.
+class GzipSource {
+private:
+    static constexpr size_t INPUT_BUFFER_SIZE = 256 * 1024;
+    
+    FdSource input_;
+    std::unique_ptr<z_stream> stream_;    // zlib keeps a pointer back to it
+    std::unique_ptr<unsigned char[]> in_;
+    bool in_member_;
+    
+public:
+    explicit GzipSource(FdSource input)
+        : input_(std::move(input)), stream_(std::make_unique<z_stream>()),
+          in_(std::make_unique<unsigned char[]>(INPUT_BUFFER_SIZE)), in_member_(false) {
+        std::memset(stream_.get(), 0, sizeof(z_stream));
+        if (inflateInit2(stream_.get(), 15 + 32) != Z_OK) {     // +32: detect gzip/zlib header
+            throw std::runtime_error("Failed to initialise gzip decoder");
+        }
+    }
+    
+    GzipSource(GzipSource&&) = default;
+    
+    ~GzipSource() {
+        if (stream_) {
+            inflateEnd(stream_.get());
+        }
+    }
+    
+    size_t read(char* buffer, size_t capacity) {
+        z_stream& zs = *stream_;
+        zs.next_out = reinterpret_cast<Bytef*>(buffer);
+        zs.avail_out = static_cast<uInt>(capacity);
+        
+        while (zs.avail_out == capacity) {
+            if (zs.avail_in == 0) {
+                size_t n = input_.read(reinterpret_cast<char*>(in_.get()), INPUT_BUFFER_SIZE);
+                if (n == 0) {
+                    if (in_member_) {
+                        throw std::runtime_error("Truncated gzip input");
+                    }
+                    return 0;
+                }
+                zs.next_in = in_.get();
+                zs.avail_in = static_cast<uInt>(n);
+            }
+            
+            int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                inflateReset(&zs);          // another member may follow
+                in_member_ = false;
+            } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+                in_member_ = true;
+            } else {
+                throw std::runtime_error("Corrupt gzip input");
+            }
+        }
+        return capacity - zs.avail_out;
+    }
+};
+
+#ifdef MBP_HAVE_ZSTD
+
+// Decompresses the frames of a multi-frame zstd file (zstd -T, pzstd,
+// concatenated archives) on worker threads, at most a window of frames
+// ahead of the reader, and hands their output over in file order.
+class ParallelZstdDecoder {
+private:
+    static constexpr unsigned MAX_WORKERS = 8;
+    static constexpr size_t   FRAMES_PER_WORKER = 2;     // read-ahead window
+    
+    struct Frame {
+        const char*       data;
+        size_t            size;
+        std::vector<char> output;
+        bool              done = false;
+        std::string       error;
+    };
+    
+    const char* map_;
+    size_t map_size_;
+    std::vector<Frame> frames_;
+    size_t window_;
+    
+    std::mutex mutex_;
+    std::condition_variable frame_done_;
+    std::condition_variable window_moved_;
+    size_t next_claim_;        // first frame no worker has taken yet
+    size_t next_read_;         // first frame the reader has not taken yet
+    bool stopping_;
+    std::vector<std::thread> workers_;
+    
+    std::vector<char> current_;
+    size_t current_pos_;
+    
+public:
+    // Maps the file and splits it into frames. The file must be regular;
+    // frame boundaries come from the headers, without decompressing.
+    explicit ParallelZstdDecoder(int fd)
+        : map_(nullptr), map_size_(0), window_(0), next_claim_(0), next_read_(0),
+          stopping_(false), current_pos_(0) {
+        struct stat sb;
+        if (fstat(fd, &sb) == -1) {
+            throw std::runtime_error("Failed to get file size");
+        }
+        map_size_ = sb.st_size;
+        if (map_size_ > 0) {
+            void* map = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                throw std::runtime_error("Failed to mmap file");
+            }
+            map_ = static_cast<const char*>(map);
+            madvise(const_cast<char*>(map_), map_size_, MADV_SEQUENTIAL);
+        }
+        
+        for (size_t pos = 0; pos < map_size_;) {
+            size_t n = ZSTD_findFrameCompressedSize(map_ + pos, map_size_ - pos);
+            if (ZSTD_isError(n)) {
+                release_map();
+                throw std::runtime_error("Corrupt zstd input");
+            }
+            frames_.push_back(Frame{map_ + pos, n, {}, false, {}});
+            pos += n;
+        }
+    }
+    
+    ~ParallelZstdDecoder() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        window_moved_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+        release_map();
+    }
+    
+    ParallelZstdDecoder(const ParallelZstdDecoder&) = delete;
+    ParallelZstdDecoder& operator=(const ParallelZstdDecoder&) = delete;
+    
+    size_t frame_count() const noexcept { return frames_.size(); }
+    
+    void start() {
+        unsigned workers = std::max(1u, std::min(MAX_WORKERS, std::thread::hardware_concurrency()));
+        window_ = workers * FRAMES_PER_WORKER;
+        for (unsigned i = 0; i < workers; ++i) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+    
+    size_t read(char* buffer, size_t capacity) {
+        while (current_pos_ == current_.size()) {
+            if (next_read_ == frames_.size()) {
+                return 0;
+            }
+            
+            std::unique_lock<std::mutex> lock(mutex_);
+            Frame& frame = frames_[next_read_];
+            frame_done_.wait(lock, [&frame] { return frame.done; });
+            if (!frame.error.empty()) {
+                throw std::runtime_error(frame.error);
+            }
+            current_ = std::move(frame.output);
+            frame.output = std::vector<char>();
+            current_pos_ = 0;
+            ++next_read_;
+            lock.unlock();
+            window_moved_.notify_all();
+        }
+        
+        size_t n = std::min(capacity, current_.size() - current_pos_);
+        std::memcpy(buffer, current_.data() + current_pos_, n);
+        current_pos_ += n;
+        return n;
+    }
+    
+private:
+    void work() {
+        std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        while (true) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                window_moved_.wait(lock, [this] {
+                    return stopping_ || next_claim_ == frames_.size() ||
+                           next_claim_ < next_read_ + window_;
+                });
+                if (stopping_ || next_claim_ == frames_.size()) return;
+                index = next_claim_++;
+            }
+            
+            std::vector<char> output;
+            std::string error;
+            decompress(dctx.get(), frames_[index], output, error);
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                frames_[index].output = std::move(output);
+                frames_[index].error = std::move(error);
+                frames_[index].done = true;
+            }
+            frame_done_.notify_all();
+        }
+    }
+    
+    static void decompress(ZSTD_DCtx* dctx, const Frame& frame, std::vector<char>& output,
+                           std::string& error) {
+        unsigned long long content_size = ZSTD_getFrameContentSize(frame.data, frame.size);
+        if (content_size == ZSTD_CONTENTSIZE_ERROR) {
+            error = "Corrupt zstd frame";
+            return;
+        }
+        output.resize(content_size == ZSTD_CONTENTSIZE_UNKNOWN ? ZSTD_DStreamOutSize()
+                                                               : static_cast<size_t>(content_size));
+        
+        ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+        ZSTD_inBuffer in = {frame.data, frame.size, 0};
+        size_t filled = 0;
+        size_t ret = 1;
+        while (ret != 0) {
+            if (filled == output.size()) {
+                output.resize(output.size() * 2 + ZSTD_DStreamOutSize());
+            }
+            ZSTD_outBuffer out = {output.data(), output.size(), filled};
+            ret = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(ret)) {
+                error = std::string("zstd: ") + ZSTD_getErrorName(ret);
+                return;
+            }
+            filled = out.pos;
+            if (ret != 0 && in.pos == in.size && out.pos < out.size) {
+                error = "Truncated zstd frame";
+                return;
+            }
+        }
+        output.resize(filled);
+    }
+    
+    void release_map() noexcept {
+        if (map_) {
+            munmap(const_cast<char*>(map_), map_size_);
+            map_ = nullptr;
+        }
+    }
+};
+
+// Streams zstd input. A regular file holding several frames is handed to
+// ParallelZstdDecoder; a single frame, a pipe or a followed file is
+// decompressed in line on the parser thread.
+class ZstdSource {
+private:
+    FdSource input_;
+    std::unique_ptr<ParallelZstdDecoder> parallel_;
+    std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx_;
+    std::vector<char> in_;
+    ZSTD_inBuffer in_pos_;
+    size_t frame_remaining_;      // last ZSTD_decompressStream hint, 0 between frames
+    
+public:
+    explicit ZstdSource(FdSource input, bool allow_parallel = true)
+        : input_(std::move(input)), dctx_(ZSTD_createDCtx(), ZSTD_freeDCtx),
+          in_(ZSTD_DStreamInSize()), in_pos_{in_.data(), 0, 0}, frame_remaining_(0) {
+        if (!dctx_) {
+            throw std::bad_alloc();
+        }
+        
+        struct stat sb;
+        if (allow_parallel && fstat(input_.fd(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+            auto decoder = std::make_unique<ParallelZstdDecoder>(input_.fd());
+            if (decoder->frame_count() > 1) {
+                decoder->start();
+                parallel_ = std::move(decoder);
+            }
+        }
+    }
+    
+    ZstdSource(ZstdSource&&) = default;
+    
+    size_t read(char* buffer, size_t capacity) {
+        if (parallel_) {
+            return parallel_->read(buffer, capacity);
+        }
+        
+        ZSTD_outBuffer out = {buffer, capacity, 0};
+        while (out.pos == 0) {
+            if (in_pos_.pos == in_pos_.size) {
+                size_t n = input_.read(in_.data(), in_.size());
+                if (n == 0) {
+                    if (frame_remaining_ != 0) {
+                        throw std::runtime_error("Truncated zstd input");
+                    }
+                    return 0;
+                }
+                in_pos_ = ZSTD_inBuffer{in_.data(), n, 0};
+            }
+            
+            frame_remaining_ = ZSTD_decompressStream(dctx_.get(), &out, &in_pos_);
+            if (ZSTD_isError(frame_remaining_)) {
+                throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(frame_remaining_));
+            }
+        }
+        return out.pos;
+    }
+};
+
+#endif // MBP_HAVE_ZSTD
+
+} // namespace mbp_reconstructor
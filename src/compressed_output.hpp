@@ -0,0 +1,294 @@
+#pragma once
+
+#include <zlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef MBP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace mbp_reconstructor {
+
+enum class OutputCodec { Gzip, Zstd };
+
+// Output sink that compresses on a pool of background threads.
+//
+// Rows are appended to a frame buffer on the caller's thread; a full frame
+// is queued, compressed by whichever worker picks it up into an independent
+// gzip member or zstd frame, and written by a writer thread strictly in
+// queue order. The concatenation is a valid .gz/.zst file, and
+// ParallelZstdDecoder can split it back into frames. The caller only waits
+// when more than a window of frames is already queued.
+class CompressedWriter {
+public:
+    static constexpr size_t FRAME_SIZE = 4 << 20;
+    
+private:
+    struct Frame {
+        std::vector<char> input;
+        std::vector<char> output;
+        bool claimed = false;
+        bool compressed = false;
+    };
+    
+    int fd_;
+    OutputCodec codec_;
+    int level_;
+    size_t max_queued_;
+    
+    std::unique_ptr<Frame> filling_;
+    
+    std::mutex mutex_;
+    std::condition_variable work_ready_;     // workers: a frame to compress
+    std::condition_variable frame_done_;     // writer: the head frame is compressed
+    std::condition_variable space_freed_;    // caller: the queue has room
+    std::deque<std::unique_ptr<Frame>> queue_;
+    std::vector<std::unique_ptr<Frame>> spare_;
+    bool closing_;
+    std::string error_;
+    
+    std::vector<std::thread> workers_;
+    std::thread writer_;
+    bool finished_;
+    
+public:
+    // threads == 0 picks one per core, leaving one for the apply loop.
+    CompressedWriter(int fd, OutputCodec codec, int level, unsigned threads = 0)
+        : fd_(fd), codec_(codec), level_(level), closing_(false), finished_(false) {
+#ifndef MBP_HAVE_ZSTD
+        if (codec_ == OutputCodec::Zstd) {
+            throw std::runtime_error("zstd output needs a build with libzstd (make ZSTD=1)");
+        }
+#endif
+        if (threads == 0) {
+            unsigned cores = std::thread::hardware_concurrency();
+            threads = cores > 1 ? cores - 1 : 1;
+        }
+        max_queued_ = threads * 2 + 1;
+        
+        filling_ = std::make_unique<Frame>();
+        filling_->input.reserve(FRAME_SIZE);
+        
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { compress_frames(); });
+        }
+        writer_ = std::thread([this] { write_frames(); });
+    }
+    
+    ~CompressedWriter() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+    
+    CompressedWriter(const CompressedWriter&) = delete;
+    CompressedWriter& operator=(const CompressedWriter&) = delete;
+    
+    void write(std::string_view text) {
+        filling_->input.insert(filling_->input.end(), text.begin(), text.end());
+        if (filling_->input.size() >= FRAME_SIZE) {
+            flush();
+        }
+    }
+    
+    // Queues the rows buffered so far as a frame of their own.
+    void flush() {
+        if (filling_->input.empty()) return;
+        
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_freed_.wait(lock, [this] { return queue_.size() < max_queued_ || !error_.empty(); });
+        if (!error_.empty()) {
+            throw std::runtime_error(error_);
+        }
+        
+        queue_.push_back(std::move(filling_));
+        if (!spare_.empty()) {
+            filling_ = std::move(spare_.back());
+            spare_.pop_back();
+        } else {
+            filling_ = std::make_unique<Frame>();
+            filling_->input.reserve(FRAME_SIZE);
+        }
+        lock.unlock();
+        work_ready_.notify_one();
+    }
+    
+    // Frames queued for compression or writing.
+    size_t queued_frames() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+    
+    // Compresses and writes everything queued, then stops the threads.
+    void finish() {
+        if (finished_) return;
+        finished_ = true;
+        
+        std::string error;
+        try {
+            flush();
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        work_ready_.notify_all();
+        frame_done_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+        writer_.join();
+        
+        if (error.empty()) error = error_;
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+    }
+    
+private:
+    void compress_frames() {
+        Compressor compressor(codec_, level_);
+        while (true) {
+            Frame* frame = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_ready_.wait(lock, [&] {
+                    frame = next_unclaimed();
+                    return frame || closing_;
+                });
+                if (!frame) return;
+                frame->claimed = true;
+            }
+            
+            std::string error;
+            try {
+                compressor.compress(frame->input, frame->output);
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                frame->compressed = true;
+                if (!error.empty() && error_.empty()) error_ = error;
+            }
+            frame_done_.notify_all();
+            if (!error.empty()) space_freed_.notify_all();
+        }
+    }
+    
+    void write_frames() {
+        while (true) {
+            Frame* frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                frame_done_.wait(lock, [this] {
+                    return (!queue_.empty() && queue_.front()->compressed) ||
+                           (closing_ && queue_.empty()) || !error_.empty();
+                });
+                if (queue_.empty() || !error_.empty()) return;
+                frame = queue_.front().get();
+            }
+            
+            std::string error = write_all(frame->output);
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::unique_ptr<Frame> done = std::move(queue_.front());
+                queue_.pop_front();
+                if (!error.empty() && error_.empty()) error_ = error;
+                done->input.clear();
+                done->claimed = done->compressed = false;
+                spare_.push_back(std::move(done));
+            }
+            space_freed_.notify_all();
+        }
+    }
+    
+    Frame* next_unclaimed() {
+        for (auto& frame : queue_) {
+            if (!frame->claimed) return frame.get();
+        }
+        return nullptr;
+    }
+    
+    std::string write_all(const std::vector<char>& bytes) {
+        size_t written = 0;
+        while (written < bytes.size()) {
+            ssize_t n = ::write(fd_, bytes.data() + written, bytes.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return "Failed to write compressed output";
+            }
+            written += static_cast<size_t>(n);
+        }
+        return {};
+    }
+    
+    // Per-worker compression state, reused across frames.
+    class Compressor {
+    private:
+        OutputCodec codec_;
+        int level_;
+#ifdef MBP_HAVE_ZSTD
+        std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx_;
+#endif
+    
+    public:
+        // Level 0 means the codec's default.
+        Compressor(OutputCodec codec, int level)
+            : codec_(codec), level_(level == 0 && codec == OutputCodec::Gzip ? Z_DEFAULT_COMPRESSION : level)
+#ifdef MBP_HAVE_ZSTD
+            , cctx_(ZSTD_createCCtx(), ZSTD_freeCCtx)
+#endif
+        {}
+        
+        void compress(const std::vector<char>& input, std::vector<char>& output) {
+#ifdef MBP_HAVE_ZSTD
+            if (codec_ == OutputCodec::Zstd) {
+                output.resize(ZSTD_compressBound(input.size()));
+                size_t n = ZSTD_compressCCtx(cctx_.get(), output.data(), output.size(),
+                                             input.data(), input.size(), level_);
+                if (ZSTD_isError(n)) {
+                    throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+                }
+                output.resize(n);
+                return;
+            }
+#endif
+            z_stream zs;
+            std::memset(&zs, 0, sizeof(zs));
+            if (deflateInit2(&zs, level_, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {  // +16: gzip wrapper
+                throw std::runtime_error("Failed to initialise gzip encoder");
+            }
+            output.resize(deflateBound(&zs, static_cast<uLong>(input.size())));
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+            zs.avail_in = static_cast<uInt>(input.size());
+            zs.next_out = reinterpret_cast<Bytef*>(output.data());
+            zs.avail_out = static_cast<uInt>(output.size());
+            int ret = deflate(&zs, Z_FINISH);
+            output.resize(zs.total_out);
+            deflateEnd(&zs);
+            if (ret != Z_STREAM_END) {
+                throw std::runtime_error("gzip compression failed");
+            }
+        }
+    };
+};
+
+} // namespace mbp_reconstructor
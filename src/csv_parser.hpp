@@ -5,77 +5,184 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <string_view>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace mbp_reconstructor {
 
-class FastCSVParser {
+// Which records a parser hands over (see CSVRecordCursor::set_filter()).
+// Both tests read only the leading ts_event and action fields, so a
+// rejected row costs a look at its first 21 bytes and a newline search.
+//
+// ts_event has 19 digits for any time from 2001 to 2286, so a timestamp
+// of that width is compared as text against the bounds written out to
+// the same width, without being parsed; other widths are parsed.
+class RecordFilter {
+public:
+    static constexpr size_t TIMESTAMP_DIGITS = 19;
+    
 private:
-    int fd_;
-    char* data_;
-    size_t file_size_;
-    char* current_;
-    char* end_;
-    bool first_line_skipped_;
+    static constexpr uint64_t MAX_TIMESTAMP_TEXT = 9999999999999999999ULL;
+    
+    uint64_t min_timestamp_;
+    uint64_t max_timestamp_;
+    std::bitset<256> actions_;
+    bool textual_;                          // bounds fit TIMESTAMP_DIGITS
+    char min_text_[TIMESTAMP_DIGITS + 1];
+    char max_text_[TIMESTAMP_DIGITS + 1];
     
 public:
-    explicit FastCSVParser(const char* filename) 
-        : fd_(-1), data_(nullptr), file_size_(0), current_(nullptr), 
-          end_(nullptr), first_line_skipped_(false) {
-        
-        fd_ = open(filename, O_RDONLY);
-        if (fd_ == -1) {
-            throw std::runtime_error("Failed to open file");
-        }
-        
-        struct stat sb;
-        if (fstat(fd_, &sb) == -1) {
-            close(fd_);
-            throw std::runtime_error("Failed to get file size");
-        }
-        file_size_ = sb.st_size;
-        
-        data_ = static_cast<char*>(mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd_, 0));
-        if (data_ == MAP_FAILED) {
-            close(fd_);
-            throw std::runtime_error("Failed to mmap file");
+    RecordFilter() {
+        actions_.set();
+        between(0, UINT64_MAX);
+    }
+    
+    // Keeps records stamped in [min_timestamp, max_timestamp]; an inverted
+    // range is rejected rather than read as one that wraps around.
+    RecordFilter& between(uint64_t min_timestamp, uint64_t max_timestamp) {
+        if (max_timestamp < min_timestamp) {
+            throw std::runtime_error("RecordFilter: max_timestamp is before min_timestamp");
         }
-        
-        madvise(data_, file_size_, MADV_SEQUENTIAL);
-        
-        current_ = data_;
-        end_ = data_ + file_size_;
+        min_timestamp_ = min_timestamp;
+        max_timestamp_ = max_timestamp;
+        textual_ = min_timestamp <= MAX_TIMESTAMP_TEXT;
+        write_digits(min_text_, textual_ ? min_timestamp : 0);
+        write_digits(max_text_, std::min(max_timestamp, MAX_TIMESTAMP_TEXT));
+        return *this;
     }
     
-    ~FastCSVParser() {
-        if (data_ != nullptr && data_ != MAP_FAILED) {
-            munmap(data_, file_size_);
+    // Keeps only the listed actions, e.g. "TF".
+    RecordFilter& only_actions(std::string_view actions) noexcept {
+        actions_.reset();
+        for (char action : actions) {
+            actions_.set(static_cast<unsigned char>(action));
         }
-        if (fd_ != -1) {
-            close(fd_);
+        return *this;
+    }
+    
+    bool keeps_all() const noexcept {
+        return min_timestamp_ == 0 && max_timestamp_ == UINT64_MAX && actions_.all();
+    }
+    
+    bool keeps(uint64_t timestamp, char action) const noexcept {
+        return timestamp - min_timestamp_ <= max_timestamp_ - min_timestamp_ &&
+               actions_.test(static_cast<unsigned char>(action));
+    }
+    
+    // The same for a TIMESTAMP_DIGITS-wide timestamp field still in text.
+    // Returns true when the bounds do not fit that width, leaving the
+    // decision to keeps().
+    bool may_keep(const char* digits, char action) const noexcept {
+        return !textual_ ||
+               (std::memcmp(digits, min_text_, TIMESTAMP_DIGITS) >= 0 &&
+                std::memcmp(digits, max_text_, TIMESTAMP_DIGITS) <= 0 &&
+                actions_.test(static_cast<unsigned char>(action)));
+    }
+    
+private:
+    static void write_digits(char* text, uint64_t value) noexcept {
+        for (size_t i = TIMESTAMP_DIGITS; i-- > 0; value /= 10) {
+            text[i] = static_cast<char>('0' + value % 10);
         }
+        text[TIMESTAMP_DIGITS] = '\0';
+    }
+};
+
+// Field parsing over a [current_, end_) window of complete records. The
+// mmap parser points it at the whole file; the streaming parser at the
+// complete lines currently buffered.
+class CSVRecordCursor {
+public:
+    // Records the filter rejects are skipped by the parse calls, which
+    // only return the kept ones.
+    void set_filter(const RecordFilter& filter) {
+        filter_ = filter;
+        update_filtering();
     }
     
-    FastCSVParser(const FastCSVParser&) = delete;
-    FastCSVParser& operator=(const FastCSVParser&) = delete;
+    // Ends the input at the first record stamped after timestamp: that
+    // record and everything behind it are never parsed, even records that
+    // are stamped earlier again (ts_event is not monotonic in a
+    // ts_recv-ordered feed), and a followed input stops being read.
+    void stop_after(uint64_t timestamp) {
+        stop_after_ = timestamp;
+        update_filtering();
+    }
     
-    bool parse_next_event(Event& event) {
-        if (current_ >= end_) {
-            return false;
+protected:
+    const char* current_;
+    const char* end_;
+    RecordFilter filter_;
+    uint64_t stop_after_;
+    bool filtering_;                // filter or stop_after set
+    bool stopped_;                  // a record past stop_after_ was reached
+    
+    CSVRecordCursor()
+        : current_(nullptr), end_(nullptr), stop_after_(UINT64_MAX), filtering_(false), stopped_(false) {}
+    
+    // Parses the record under the cursor into event, or skips it when the
+    // filter rejects it; either way the cursor moves to the next line. A
+    // record past stop_after_ sets stopped_ instead, and the parsers'
+    // at_record() report the end of the input from then on.
+    bool take_record(Event& event) {
+        if (!filtering_) {
+            parse_record(event);
+            return true;
         }
         
-        if (!first_line_skipped_) {
+        constexpr size_t DIGITS = RecordFilter::TIMESTAMP_DIGITS;
+        if (stop_after_ == UINT64_MAX &&
+            end_ - current_ > static_cast<ptrdiff_t>(DIGITS + 1) && current_[DIGITS] == ',' &&
+            !filter_.may_keep(current_, current_[DIGITS + 1])) {
             skip_to_next_line();
-            first_line_skipped_ = true;
-            if (current_ >= end_) return false;
+            return false;
         }
         
+        uint64_t timestamp = parse_uint64();
+        if (timestamp > stop_after_) {
+            stopped_ = true;
+            return false;
+        }
+        expect_char(',');
+        if (current_ >= end_ || !filter_.keeps(timestamp, *current_)) {
+            skip_to_next_line();
+            return false;
+        }
+        event.timestamp_ns = timestamp;
+        parse_after_timestamp(event);
+        return true;
+    }
+    
+    bool take_record(EventBlock& block) {
+        Event event;
+        if (!take_record(event)) {
+            return false;
+        }
+        block.push_back(event);
+        return true;
+    }
+    
+    void update_filtering() noexcept {
+        filtering_ = !filter_.keeps_all() || stop_after_ != UINT64_MAX;
+    }
+    
+    void parse_record(Event& event) {
         // ts_event,action,side,price,size,order_id,flags,ts_recv,ts_in_delta,sequence
         event.timestamp_ns = parse_uint64();
         expect_char(',');
-        
+        parse_after_timestamp(event);
+    }
+    
+    void parse_after_timestamp(Event& event) {
         event.action = *current_;
         advance_char();
         expect_char(',');
@@ -91,13 +198,13 @@ public:
         expect_char(',');
         
         event.order_id = parse_uint64();
+        expect_char(',');
         
-        skip_to_next_line();
+        event.flags = static_cast<uint8_t>(parse_uint32());
         
-        return true;
+        skip_to_next_line();
     }
     
-private:
     uint64_t parse_uint64() {
         uint64_t result = 0;
         while (current_ < end_ && *current_ >= '0' && *current_ <= '9') {
@@ -163,19 +270,106 @@ private:
         }
     }
     
+    // memchr scans a word or vector at a time, so skipping the unused
+    // trailing fields, or a whole filtered-out row, runs at memory speed.
     void skip_to_next_line() {
-        while (current_ < end_ && *current_ != '\n') {
-            ++current_;
+        const void* newline = std::memchr(current_, '\n', static_cast<size_t>(end_ - current_));
+        current_ = newline ? static_cast<const char*>(newline) + 1 : end_;
+    }
+};
+
+class FastCSVParser : private CSVRecordCursor {
+private:
+    int fd_;
+    char* data_;
+    size_t file_size_;
+    bool first_line_skipped_;
+    
+public:
+    explicit FastCSVParser(const char* filename) 
+        : fd_(-1), data_(nullptr), file_size_(0), first_line_skipped_(false) {
+        
+        fd_ = open(filename, O_RDONLY);
+        if (fd_ == -1) {
+            throw std::runtime_error("Failed to open file");
         }
-        if (current_ < end_ && *current_ == '\n') {
-            ++current_;
+        
+        struct stat sb;
+        if (fstat(fd_, &sb) == -1) {
+            close(fd_);
+            throw std::runtime_error("Failed to get file size");
+        }
+        file_size_ = sb.st_size;
+        
+        data_ = static_cast<char*>(mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd_, 0));
+        if (data_ == MAP_FAILED) {
+            close(fd_);
+            throw std::runtime_error("Failed to mmap file");
+        }
+        
+        madvise(data_, file_size_, MADV_SEQUENTIAL);
+        
+        current_ = data_;
+        end_ = data_ + file_size_;
+    }
+    
+    ~FastCSVParser() {
+        if (data_ != nullptr && data_ != MAP_FAILED) {
+            munmap(data_, file_size_);
+        }
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+    
+    FastCSVParser(const FastCSVParser&) = delete;
+    FastCSVParser& operator=(const FastCSVParser&) = delete;
+    
+    using CSVRecordCursor::set_filter;
+    using CSVRecordCursor::stop_after;
+    
+    bool parse_next_event(Event& event) {
+        while (at_record()) {
+            if (take_record(event)) return true;
         }
+        return false;
+    }
+    
+    size_t parse_events(Event* events, size_t max_events) {
+        size_t count = 0;
+        while (count < max_events && parse_next_event(events[count])) {
+            ++count;
+        }
+        return count;
+    }
+    
+    // Refills the block with up to CAPACITY events; 0 at the end of the file.
+    size_t parse_events(EventBlock& block) {
+        block.count = 0;
+        while (!block.full() && at_record()) {
+            take_record(block);
+        }
+        return block.count;
+    }
+    
+private:
+    // Skips the header line on first use; false at the end of the file
+    // or once stopped.
+    bool at_record() {
+        if (current_ >= end_ || stopped_) {
+            return false;
+        }
+        
+        if (!first_line_skipped_) {
+            skip_to_next_line();
+            first_line_skipped_ = true;
+            if (current_ >= end_) return false;
+        }
+        return true;
     }
 };
 
 #ifdef __AVX2__
-#include <immintrin.h>
-
 class SIMDCSVParser {
     // SIMD implementation for vectorized parsing
 };
@@ -0,0 +1,411 @@
+#pragma once
+
+#include "order.hpp"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace mbp_reconstructor {
+
+// Order-book features computed per snapshot, for ML pipelines.
+//
+// Groups and the columns they add, over the top depth levels of each side
+// (undefined values are NaN):
+//
+//   FEATURE_IMBALANCE     imbalance        (bid - ask) / (bid + ask) size
+//   FEATURE_WEIGHTED_MID  weighted_mid     each side's size-weighted price,
+//                                          weighted by the opposite side's size
+//   FEATURE_SLOPE         bid_slope,       size per unit of price between
+//                         ask_slope        level 0 and the deepest level
+//   FEATURE_DEPLETION     bid_depletion,   size gone since the previous
+//                         ask_depletion    snapshot from the queue at the
+//                                          previous level-0 price (negative:
+//                                          it grew)
+enum FeatureGroup : uint32_t {
+    FEATURE_IMBALANCE    = 1 << 0,
+    FEATURE_WEIGHTED_MID = 1 << 1,
+    FEATURE_SLOPE        = 1 << 2,
+    FEATURE_DEPLETION    = 1 << 3,
+};
+
+constexpr uint32_t ALL_FEATURES = FEATURE_IMBALANCE | FEATURE_WEIGHTED_MID |
+                                  FEATURE_SLOPE | FEATURE_DEPLETION;
+
+struct FeatureConfig {
+    uint32_t groups = ALL_FEATURES;
+    int      depth = 5;           // 1-10
+};
+
+// "all" or a comma list of imbalance, weighted_mid, slope, depletion.
+inline uint32_t parse_feature_groups(const std::string& list) {
+    uint32_t groups = 0;
+    for (size_t pos = 0; pos < list.size(); ) {
+        size_t comma = std::min(list.find(',', pos), list.size());
+        std::string name = list.substr(pos, comma - pos);
+        if (name == "all") {
+            groups |= ALL_FEATURES;
+        } else if (name == "imbalance") {
+            groups |= FEATURE_IMBALANCE;
+        } else if (name == "weighted_mid") {
+            groups |= FEATURE_WEIGHTED_MID;
+        } else if (name == "slope") {
+            groups |= FEATURE_SLOPE;
+        } else if (name == "depletion") {
+            groups |= FEATURE_DEPLETION;
+        } else {
+            throw std::runtime_error("Unknown feature '" + name + "'");
+        }
+        pos = comma + 1;
+    }
+    return groups;
+}
+
+// One side's top levels, summed.
+struct SideDepth {
+    uint64_t size = 0;
+    double   notional_raw = 0.0;  // sum of price_raw * size
+    int      levels = 0;          // populated levels
+};
+
+inline SideDepth side_depth_scalar(const int64_t* px, const uint64_t* sz, int depth) {
+    SideDepth side;
+    for (int i = 0; i < depth; ++i) {
+        side.size += sz[i];
+        side.notional_raw += static_cast<double>(px[i]) * static_cast<double>(sz[i]);
+        side.levels += sz[i] != 0;
+    }
+    return side;
+}
+
+#ifdef __x86_64__
+namespace detail {
+
+// Exact for |v| < 2^51: v lands in the mantissa of 1.5 * 2^52.
+__attribute__((target("avx2")))
+inline __m256d int64_to_double(__m256i v) {
+    const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+    return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(v, _mm256_castpd_si256(magic))), magic);
+}
+
+} // namespace detail
+
+// Four levels per step; masked loads keep the last step inside the
+// 10-entry arrays. Compiled for AVX2 whatever the build flags, so the
+// tests can check it against side_depth_scalar() on any AVX2 machine;
+// only call it where the CPU has AVX2.
+__attribute__((target("avx2")))
+inline SideDepth side_depth_avx2(const int64_t* px, const uint64_t* sz, int depth) {
+    const __m256i lane = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i size = zero;
+    __m256d notional = _mm256_setzero_pd();
+    int levels = 0;
+    
+    for (int i = 0; i < depth; i += 4) {
+        __m256i active = _mm256_cmpgt_epi64(_mm256_set1_epi64x(depth - i), lane);
+        __m256i s = _mm256_maskload_epi64(reinterpret_cast<const long long*>(sz + i), active);
+        __m256i p = _mm256_maskload_epi64(reinterpret_cast<const long long*>(px + i), active);
+        size = _mm256_add_epi64(size, s);
+        notional = _mm256_add_pd(notional, _mm256_mul_pd(detail::int64_to_double(p),
+                                                         detail::int64_to_double(s)));
+        // Inactive lanes loaded as 0, so they never count.
+        int empty = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(s, zero)));
+        levels += 4 - __builtin_popcount(static_cast<unsigned>(empty));
+    }
+    
+    __m128i size2 = _mm_add_epi64(_mm256_castsi256_si128(size), _mm256_extracti128_si256(size, 1));
+    __m128d notional2 = _mm_add_pd(_mm256_castpd256_pd128(notional), _mm256_extractf128_pd(notional, 1));
+    
+    SideDepth side;
+    side.size = static_cast<uint64_t>(_mm_cvtsi128_si64(size2)) +
+                static_cast<uint64_t>(_mm_extract_epi64(size2, 1));
+    side.notional_raw = _mm_cvtsd_f64(_mm_add_sd(notional2, _mm_unpackhi_pd(notional2, notional2)));
+    side.levels = levels;
+    return side;
+}
+#endif
+
+// The AVX2 path when the build targets it (-march=native on an AVX2
+// machine), the scalar loop otherwise.
+inline SideDepth side_depth(const int64_t* px, const uint64_t* sz, int depth) {
+#ifdef __AVX2__
+    return side_depth_avx2(px, sz, depth);
+#else
+    return side_depth_scalar(px, sz, depth);
+#endif
+}
+
+// Computes the configured features from successive snapshots. A side's
+// depth sums are only recomputed when the change mask touches its top
+// depth levels.
+class FeatureComputer {
+private:
+    static constexpr double NaN = std::numeric_limits<double>::quiet_NaN();
+    
+    FeatureConfig config_;
+    std::vector<std::string> names_;
+    std::vector<double> values_;
+    uint32_t bid_mask_;
+    uint32_t ask_mask_;
+    
+    SideDepth bid_;
+    SideDepth ask_;
+    int64_t touch_px_[2];         // previous level 0, bid then ask
+    uint64_t touch_sz_[2];
+    
+public:
+    explicit FeatureComputer(const FeatureConfig& config)
+        : config_(config), bid_mask_(0), ask_mask_(0), touch_px_{0, 0}, touch_sz_{0, 0} {
+        for (int i = 0; i < config.depth; ++i) {
+            bid_mask_ |= bid_level_bit(i);
+            ask_mask_ |= ask_level_bit(i);
+        }
+        if (config.groups & FEATURE_IMBALANCE) {
+            names_.emplace_back("imbalance");
+        }
+        if (config.groups & FEATURE_WEIGHTED_MID) {
+            names_.emplace_back("weighted_mid");
+        }
+        if (config.groups & FEATURE_SLOPE) {
+            names_.emplace_back("bid_slope");
+            names_.emplace_back("ask_slope");
+        }
+        if (config.groups & FEATURE_DEPLETION) {
+            names_.emplace_back("bid_depletion");
+            names_.emplace_back("ask_depletion");
+        }
+        values_.resize(names_.size());
+    }
+    
+    // Column order of update()'s values.
+    const std::vector<std::string>& column_names() const noexcept { return names_; }
+    
+    // snapshot and changed_mask as given to BookListener::on_book_change.
+    const double* update(const MBPSnapshot& snapshot, uint32_t changed_mask) {
+        if (changed_mask & bid_mask_) {
+            bid_ = side_depth(snapshot.bid_px, snapshot.bid_sz, config_.depth);
+        }
+        if (changed_mask & ask_mask_) {
+            ask_ = side_depth(snapshot.ask_px, snapshot.ask_sz, config_.depth);
+        }
+        
+        double* out = values_.data();
+        double bid_size = static_cast<double>(bid_.size);
+        double ask_size = static_cast<double>(ask_.size);
+        double total = bid_size + ask_size;
+        
+        if (config_.groups & FEATURE_IMBALANCE) {
+            *out++ = total > 0 ? (bid_size - ask_size) / total : NaN;
+        }
+        if (config_.groups & FEATURE_WEIGHTED_MID) {
+            if (bid_.size > 0 && ask_.size > 0) {
+                double bid_px = bid_.notional_raw / bid_size;
+                double ask_px = ask_.notional_raw / ask_size;
+                *out++ = (bid_px * ask_size + ask_px * bid_size) / total / 100.0;
+            } else {
+                *out++ = NaN;
+            }
+        }
+        if (config_.groups & FEATURE_SLOPE) {
+            *out++ = slope(bid_, snapshot.bid_px);
+            *out++ = slope(ask_, snapshot.ask_px);
+        }
+        if (config_.groups & FEATURE_DEPLETION) {
+            *out++ = depletion(0, snapshot.bid_px, snapshot.bid_sz, changed_mask & bid_level_bit(0));
+            *out++ = depletion(1, snapshot.ask_px, snapshot.ask_sz, changed_mask & ask_level_bit(0));
+        }
+        return values_.data();
+    }
+    
+private:
+    static double slope(const SideDepth& side, const int64_t* px) {
+        if (side.levels < 2) return NaN;
+        int64_t range_raw = px[side.levels - 1] - px[0];
+        return static_cast<double>(side.size) / (std::abs(range_raw) / 100.0);
+    }
+    
+    double depletion(int s, const int64_t* px, const uint64_t* sz, bool touch_changed) {
+        if (!touch_changed) return touch_sz_[s] != 0 ? 0.0 : NaN;
+        
+        double result = NaN;
+        if (touch_sz_[s] != 0) {
+            // What is left at the old level-0 price: gone if that price is
+            // better than the new touch, otherwise somewhere in the top 10.
+            bool bid = s == 0;
+            int64_t old_px = touch_px_[s];
+            bool gone = sz[0] == 0 || (bid ? old_px > px[0] : old_px < px[0]);
+            uint64_t remaining = 0;
+            bool found = gone;
+            for (int i = 0; i < 10 && !found; ++i) {
+                if (px[i] == old_px && sz[i] != 0) {
+                    remaining = sz[i];
+                    found = true;
+                }
+            }
+            if (found) {
+                result = static_cast<double>(touch_sz_[s]) - static_cast<double>(remaining);
+            }
+        }
+        touch_px_[s] = px[0];
+        touch_sz_[s] = sz[0];
+        return result;
+    }
+};
+
+// Writes feature rows column by column, one raw little-endian array per
+// column in a directory, so each column maps straight into numpy or Arrow
+// without parsing:
+//
+//   DIR/ts_event.u64          uint64 per row
+//   DIR/<feature>.f64         float64 per row
+//   DIR/schema.json           row count, column names, files and dtypes
+//
+//   np.memmap("DIR/imbalance.f64", dtype="<f8", mode="r")
+//
+// Rows are buffered per column and appended in blocks; schema.json is
+// written by finish().
+class FeatureWriter {
+private:
+    static constexpr size_t BLOCK_ROWS = 65536;
+    
+    struct Column {
+        std::string name;
+        std::string file;
+        const char* dtype;
+        int fd = -1;
+    };
+    
+    std::string dir_;
+    std::vector<Column> columns_;   // ts_event first
+    std::vector<uint64_t> timestamps_;
+    std::vector<std::vector<double>> values_;
+    uint64_t rows_;
+    bool finished_;
+    
+public:
+    FeatureWriter(const std::string& dir, const std::vector<std::string>& names)
+        : dir_(dir), rows_(0), finished_(false) {
+        if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+            throw std::runtime_error("Failed to create " + dir);
+        }
+        
+        columns_.push_back(Column{"ts_event", "ts_event.u64", "<u8"});
+        for (const std::string& name : names) {
+            columns_.push_back(Column{name, name + ".f64", "<f8"});
+        }
+        for (Column& column : columns_) {
+            std::string path = dir_ + "/" + column.file;
+            column.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (column.fd == -1) {
+                close_files();
+                throw std::runtime_error("Failed to create " + path);
+            }
+        }
+        
+        timestamps_.reserve(BLOCK_ROWS);
+        values_.resize(names.size());
+        for (auto& column : values_) {
+            column.reserve(BLOCK_ROWS);
+        }
+    }
+    
+    ~FeatureWriter() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+    
+    FeatureWriter(const FeatureWriter&) = delete;
+    FeatureWriter& operator=(const FeatureWriter&) = delete;
+    
+    // values holds one entry per feature column, in the constructor's order.
+    void append(uint64_t timestamp_ns, const double* values) {
+        timestamps_.push_back(timestamp_ns);
+        for (size_t i = 0; i < values_.size(); ++i) {
+            values_[i].push_back(values[i]);
+        }
+        ++rows_;
+        if (timestamps_.size() == BLOCK_ROWS) {
+            flush();
+        }
+    }
+    
+    // Writes the buffered rows and schema.json, and closes the files.
+    void finish() {
+        if (finished_) return;
+        finished_ = true;
+        
+        flush();
+        close_files();
+        write_schema();
+    }
+    
+    uint64_t rows() const noexcept { return rows_; }
+    
+private:
+    void flush() {
+        write_all(columns_[0], timestamps_.data(), timestamps_.size() * sizeof(uint64_t));
+        timestamps_.clear();
+        for (size_t i = 0; i < values_.size(); ++i) {
+            write_all(columns_[i + 1], values_[i].data(), values_[i].size() * sizeof(double));
+            values_[i].clear();
+        }
+    }
+    
+    void write_all(const Column& column, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = ::write(column.fd, bytes + written, size - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Failed to write " + dir_ + "/" + column.file);
+            }
+            written += static_cast<size_t>(n);
+        }
+    }
+    
+    void close_files() {
+        for (Column& column : columns_) {
+            if (column.fd != -1) {
+                close(column.fd);
+                column.fd = -1;
+            }
+        }
+    }
+    
+    void write_schema() {
+        std::string path = dir_ + "/schema.json";
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            throw std::runtime_error("Failed to create " + path);
+        }
+        std::fprintf(file, "{\n  \"rows\": %llu,\n  \"columns\": [\n", (unsigned long long)rows_);
+        for (size_t i = 0; i < columns_.size(); ++i) {
+            std::fprintf(file, "    {\"name\": \"%s\", \"file\": \"%s\", \"dtype\": \"%s\"}%s\n",
+                         columns_[i].name.c_str(), columns_[i].file.c_str(), columns_[i].dtype,
+                         i + 1 < columns_.size() ? "," : "");
+        }
+        std::fprintf(file, "  ]\n}\n");
+        if (std::fclose(file) != 0) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+    }
+};
+
+} // namespace mbp_reconstructor
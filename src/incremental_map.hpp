@@ -0,0 +1,347 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace mbp_reconstructor {
+
+// Open-addressing uint64_t -> Value map that never rehashes in one go.
+//
+// When the table passes its load limit, it becomes the "old" table and a
+// table twice the size takes over; every following insert/erase migrates
+// a few old buckets until the old table is empty. Lookups probe the new
+// table first and the old one while a migration is in flight. Erasing from
+// the current table uses backward-shift deletion, so it never accumulates
+// tombstones; only the draining old table marks erased buckets. Tables are
+// anonymous mappings, i.e. zero pages faulted in lazily rather than cleared
+// up front; key 0 therefore marks an empty bucket and is kept, with the
+// tombstone key, in a side slot.
+template<typename Value>
+class IncrementalHashMap {
+private:
+    static constexpr uint64_t EMPTY_KEY = 0;
+    static constexpr uint64_t TOMBSTONE_KEY = UINT64_MAX;
+    static constexpr size_t   MIN_CAPACITY = 1024;
+    static constexpr size_t   MIGRATE_STEP = 64;     // old buckets per mutation
+    static constexpr size_t   RELEASE_CHUNK = 64 * 1024;   // bytes unmapped per step
+    
+    struct Slot {
+        uint64_t key;
+        Value    value;
+    };
+    
+    struct Table {
+        Slot*  slots = nullptr;
+        size_t mask = 0;
+        unsigned shift = 64;    // 64 - log2(capacity)
+        size_t used = 0;        // live entries + tombstones (old table only)
+        size_t live = 0;
+        
+        size_t capacity() const noexcept { return slots ? mask + 1 : 0; }
+    };
+    
+    Table  cur_;
+    Table  old_;
+    size_t migrate_pos_;
+    size_t released_bytes_;     // prefix of old_ already unmapped
+    
+    // Keys that collide with the bucket sentinels.
+    bool  has_special_[2];
+    Value special_[2];
+    
+public:
+    IncrementalHashMap() : migrate_pos_(0), released_bytes_(0), has_special_{false, false}, special_{} {
+        allocate(cur_, MIN_CAPACITY);
+    }
+    
+    ~IncrementalHashMap() {
+        release(cur_);
+        release_old();
+    }
+    
+    IncrementalHashMap(const IncrementalHashMap&) = delete;
+    IncrementalHashMap& operator=(const IncrementalHashMap&) = delete;
+    
+    const Value* find(uint64_t key) const noexcept {
+        if (is_special(key)) {
+            return has_special_[special_slot(key)] ? &special_[special_slot(key)] : nullptr;
+        }
+        
+        const Slot* slot = probe(cur_, key);
+        if (!slot && old_.slots) {
+            slot = probe_old(key);
+        }
+        return slot ? &slot->value : nullptr;
+    }
+    
+    bool contains(uint64_t key) const noexcept { return find(key) != nullptr; }
+    
+    // Inserts or overwrites.
+    void insert(uint64_t key, Value value) {
+        if (is_special(key)) {
+            size_t s = special_slot(key);
+            has_special_[s] = true;
+            special_[s] = value;
+            return;
+        }
+        
+        // The current table has no tombstones, so the probe either finds the
+        // key or stops on the empty bucket where it belongs.
+        Slot* slot = probe_insert(cur_, key);
+        if (slot->key == key) {
+            slot->value = value;
+        } else if (Slot* old_slot = old_.slots ? probe_old(key) : nullptr) {
+            old_slot->value = value;
+        } else if (cur_.used + 1 > cur_.capacity() / 10 * 7) {
+            grow();
+            place(cur_, key, value);
+        } else {
+            *slot = Slot{key, value};
+            ++cur_.used;
+            ++cur_.live;
+        }
+        
+        migrate_some();
+    }
+    
+    bool erase(uint64_t key) {
+        if (is_special(key)) {
+            size_t s = special_slot(key);
+            bool had = has_special_[s];
+            has_special_[s] = false;
+            return had;
+        }
+        
+        bool erased = erase_shift(cur_, key) || (old_.slots && erase_old(key));
+        migrate_some();
+        return erased;
+    }
+    
+    size_t size() const noexcept {
+        return cur_.live + old_.live + has_special_[0] + has_special_[1];
+    }
+    
+    bool empty() const noexcept { return size() == 0; }
+    
+    bool migrating() const noexcept { return old_.slots != nullptr; }
+    
+    // Pre-sizes the table so `count` entries fit without any migration.
+    void reserve(size_t count) {
+        size_t needed = count / 7 * 10 + MIN_CAPACITY;
+        if (needed <= cur_.capacity() || migrating() || cur_.live != 0) {
+            return;
+        }
+        release(cur_);
+        allocate(cur_, needed);
+    }
+    
+    template<typename Fn>
+    void for_each(Fn&& fn) const {
+        // Old buckets below migrate_pos_ are drained and may be unmapped.
+        visit(cur_, 0, fn);
+        visit(old_, migrate_pos_, fn);
+        if (has_special_[0]) fn(EMPTY_KEY, special_[0]);
+        if (has_special_[1]) fn(TOMBSTONE_KEY, special_[1]);
+    }
+    
+    void clear() {
+        release(cur_);
+        release_old();
+        migrate_pos_ = 0;
+        has_special_[0] = has_special_[1] = false;
+        allocate(cur_, MIN_CAPACITY);
+    }
+    
+private:
+    static bool is_special(uint64_t key) noexcept {
+        return key == EMPTY_KEY || key == TOMBSTONE_KEY;
+    }
+    
+    static size_t special_slot(uint64_t key) noexcept {
+        return key == EMPTY_KEY ? 0 : 1;
+    }
+    
+    static size_t bucket(const Table& t, uint64_t key) noexcept {
+        // Fibonacci hashing: the top bits of the product keep near-sequential
+        // ids well spread.
+        return static_cast<size_t>((key * UINT64_C(0x9E3779B97F4A7C15)) >> t.shift);
+    }
+    
+    static void allocate(Table& t, size_t min_capacity) {
+        size_t capacity = MIN_CAPACITY;
+        unsigned bits = 10;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+            ++bits;
+        }
+        
+        void* mem = mmap(nullptr, capacity * sizeof(Slot), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        t.slots = static_cast<Slot*>(mem);
+        t.mask = capacity - 1;
+        t.shift = 64 - bits;
+        t.used = 0;
+        t.live = 0;
+    }
+    
+    static void release(Table& t) noexcept {
+        if (t.slots) {
+            munmap(t.slots, t.capacity() * sizeof(Slot));
+        }
+        t = Table{};
+    }
+    
+    void release_old() noexcept {
+        if (old_.slots) {
+            munmap(reinterpret_cast<char*>(old_.slots) + released_bytes_,
+                   old_.capacity() * sizeof(Slot) - released_bytes_);
+        }
+        old_ = Table{};
+        released_bytes_ = 0;
+    }
+    
+    template<typename Fn>
+    static void visit(const Table& t, size_t first, Fn& fn) {
+        for (size_t i = first; i < t.capacity(); ++i) {
+            uint64_t key = t.slots[i].key;
+            if (key != EMPTY_KEY && key != TOMBSTONE_KEY) {
+                fn(key, t.slots[i].value);
+            }
+        }
+    }
+    
+    static Slot* probe(const Table& t, uint64_t key) noexcept {
+        size_t i = bucket(t, key);
+        while (true) {
+            Slot& slot = t.slots[i];
+            if (slot.key == key) return &slot;
+            if (slot.key == EMPTY_KEY) return nullptr;
+            i = (i + 1) & t.mask;
+        }
+    }
+    
+    static Slot* probe_insert(const Table& t, uint64_t key) noexcept {
+        size_t i = bucket(t, key);
+        while (t.slots[i].key != key && t.slots[i].key != EMPTY_KEY) {
+            i = (i + 1) & t.mask;
+        }
+        return &t.slots[i];
+    }
+
+    static void place(Table& t, uint64_t key, Value value) noexcept {
+        size_t i = bucket(t, key);
+        while (t.slots[i].key != EMPTY_KEY && t.slots[i].key != TOMBSTONE_KEY) {
+            i = (i + 1) & t.mask;
+        }
+        if (t.slots[i].key == EMPTY_KEY) ++t.used;
+        t.slots[i] = Slot{key, value};
+        ++t.live;
+    }
+    
+    // Removes key and pulls later members of its probe run back into the
+    // hole, keeping every run contiguous without tombstones.
+    static bool erase_shift(Table& t, uint64_t key) noexcept {
+        Slot* slot = probe(t, key);
+        if (!slot) return false;
+
+        size_t hole = static_cast<size_t>(slot - t.slots);
+        size_t next = hole;
+        while (true) {
+            next = (next + 1) & t.mask;
+            uint64_t next_key = t.slots[next].key;
+            if (next_key == EMPTY_KEY) break;
+
+            // Move next_key into the hole unless its home bucket lies
+            // cyclically in (hole, next].
+            size_t home = bucket(t, next_key);
+            bool stays = hole <= next ? (hole < home && home <= next)
+                                      : (hole < home || home <= next);
+            if (!stays) {
+                t.slots[hole] = t.slots[next];
+                hole = next;
+            }
+        }
+
+        t.slots[hole].key = EMPTY_KEY;
+        --t.used;
+        --t.live;
+        return true;
+    }
+
+    // Probes the draining table. Buckets below migrate_pos_ have been moved
+    // (and may already be unmapped). Moving leaves tombstones, not empty
+    // buckets, so a run may continue through them: a run starting there,
+    // or wrapping past the end into them, resumes at migrate_pos_. Each
+    // mapped bucket is visited at most once.
+    Slot* probe_old(uint64_t key) const noexcept {
+        size_t i = bucket(old_, key);
+        if (i < migrate_pos_) i = migrate_pos_;
+        for (size_t left = old_.capacity() - migrate_pos_; left > 0; --left) {
+            Slot& slot = old_.slots[i];
+            if (slot.key == key) return &slot;
+            if (slot.key == EMPTY_KEY) return nullptr;
+            if (++i > old_.mask) i = migrate_pos_;
+        }
+        return nullptr;
+    }
+
+    bool erase_old(uint64_t key) noexcept {
+        Slot* slot = probe_old(key);
+        if (!slot) return false;
+        slot->key = TOMBSTONE_KEY;
+        --old_.live;
+        return true;
+    }
+    
+    void grow() {
+        // Finish any migration still in flight before starting the next.
+        while (old_.slots) {
+            migrate_some();
+        }
+        
+        size_t capacity = cur_.live * 2 > cur_.capacity() / 2 ? cur_.capacity() * 2
+                                                              : cur_.capacity();
+        old_ = cur_;
+        cur_ = Table{};
+        allocate(cur_, capacity);
+        migrate_pos_ = 0;
+        released_bytes_ = 0;
+    }
+    
+    void migrate_some() {
+        if (!old_.slots) return;
+        
+        size_t end = migrate_pos_ + MIGRATE_STEP;
+        if (end > old_.capacity()) end = old_.capacity();
+        
+        for (; migrate_pos_ < end; ++migrate_pos_) {
+            Slot& slot = old_.slots[migrate_pos_];
+            if (slot.key != EMPTY_KEY && slot.key != TOMBSTONE_KEY) {
+                place(cur_, slot.key, slot.value);
+                slot.key = TOMBSTONE_KEY;
+                --old_.live;
+            }
+        }
+        
+        if (migrate_pos_ == old_.capacity()) {
+            release_old();
+            return;
+        }
+
+        // Unmap the drained prefix as we go, so freeing a large old table
+        // is not one long munmap at the end.
+        size_t drained = migrate_pos_ * sizeof(Slot);
+        if (drained - released_bytes_ >= RELEASE_CHUNK) {
+            munmap(reinterpret_cast<char*>(old_.slots) + released_bytes_, RELEASE_CHUNK);
+            released_bytes_ += RELEASE_CHUNK;
+        }
+    }
+};
+
+} // namespace mbp_reconstructor
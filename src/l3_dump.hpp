@@ -0,0 +1,327 @@
+#pragma once
+
+#include "order.hpp"
+#include "order_book.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mbp_reconstructor {
+
+// Market-by-order (L3) book dumps.
+//
+// File layout, little-endian and packed:
+//
+//   FileHeader                       once
+//   per dump:
+//     DumpHeader
+//     per level, bids best first, then asks best first:
+//       LevelRecord
+//       OrderRecord * order_count    queue order, front first
+namespace l3 {
+
+constexpr uint64_t MAGIC = 0x4D424F4C33445031ULL;   // "MBOL3DP1"
+constexpr uint32_t VERSION = 1;
+
+struct FileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct DumpHeader {
+    uint64_t timestamp_ns;    // the book as of this time
+    uint32_t bid_levels;
+    uint32_t ask_levels;
+    uint64_t order_count;
+} __attribute__((packed));
+
+struct LevelRecord {
+    int64_t  price_raw;
+    uint32_t order_count;
+} __attribute__((packed));
+
+struct OrderRecord {
+    uint64_t order_id;
+    uint64_t timestamp_ns;    // when the order was added
+    uint32_t size;
+} __attribute__((packed));
+
+static_assert(sizeof(DumpHeader) == 24 && sizeof(LevelRecord) == 12 && sizeof(OrderRecord) == 20,
+              "dump records are packed");
+
+} // namespace l3
+
+// Writes L3 dumps from a background thread.
+//
+// dump() copies the book into one of two BookImages (OrderBook::copy_image:
+// the levels, and the order arena shared copy-on-write) and returns; the
+// writer thread walks the level queues in that copy, encodes them and
+// writes the result while events keep being applied to the live book,
+// which copies an arena chunk the first time it writes to it. The caller
+// only waits when the writer is still busy with the previous dump and the
+// other image is already queued.
+class L3Dumper {
+private:
+    struct Job {
+        BookImage image;
+        uint64_t timestamp_ns = 0;
+    };
+    
+    int fd_;
+    
+    std::mutex mutex_;
+    std::condition_variable job_ready_;
+    std::condition_variable job_done_;
+    std::vector<std::unique_ptr<Job>> free_;
+    std::deque<std::unique_ptr<Job>> queued_;
+    bool closing_;
+    std::string error_;
+    
+    std::thread writer_;
+    bool finished_;
+    
+    uint64_t dumps_written_;
+    uint64_t copy_ns_;
+    
+public:
+    // Creates (or truncates) path.
+    explicit L3Dumper(const char* path)
+        : fd_(-1), closing_(false), finished_(false),
+          dumps_written_(0), copy_ns_(0) {
+        fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ == -1) {
+            throw std::runtime_error(std::string("Failed to create ") + path);
+        }
+        
+        l3::FileHeader header{l3::MAGIC, l3::VERSION, 0};
+        std::string error = write_all(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!error.empty()) {
+            close(fd_);
+            throw std::runtime_error(error);
+        }
+        
+        free_.push_back(std::make_unique<Job>());
+        free_.push_back(std::make_unique<Job>());
+        writer_ = std::thread([this] { write_dumps(); });
+    }
+    
+    ~L3Dumper() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+    
+    L3Dumper(const L3Dumper&) = delete;
+    L3Dumper& operator=(const L3Dumper&) = delete;
+    
+    // Dumps the book as of timestamp_ns.
+    void dump(const OrderBook& book, uint64_t timestamp_ns) {
+        std::unique_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            job_done_.wait(lock, [this] { return !free_.empty() || !error_.empty(); });
+            if (!error_.empty()) {
+                throw std::runtime_error(error_);
+            }
+            job = std::move(free_.back());
+            free_.pop_back();
+        }
+        
+        auto start = std::chrono::steady_clock::now();
+        book.copy_image(job->image);
+        job->timestamp_ns = timestamp_ns;
+        copy_ns_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+        ++dumps_written_;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_.push_back(std::move(job));
+        }
+        job_ready_.notify_one();
+    }
+    
+    // Writes the queued dumps and stops the writer thread.
+    void finish() {
+        if (finished_) return;
+        finished_ = true;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        job_ready_.notify_one();
+        writer_.join();
+        close(fd_);
+        
+        if (!error_.empty()) {
+            throw std::runtime_error(error_);
+        }
+    }
+    
+    uint64_t dumps_written() const noexcept { return dumps_written_; }
+    // Dumps copied but not yet written.
+    size_t queued_dumps() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queued_.size();
+    }
+    // Time the caller spent in dump() taking book images. The chunk copies
+    // the book makes as it is written to afterwards are not included.
+    double copy_seconds() const noexcept { return copy_ns_ / 1e9; }
+    
+private:
+    void write_dumps() {
+        std::vector<char> buffer;
+        while (true) {
+            std::unique_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                job_ready_.wait(lock, [this] { return !queued_.empty() || closing_; });
+                if (queued_.empty()) return;
+                job = std::move(queued_.front());
+                queued_.pop_front();
+            }
+            
+            encode(*job, buffer);
+            job->image.orders.release();
+            std::string error = write_all(buffer.data(), buffer.size());
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(std::move(job));
+                if (!error.empty() && error_.empty()) error_ = error;
+            }
+            job_done_.notify_one();
+            if (!error.empty()) return;
+        }
+    }
+    
+    static void encode(const Job& job, std::vector<char>& buffer) {
+        const BookImage& image = job.image;
+        uint64_t order_count = 0;
+        for (const Level& level : image.bids) order_count += level.order_count;
+        for (const Level& level : image.asks) order_count += level.order_count;
+        
+        buffer.resize(sizeof(l3::DumpHeader) +
+                      (image.bids.size() + image.asks.size()) * sizeof(l3::LevelRecord) +
+                      order_count * sizeof(l3::OrderRecord));
+        char* out = buffer.data();
+        
+        l3::DumpHeader header{job.timestamp_ns, static_cast<uint32_t>(image.bids.size()),
+                              static_cast<uint32_t>(image.asks.size()), order_count};
+        std::memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        
+        for (const auto* side : {&image.bids, &image.asks}) {
+            for (const Level& level : *side) {
+                l3::LevelRecord record{level.price_raw, level.order_count};
+                std::memcpy(out, &record, sizeof(record));
+                out += sizeof(record);
+                
+                OrderIndex idx = level.first_order;
+                for (uint32_t i = 0; i < level.order_count; ++i, idx = image.orders[idx].next) {
+                    const OrderInfo& info = image.orders.info(idx);
+                    l3::OrderRecord order{info.order_id, info.timestamp_ns, image.orders[idx].size};
+                    std::memcpy(out, &order, sizeof(order));
+                    out += sizeof(order);
+                }
+            }
+        }
+    }
+    
+    std::string write_all(const char* data, size_t size) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = ::write(fd_, data + written, size - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return "Failed to write L3 dump";
+            }
+            written += static_cast<size_t>(n);
+        }
+        return {};
+    }
+};
+
+// Reads back a file written by L3Dumper.
+class L3DumpReader {
+public:
+    struct PriceLevel {
+        int64_t price_raw;
+        std::vector<l3::OrderRecord> orders;   // queue order
+    };
+    
+    struct Dump {
+        uint64_t timestamp_ns = 0;
+        std::vector<PriceLevel> bids;   // best first
+        std::vector<PriceLevel> asks;   // best first
+    };
+    
+private:
+    FILE* file_;
+    
+public:
+    explicit L3DumpReader(const char* path) : file_(std::fopen(path, "rb")) {
+        if (!file_) {
+            throw std::runtime_error(std::string("Failed to open ") + path);
+        }
+        l3::FileHeader header;
+        if (std::fread(&header, sizeof(header), 1, file_) != 1 ||
+            header.magic != l3::MAGIC || header.version != l3::VERSION) {
+            std::fclose(file_);
+            throw std::runtime_error(std::string("Not an L3 dump: ") + path);
+        }
+    }
+    
+    ~L3DumpReader() {
+        std::fclose(file_);
+    }
+    
+    L3DumpReader(const L3DumpReader&) = delete;
+    L3DumpReader& operator=(const L3DumpReader&) = delete;
+    
+    // Returns false at the end of the file.
+    bool next(Dump& dump) {
+        l3::DumpHeader header;
+        if (std::fread(&header, sizeof(header), 1, file_) != 1) {
+            return false;
+        }
+        dump.timestamp_ns = header.timestamp_ns;
+        read_levels(dump.bids, header.bid_levels);
+        read_levels(dump.asks, header.ask_levels);
+        return true;
+    }
+    
+private:
+    void read_levels(std::vector<PriceLevel>& levels, uint32_t count) {
+        levels.resize(count);
+        for (PriceLevel& level : levels) {
+            l3::LevelRecord record;
+            if (std::fread(&record, sizeof(record), 1, file_) != 1) {
+                throw std::runtime_error("Truncated L3 dump");
+            }
+            level.price_raw = record.price_raw;
+            level.orders.resize(record.order_count);
+            if (record.order_count > 0 &&
+                std::fread(level.orders.data(), sizeof(l3::OrderRecord), record.order_count, file_) !=
+                    record.order_count) {
+                throw std::runtime_error("Truncated L3 dump");
+            }
+        }
+    }
+};
+
+} // namespace mbp_reconstructor
@@ -1,10 +1,23 @@
 #include "csv_parser.hpp"
-#include "order_book.hpp"
-#include "action_engine.hpp"
-#include "snapshot.hpp"
+#include "stream_parser.hpp"
+#include "compressed_input.hpp"
+#include "uring_io.hpp"
+#include "compressed_output.hpp"
+#include "shm_publisher.hpp"
+#include "reconstructor.hpp"
+#include "l3_dump.hpp"
+#include "bars.hpp"
+#include "features.hpp"
+#include "arrow_writer.hpp"
+#include "metrics.hpp"
+#include "shadow_verifier.hpp"
+#include <fcntl.h>
 #include <iostream>
 #include <chrono>
+#include <cstdio>
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 using namespace mbp_reconstructor;
 
@@ -32,55 +45,285 @@ public:
     }
 };
 
-class MBPReconstructor {
+struct ReconstructorConfig {
+    static constexpr size_t DEFAULT_PREFETCH_DISTANCE = BookReconstructor::DEFAULT_PREFETCH_DISTANCE;
+    
+    size_t         prefetch_distance = DEFAULT_PREFETCH_DISTANCE;
+    OrderIndexKind order_index = OrderIndexKind::Hash;
+    bool           stream_input = false;    // read through StreamingCSVParser
+    bool           follow_input = false;    // keep reading a growing file at EOF
+    bool           io_uring = false;        // queued reads/writes instead of mmap/stdio
+    bool           compress_output = false;
+    OutputCodec    output_codec = OutputCodec::Zstd;
+    int            compress_level = 0;      // 0: codec default
+    unsigned       compress_threads = 0;    // 0: one per spare core
+    std::string    shm_name;                // publish snapshots to this shm feed
+    size_t         shm_capacity = shm::DEFAULT_CAPACITY;
+    std::string    trades_path;             // also write trade prints here
+    std::string    arrow_path;              // snapshots as Arrow here instead of CSV on stdout
+    std::string    arrow_trades_path;       // also write trade prints here as Arrow
+    std::string    l3_path;                 // write order-level book dumps here
+    uint64_t       l3_interval_ns = 0;      // dump every interval of event time
+    std::vector<uint64_t> l3_times;         // and/or at these timestamps
+    bool           order_counts = false;    // bid_ct/ask_ct columns
+    int            derived_depth = 0;       // mid,microprice,spread,imbalance over N levels; 0: off
+    bool           conflate = false;        // one snapshot per exchange event (F_LAST)
+    uint64_t       sample_interval_ns = 0;  // a snapshot per interval of event time; 0: per change
+    std::string    bars_path;               // also write time bars here
+    uint64_t       bar_interval_ns = 60000000000ULL;
+    std::string    features_dir;            // also write feature columns here
+    FeatureConfig  features;
+    bool           progress = true;         // progress lines on stderr
+    std::string    metrics_path;            // Prometheus text file, rewritten each interval
+    double         metrics_interval_s = 1.0;
+    bool           verify = false;          // shadow verification thread
+    size_t         verify_image_every = ShadowVerifier::DEFAULT_IMAGE_EVERY;
+    uint64_t       end_time_ns = UINT64_MAX;    // input ends at the first record stamped later
+};
+
+// An output file (the MBP rows on stdout, or the trade prints) behind
+// whichever writer the configuration picks: background compression,
+// io_uring, or plain buffered stdio.
+class OutputStream {
+private:
+    int fd_;
+    bool owns_fd_;
+    std::unique_ptr<CompressedWriter> compressed_;
+    std::unique_ptr<UringWriter> uring_;
+    FILE* file_;
+    
+public:
+    OutputStream(int fd, bool owns_fd, const ReconstructorConfig& config)
+        : fd_(fd), owns_fd_(owns_fd), file_(nullptr) {
+        if (config.compress_output) {
+            compressed_ = std::make_unique<CompressedWriter>(
+                fd_, config.output_codec, config.compress_level, config.compress_threads);
+        } else if (config.io_uring) {
+            uring_ = std::make_unique<UringWriter>(fd_);
+        } else if (fd_ == STDOUT_FILENO) {
+            file_ = stdout;
+        } else if (!(file_ = fdopen(fd_, "w"))) {
+            throw std::runtime_error("Failed to open output");
+        }
+    }
+    
+    // Creates (or truncates) path.
+    OutputStream(const char* path, const ReconstructorConfig& config)
+        : OutputStream(open_output(path), true, config) {}
+    
+    ~OutputStream() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+    
+    OutputStream(const OutputStream&) = delete;
+    OutputStream& operator=(const OutputStream&) = delete;
+    
+    bool compressed() const noexcept { return compressed_ != nullptr; }
+    
+    // Frames waiting on the compression threads; 0 for the other writers.
+    size_t backlog() { return compressed_ ? compressed_->queued_frames() : 0; }
+    
+    void write(std::string_view text) {
+        if (compressed_) {
+            compressed_->write(text);
+        } else if (uring_) {
+            uring_->write(text);
+        } else {
+            fwrite(text.data(), 1, text.size(), file_);
+        }
+    }
+    
+    void flush() {
+        if (compressed_) {
+            compressed_->flush();
+        } else if (uring_) {
+            uring_->flush();
+        } else {
+            fflush(file_);
+        }
+    }
+    
+    void finish() {
+        if (compressed_) {
+            compressed_->finish();
+        } else if (uring_) {
+            uring_->finish();
+        } else {
+            fflush(file_);
+        }
+        
+        if (owns_fd_) {
+            owns_fd_ = false;
+            compressed_.reset();
+            uring_.reset();
+            if (file_) {
+                fclose(file_);
+            } else {
+                close(fd_);
+            }
+        }
+    }
+    
+private:
+    static int open_output(const char* path) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            throw std::runtime_error(std::string("Failed to create ") + path);
+        }
+        return fd;
+    }
+};
+
+// Command-line front end: a BookListener that renders each book change as
+// an MBP-10 CSV row (and optionally publishes it to shared memory) and,
+// when asked, each aggregated trade as a row of a separate trades file and
+// the full order-level book at scheduled times.
+class MBPReconstructor : private BookListener {
 private:
-    std::unique_ptr<OrderBook> order_book_;
-    std::unique_ptr<ActionEngine> action_engine_;
-    std::unique_ptr<SnapshotProcessor> snapshot_processor_;
+    std::unique_ptr<BookReconstructor> book_;
+    MBPFormatter formatter_;
+    TradeFormatter trade_formatter_;
+    std::unique_ptr<OutputStream> output_;
+    std::unique_ptr<OutputStream> trades_;
+    std::unique_ptr<MBPArrowWriter> arrow_;
+    std::unique_ptr<TradeArrowWriter> arrow_trades_;
+    std::unique_ptr<ShmPublisher> publisher_;
+    std::unique_ptr<L3Dumper> l3_dumper_;
+    std::unique_ptr<OutputStream> bars_out_;
+    std::unique_ptr<BarBuilder> bars_;
+    BarFormatter bar_formatter_;
+    std::unique_ptr<FeatureComputer> features_;
+    std::unique_ptr<FeatureWriter> features_out_;
+    size_t next_l3_time_;
+    ReplayMetrics metrics_;
+    std::unique_ptr<MetricsReporter> reporter_;
+    std::unique_ptr<ShadowVerifier> verifier_;
     
-    uint64_t events_processed_;
     uint64_t snapshots_emitted_;
+    uint64_t trades_emitted_;
+    uint64_t bars_emitted_;
+    ReconstructorConfig config_;
     
 public:
-    MBPReconstructor() : events_processed_(0), snapshots_emitted_(0) {
-        order_book_ = std::make_unique<OrderBook>();
-        action_engine_ = std::make_unique<ActionEngine>(*order_book_);
-        snapshot_processor_ = std::make_unique<SnapshotProcessor>();
+    explicit MBPReconstructor(const ReconstructorConfig& config = ReconstructorConfig{}) 
+        : formatter_(config.order_counts), next_l3_time_(0), snapshots_emitted_(0),
+          trades_emitted_(0), bars_emitted_(0), config_(config) {
+        std::sort(config_.l3_times.begin(), config_.l3_times.end());
+        BookListener& listener = *this;
+        book_ = std::make_unique<BookReconstructor>(listener, config_.order_index,
+                                                    config_.prefetch_distance);
+        if (config_.derived_depth > 0) {
+            book_->enable_derived_fields(config_.derived_depth);
+        }
+        book_->compare_order_counts(config_.order_counts);
+        book_->conflate_events(config_.conflate);
+        book_->sample_every(config_.sample_interval_ns);
     }
     
     bool reconstruct(const char* input_filename) {
         try {
             PerformanceTimer timer;
             
-            FastCSVParser parser(input_filename);
+            if (!config_.shm_name.empty()) {
+                publisher_ = std::make_unique<ShmPublisher>(config_.shm_name.c_str(), config_.shm_capacity);
+            }
             
-            std::cout << CSVHeader::generate_mbp_header();
+            if (config_.arrow_path.empty()) {
+                output_ = std::make_unique<OutputStream>(STDOUT_FILENO, false, config_);
+            } else {
+                arrow_ = std::make_unique<MBPArrowWriter>(config_.arrow_path, config_.order_counts,
+                                                          config_.derived_depth > 0,
+                                                          is_arrow_stream(config_.arrow_path));
+            }
+            if (!config_.trades_path.empty()) {
+                trades_ = std::make_unique<OutputStream>(config_.trades_path.c_str(), config_);
+            }
+            if (!config_.arrow_trades_path.empty()) {
+                arrow_trades_ = std::make_unique<TradeArrowWriter>(
+                    config_.arrow_trades_path, is_arrow_stream(config_.arrow_trades_path));
+            }
+            if (!config_.bars_path.empty()) {
+                bars_out_ = std::make_unique<OutputStream>(config_.bars_path.c_str(), config_);
+                bars_ = std::make_unique<BarBuilder>(config_.bar_interval_ns);
+            }
+            if (!config_.features_dir.empty()) {
+                features_ = std::make_unique<FeatureComputer>(config_.features);
+                features_out_ = std::make_unique<FeatureWriter>(config_.features_dir,
+                                                                features_->column_names());
+            }
+            if (!config_.l3_path.empty()) {
+                l3_dumper_ = std::make_unique<L3Dumper>(config_.l3_path.c_str());
+                // An interval schedule arms at 0 to find where the data starts.
+                book_->set_checkpoint(config_.l3_interval_ns > 0 || config_.l3_times.empty()
+                                      ? 0 : config_.l3_times.front());
+            }
             
-            Event event;
-            while (parser.parse_next_event(event)) {
-                ++events_processed_;
-                
-                bool should_snapshot = action_engine_->process_event(event);
-                
-                if (should_snapshot) {
-                    std::string snapshot_line = snapshot_processor_->process_event(
-                        *order_book_, event.timestamp_ns);
-                    
-                    if (!snapshot_line.empty()) {
-                        std::cout << snapshot_line;
-                        ++snapshots_emitted_;
-                    }
-                }
-                
-                if (events_processed_ % 100000 == 0) {
-                    std::cerr << "Processed " << events_processed_ << " events..." << std::endl;
-                }
+            if (config_.verify) {
+                verifier_ = std::make_unique<ShadowVerifier>(config_.verify_image_every);
+            }
+            if (config_.progress || !config_.metrics_path.empty()) {
+                auto interval = std::chrono::milliseconds(
+                    static_cast<int64_t>(config_.metrics_interval_s * 1000));
+                reporter_ = std::make_unique<MetricsReporter>(metrics_, interval, config_.progress,
+                                                              config_.metrics_path);
+            }
+            
+            Compression compression = detect_compression(input_filename);
+            if (compression == Compression::Gzip) {
+                replay_source(GzipSource(FdSource(input_filename, config_.follow_input)));
+            } else if (compression == Compression::Zstd) {
+#ifdef MBP_HAVE_ZSTD
+                replay_source(ZstdSource(FdSource(input_filename, config_.follow_input),
+                                         !config_.follow_input));
+#else
+                throw std::runtime_error("zstd input needs a build with libzstd (make ZSTD=1)");
+#endif
+            } else if (config_.stream_input) {
+                StreamingCSVParser parser(input_filename, config_.follow_input);
+                replay(parser, true);
+            } else if (config_.io_uring) {
+                UringCSVParser parser(input_filename);
+                replay(parser, false);
+            } else {
+                FastCSVParser parser(input_filename);
+                replay(parser, false);
+            }
+            
+            if (output_) {
+                output_->finish();
+            } else {
+                arrow_->finish();
+            }
+            if (trades_) {
+                trades_->finish();
+            }
+            if (arrow_trades_) {
+                arrow_trades_->finish();
+            }
+            if (bars_out_) {
+                bars_out_->finish();
+            }
+            if (features_out_) {
+                features_out_->finish();
+            }
+            if (l3_dumper_) {
+                l3_dumper_->finish();
+            }
+            if (reporter_) {
+                publish_metrics();
+                reporter_->stop();
+            }
+            if (verifier_) {
+                verifier_->finish();
             }
             
             timer.print_elapsed("Total processing time");
             print_statistics();
             
-            return true;
+            return !verifier_ || verifier_->report().passed();
             
         } catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << std::endl;
@@ -89,28 +332,198 @@ public:
     }
     
 private:
+    // The stream format for .arrows, the file format otherwise.
+    static bool is_arrow_stream(const std::string& path) {
+        return path.size() >= 7 && path.compare(path.size() - 7, 7, ".arrows") == 0;
+    }
+    
+    // Streamed input hands over whatever lines have arrived, so flushing
+    // after each block gets their snapshots downstream right away.
+    template<typename Parser>
+    void replay(Parser& parser, bool flush_each_block) {
+        if (output_) {
+            output_->write(CSVHeader::generate_mbp_header(config_.order_counts, config_.derived_depth > 0));
+        }
+        if (trades_) {
+            trades_->write(CSVHeader::generate_trade_header());
+        }
+        if (bars_out_) {
+            bars_out_->write(CSVHeader::generate_bar_header());
+        }
+        
+        // The book as of end_time_ns only needs the records up to it; the
+        // parser ends the input at the first one stamped later.
+        if (config_.end_time_ns != UINT64_MAX) {
+            parser.stop_after(config_.end_time_ns);
+        }
+        
+        auto block = std::make_unique<EventBlock>();
+        while (parser.parse_events(*block) > 0) {
+            book_->on_events(*block);
+            if (verifier_) {
+                verifier_->submit(*block, book_->book());
+            }
+            if (reporter_) {
+                publish_metrics();
+            }
+            
+            if (flush_each_block) {
+                if (output_) {
+                    output_->flush();
+                }
+                if (trades_) {
+                    trades_->flush();
+                }
+                if (bars_out_) {
+                    bars_out_->flush();
+                }
+            }
+        }
+        book_->finish();
+        if (bars_) {
+            write_bar(bars_->finish());
+        }
+    }
+    
+    // Decompressed input goes through the streaming parser; it is only
+    // flushed per block when it is actually live.
+    template<typename Source>
+    void replay_source(Source source) {
+        BasicStreamingCSVParser<Source> parser(std::move(source));
+        replay(parser, config_.stream_input);
+    }
+    
+    // Hands the current figures to the reporter thread; once per block, so
+    // the apply loop itself only counts.
+    void publish_metrics() {
+        const OrderBook& book = book_->book();
+        ReplayMetrics::set(metrics_.events, book_->events_processed());
+        ReplayMetrics::set(metrics_.snapshots, snapshots_emitted_);
+        ReplayMetrics::set(metrics_.trades, book_->action_engine().get_trades_aggregated());
+        ReplayMetrics::set(metrics_.active_orders, book.get_active_orders());
+        ReplayMetrics::set(metrics_.price_levels, book.get_price_levels());
+        ReplayMetrics::set(metrics_.pool_high_water, book.get_pool_high_water());
+        ReplayMetrics::set(metrics_.pool_capacity, book.get_pool_capacity());
+        ReplayMetrics::set(metrics_.output_backlog, output_ ? output_->backlog() : 0);
+        ReplayMetrics::set(metrics_.l3_backlog, l3_dumper_ ? l3_dumper_->queued_dumps() : 0);
+    }
+    
+    void on_book_change(const MBPSnapshot& snapshot, uint32_t changed_mask) override {
+        if (publisher_) {
+            publisher_->publish(snapshot);
+        }
+        const DerivedFields* derived = book_->snapshot_manager().derived_fields();
+        if (output_) {
+            output_->write(formatter_.format_snapshot(snapshot, derived));
+        } else {
+            arrow_->append(snapshot, derived);
+        }
+        ++snapshots_emitted_;
+        
+        if (bars_ && (changed_mask & (bid_level_bit(0) | ask_level_bit(0)))) {
+            write_bar(bars_->on_quote(snapshot));
+        }
+        if (features_) {
+            features_out_->append(snapshot.timestamp_ns, features_->update(snapshot, changed_mask));
+        }
+    }
+    
+    void write_bar(const Bar* bar) {
+        if (bar) {
+            bars_out_->write(bar_formatter_.format_bar(*bar));
+            ++bars_emitted_;
+        }
+    }
+    
+    uint64_t on_checkpoint(uint64_t time, const OrderBook& book, uint64_t next_event_ts) override {
+        if (time > 0) {
+            l3_dumper_->dump(book, time);
+        }
+        
+        const std::vector<uint64_t>& times = config_.l3_times;
+        while (next_l3_time_ < times.size() && times[next_l3_time_] <= time) {
+            ++next_l3_time_;
+        }
+        uint64_t next = next_l3_time_ < times.size() ? times[next_l3_time_] : NO_CHECKPOINT;
+        
+        // The next interval boundary that has events before it; a quiet
+        // stretch would only repeat the same book.
+        uint64_t interval = config_.l3_interval_ns;
+        if (interval > 0) {
+            next = std::min(next, (next_event_ts + interval - 1) / interval * interval);
+        }
+        return next;
+    }
+    
+    void on_trade(const TradeInfo& trade) override {
+        if (trades_) {
+            trades_->write(trade_formatter_.format_trade(trade));
+        }
+        if (arrow_trades_) {
+            arrow_trades_->append(trade);
+        }
+        if (trades_ || arrow_trades_) {
+            ++trades_emitted_;
+        }
+        if (bars_) {
+            write_bar(bars_->on_trade(trade));
+        }
+    }
+    
     void print_statistics() const {
+        uint64_t events_processed = book_->events_processed();
+        const OrderBook& order_book = book_->book();
+        const ActionEngine& action_engine = book_->action_engine();
+        
         std::cerr << "\n=== Performance Statistics ===" << std::endl;
-        std::cerr << "Events processed: " << events_processed_ << std::endl;
+        std::cerr << "Events processed: " << events_processed << std::endl;
         std::cerr << "Snapshots emitted: " << snapshots_emitted_ << std::endl;
+        if (trades_ || arrow_trades_) {
+            std::cerr << "Trades emitted: " << trades_emitted_ << std::endl;
+        }
+        if (bars_) {
+            std::cerr << "Bars emitted: " << bars_emitted_ << std::endl;
+        }
+        if (features_out_) {
+            std::cerr << "Feature rows: " << features_out_->rows() << std::endl;
+        }
+        if (config_.conflate) {
+            std::cerr << "Records conflated: " << book_->records_conflated() << std::endl;
+        }
+        if (verifier_) {
+            const ShadowVerifier::Report& report = verifier_->report();
+            std::cerr << "Shadow verification: " << (report.passed() ? "passed" : "FAILED") << " ("
+                      << report.events << " events in " << report.blocks << " blocks, "
+                      << report.images << " full-book checks; " << report.top_mismatches
+                      << " top-10 and " << report.book_mismatches << " full-book mismatches, "
+                      << report.crossed << " crossed; waited " << verifier_->stall_seconds()
+                      << " s)" << std::endl;
+        }
+        if (l3_dumper_) {
+            std::cerr << "L3 dumps: " << l3_dumper_->dumps_written() << " (book copies took "
+                      << l3_dumper_->copy_seconds() << " s)" << std::endl;
+        }
         
-        if (events_processed_ > 0) {
+        if (events_processed > 0) {
                     std::cerr << "Events per snapshot: " << 
-            static_cast<double>(events_processed_) / snapshots_emitted_ << std::endl;
+            static_cast<double>(events_processed) / snapshots_emitted_ << std::endl;
         std::cerr << "Compression ratio: " << 
-            (1.0 - static_cast<double>(snapshots_emitted_) / events_processed_) * 100.0 
+            (1.0 - static_cast<double>(snapshots_emitted_) / events_processed) * 100.0 
             << "%" << std::endl;
     }
     
-    std::cerr << "Active orders: " << order_book_->get_active_orders() << std::endl;
-    std::cerr << "Price levels: " << order_book_->get_price_levels() << std::endl;
-    std::cerr << "Total orders processed: " << order_book_->get_total_orders() << std::endl;
+    std::cerr << "Active orders: " << order_book.get_active_orders() << std::endl;
+    std::cerr << "Price levels: " << order_book.get_price_levels() << std::endl;
+    std::cerr << "Total orders processed: " << order_book.get_total_orders() << std::endl;
     
-    std::cerr << "Actions processed: " << action_engine_->get_actions_processed() << std::endl;
-    std::cerr << "Trades aggregated: " << action_engine_->get_trades_aggregated() << std::endl;
-    std::cerr << "Errors encountered: " << action_engine_->get_errors_encountered() << std::endl;
+    std::cerr << "Actions processed: " << action_engine.get_actions_processed() << std::endl;
+    std::cerr << "Trades aggregated: " << action_engine.get_trades_aggregated() << std::endl;
+    std::cerr << "Errors encountered: " << action_engine.get_errors_encountered() << std::endl;
     
-    snapshot_processor_->print_statistics();
+    // Keep plain text out of a compressed stream.
+    SnapshotProcessor::print_snapshot_statistics(output_ && output_->compressed() ? stderr : stdout,
+                                                 book_->book_updates(), snapshots_emitted_,
+                                                 book_->snapshot_manager());
     }
 };
 
@@ -158,8 +571,63 @@ void print_usage(const char* program_name) {
     std::cerr << "\nOptions:" << std::endl;
     std::cerr << "  --debug           Enable debug mode with verbose output" << std::endl;
     std::cerr << "  --max-events N    Process only first N events (debug mode)" << std::endl;
+    std::cerr << "  --prefetch-distance K" << std::endl;
+    std::cerr << "                    Prefetch order lookups K events ahead (default "
+              << ReconstructorConfig::DEFAULT_PREFETCH_DISTANCE << ", 0 disables)" << std::endl;
+    std::cerr << "  --stream          Read the input as a stream (pipe or FIFO); '-' is stdin" << std::endl;
+    std::cerr << "  --follow          Stream a file that is still being written, waiting" << std::endl;
+    std::cerr << "                    for more data at its end (implies --stream)" << std::endl;
+    std::cerr << "  --io-uring        Read the input and write the output through io_uring" << std::endl;
+    std::cerr << "  --compress zstd|gzip" << std::endl;
+    std::cerr << "                    Compress the output on background threads" << std::endl;
+    std::cerr << "  --compress-level N    Codec level (default: codec default)" << std::endl;
+    std::cerr << "  --compress-threads N  Compression threads (default: one per spare core)" << std::endl;
+    std::cerr << "  --publish-shm NAME    Also publish snapshots to shared memory (e.g. /mbp10)" << std::endl;
+    std::cerr << "  --shm-capacity N      Snapshots kept in the shared-memory ring (default "
+              << shm::DEFAULT_CAPACITY << ")" << std::endl;
+    std::cerr << "  --trades FILE     Also write the aggregated T+F+C trades to FILE" << std::endl;
+    std::cerr << "                    (ts_event,price,size,side,orders_filled; compressed" << std::endl;
+    std::cerr << "                    like the main output)" << std::endl;
+    std::cerr << "  --arrow FILE      Write the snapshots to FILE as Apache Arrow IPC instead" << std::endl;
+    std::cerr << "                    of CSV on stdout (a Feather v2 file; the stream format" << std::endl;
+    std::cerr << "                    if FILE ends in .arrows)" << std::endl;
+    std::cerr << "  --arrow-trades FILE   Also write the aggregated trades to FILE as Arrow" << std::endl;
+    std::cerr << "  --bars FILE       Also write OHLCV/VWAP and spread bars to FILE" << std::endl;
+    std::cerr << "  --bar-interval NS Bar length in event time (default 60 s); bars need every" << std::endl;
+    std::cerr << "                    book change, so not with --conflate or --sample-interval" << std::endl;
+    std::cerr << "  --features DIR    Also write order-book features, one binary column" << std::endl;
+    std::cerr << "                    file per feature (see features.hpp), to DIR" << std::endl;
+    std::cerr << "  --feature-set LIST    imbalance,weighted_mid,slope,depletion (default all)" << std::endl;
+    std::cerr << "  --feature-depth N Levels per side the features cover, 1-10 (default 5)" << std::endl;
+    std::cerr << "  --l3-dump FILE    Write full order-level book dumps (binary, see" << std::endl;
+    std::cerr << "                    l3_dump.hpp) to FILE, from a background thread" << std::endl;
+    std::cerr << "  --l3-interval NS  Dump at every NS of event time (quiet intervals skipped)" << std::endl;
+    std::cerr << "  --l3-at TS[,TS...]    Dump the book as of these ts_event values" << std::endl;
+    std::cerr << "  --conflate        Emit at most one snapshot per exchange event, after" << std::endl;
+    std::cerr << "                    its record flagged last-in-event (flags & 128)" << std::endl;
+    std::cerr << "  --sample-interval NS  Emit the book as of every NS of event time instead" << std::endl;
+    std::cerr << "                    of on every change (e.g. 1000000000 for 1 s)" << std::endl;
+    std::cerr << "  --order-counts    Add bid_ct_NN/ask_ct_NN (orders per level) columns" << std::endl;
+    std::cerr << "  --derived-fields N    Add mid,microprice,spread,imbalance columns, the" << std::endl;
+    std::cerr << "                    imbalance over the top N (1-10) levels" << std::endl;
+    std::cerr << "  --metrics-interval SEC    How often progress and metrics are reported" << std::endl;
+    std::cerr << "                    (default 1)" << std::endl;
+    std::cerr << "  --metrics-file FILE   Rewrite FILE with Prometheus-format metrics every" << std::endl;
+    std::cerr << "                    interval (events/s, snapshots/s, book size, backlogs)" << std::endl;
+    std::cerr << "  --no-progress     No progress lines on stderr" << std::endl;
+    std::cerr << "  --verify          Check the book against an independent reference book" << std::endl;
+    std::cerr << "                    on a background thread (exit status 1 on a mismatch)" << std::endl;
+    std::cerr << "  --verify-every N  Compare the whole book every N event blocks (default "
+              << ShadowVerifier::DEFAULT_IMAGE_EVERY << ", 0: top 10 only)" << std::endl;
+    std::cerr << "  --end-time TS     Stop at the first record with ts_event past TS; the" << std::endl;
+    std::cerr << "                    rest of the input is not read (also ends --follow)" << std::endl;
+    std::cerr << "  --order-index hash|dense" << std::endl;
+    std::cerr << "                    Order id lookup structure (default hash; dense suits" << std::endl;
+    std::cerr << "                    near-sequential venue order ids)" << std::endl;
+    std::cerr << "\nGzip and zstd input (.gz/.zst) is decompressed on the fly." << std::endl;
     std::cerr << "\nExample:" << std::endl;
     std::cerr << "  " << program_name << " data/mbo.csv > output/mbp.csv" << std::endl;
+    std::cerr << "  capture | " << program_name << " - > output/mbp.csv" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -170,6 +638,7 @@ int main(int argc, char* argv[]) {
     
     bool debug_mode = false;
     uint64_t max_events = UINT64_MAX;
+    ReconstructorConfig config;
     const char* input_file = nullptr;
     
     for (int i = 1; i < argc; ++i) {
@@ -177,6 +646,113 @@ int main(int argc, char* argv[]) {
             debug_mode = true;
         } else if (std::string(argv[i]) == "--max-events" && i + 1 < argc) {
             max_events = std::stoull(argv[++i]);
+        } else if (std::string(argv[i]) == "--prefetch-distance" && i + 1 < argc) {
+            config.prefetch_distance = std::stoull(argv[++i]);
+        } else if (std::string(argv[i]) == "--stream") {
+            config.stream_input = true;
+        } else if (std::string(argv[i]) == "--follow") {
+            config.stream_input = true;
+            config.follow_input = true;
+        } else if (std::string(argv[i]) == "--io-uring") {
+            config.io_uring = true;
+        } else if (std::string(argv[i]) == "--compress" && i + 1 < argc) {
+            std::string codec = argv[++i];
+            if (codec == "zstd") {
+                config.output_codec = OutputCodec::Zstd;
+            } else if (codec == "gzip") {
+                config.output_codec = OutputCodec::Gzip;
+            } else {
+                std::cerr << "Error: Unknown codec '" << codec << "'" << std::endl;
+                return 1;
+            }
+            config.compress_output = true;
+        } else if (std::string(argv[i]) == "--compress-level" && i + 1 < argc) {
+            config.compress_level = std::stoi(argv[++i]);
+        } else if (std::string(argv[i]) == "--compress-threads" && i + 1 < argc) {
+            config.compress_threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (std::string(argv[i]) == "--publish-shm" && i + 1 < argc) {
+            config.shm_name = argv[++i];
+        } else if (std::string(argv[i]) == "--shm-capacity" && i + 1 < argc) {
+            config.shm_capacity = std::stoull(argv[++i]);
+        } else if (std::string(argv[i]) == "--trades" && i + 1 < argc) {
+            config.trades_path = argv[++i];
+        } else if (std::string(argv[i]) == "--arrow" && i + 1 < argc) {
+            config.arrow_path = argv[++i];
+        } else if (std::string(argv[i]) == "--arrow-trades" && i + 1 < argc) {
+            config.arrow_trades_path = argv[++i];
+        } else if (std::string(argv[i]) == "--bars" && i + 1 < argc) {
+            config.bars_path = argv[++i];
+        } else if (std::string(argv[i]) == "--bar-interval" && i + 1 < argc) {
+            config.bar_interval_ns = std::stoull(argv[++i]);
+            if (config.bar_interval_ns == 0) {
+                std::cerr << "Error: --bar-interval must be positive" << std::endl;
+                return 1;
+            }
+        } else if (std::string(argv[i]) == "--features" && i + 1 < argc) {
+            config.features_dir = argv[++i];
+        } else if (std::string(argv[i]) == "--feature-set" && i + 1 < argc) {
+            try {
+                config.features.groups = parse_feature_groups(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        } else if (std::string(argv[i]) == "--feature-depth" && i + 1 < argc) {
+            config.features.depth = std::stoi(argv[++i]);
+            if (config.features.depth < 1 || config.features.depth > 10) {
+                std::cerr << "Error: --feature-depth takes 1 to 10 levels" << std::endl;
+                return 1;
+            }
+        } else if (std::string(argv[i]) == "--l3-dump" && i + 1 < argc) {
+            config.l3_path = argv[++i];
+        } else if (std::string(argv[i]) == "--l3-interval" && i + 1 < argc) {
+            config.l3_interval_ns = std::stoull(argv[++i]);
+        } else if (std::string(argv[i]) == "--l3-at" && i + 1 < argc) {
+            std::string list = argv[++i];
+            for (size_t pos = 0; pos < list.size(); ) {
+                size_t comma = std::min(list.find(',', pos), list.size());
+                config.l3_times.push_back(std::stoull(list.substr(pos, comma - pos)));
+                pos = comma + 1;
+            }
+        } else if (std::string(argv[i]) == "--conflate") {
+            config.conflate = true;
+        } else if (std::string(argv[i]) == "--sample-interval" && i + 1 < argc) {
+            config.sample_interval_ns = std::stoull(argv[++i]);
+        } else if (std::string(argv[i]) == "--order-counts") {
+            config.order_counts = true;
+        } else if (std::string(argv[i]) == "--derived-fields" && i + 1 < argc) {
+            config.derived_depth = std::stoi(argv[++i]);
+            if (config.derived_depth < 1 || config.derived_depth > 10) {
+                std::cerr << "Error: --derived-fields takes 1 to 10 levels" << std::endl;
+                return 1;
+            }
+        } else if (std::string(argv[i]) == "--metrics-interval" && i + 1 < argc) {
+            config.metrics_interval_s = std::stod(argv[++i]);
+            if (!(config.metrics_interval_s >= 0.001)) {
+                std::cerr << "Error: --metrics-interval must be at least 0.001" << std::endl;
+                return 1;
+            }
+        } else if (std::string(argv[i]) == "--metrics-file" && i + 1 < argc) {
+            config.metrics_path = argv[++i];
+        } else if (std::string(argv[i]) == "--no-progress") {
+            config.progress = false;
+        } else if (std::string(argv[i]) == "--verify") {
+            config.verify = true;
+        } else if (std::string(argv[i]) == "--verify-every" && i + 1 < argc) {
+            config.verify = true;
+            config.verify_image_every = std::stoull(argv[++i]);
+        } else if (std::string(argv[i]) == "--end-time" && i + 1 < argc) {
+            config.end_time_ns = std::stoull(argv[++i]);
+        } else if (std::string(argv[i]) == "--order-index" && i + 1 < argc) {
+            std::string kind = argv[++i];
+            if (kind == "dense") {
+                config.order_index = OrderIndexKind::Dense;
+            } else if (kind == "hash") {
+                config.order_index = OrderIndexKind::Hash;
+            } else {
+                std::cerr << "Error: Unknown order index '" << kind << "'" << std::endl;
+                return 1;
+            }
         } else {
             input_file = argv[i];
         }
@@ -188,6 +764,22 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    if (!config.l3_path.empty() && config.l3_interval_ns == 0 && config.l3_times.empty()) {
+        std::cerr << "Error: --l3-dump needs --l3-interval or --l3-at" << std::endl;
+        return 1;
+    }
+    
+    // Bars take their quotes from the reported book changes; sampled or
+    // conflated output hides the top-of-book changes in between.
+    if (!config.bars_path.empty() && (config.conflate || config.sample_interval_ns > 0)) {
+        std::cerr << "Error: --bars cannot be combined with --conflate or --sample-interval" << std::endl;
+        return 1;
+    }
+    
+    if (std::string(input_file) == "-") {
+        config.stream_input = true;
+    }
+    
     std::cerr << "MBP Reconstructor v1.0 - High Performance Order Book Reconstruction" << std::endl;
     std::cerr << "Input file: " << input_file << std::endl;
     
@@ -198,7 +790,7 @@ int main(int argc, char* argv[]) {
         DebugReconstructor debug_reconstructor(true, max_events);
         success = debug_reconstructor.reconstruct_debug(input_file);
     } else {
-        MBPReconstructor reconstructor;
+        MBPReconstructor reconstructor(config);
         success = reconstructor.reconstruct(input_file);
     }
     
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace mbp_reconstructor {
+
+// Figures of a replay in progress, stored by the thread that applies the
+// events (after each block, never per event) and read by a MetricsReporter.
+// Every value has that one writer and readers only need a recent figure,
+// so all accesses are relaxed: a store is a plain mov.
+struct ReplayMetrics {
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> snapshots{0};
+    std::atomic<uint64_t> trades{0};
+    std::atomic<uint64_t> active_orders{0};
+    std::atomic<uint64_t> price_levels{0};
+    std::atomic<uint64_t> pool_high_water{0};   // order pool slots ever used
+    std::atomic<uint64_t> pool_capacity{0};     // order pool slots allocated
+    std::atomic<uint64_t> output_backlog{0};    // compressed output frames queued
+    std::atomic<uint64_t> l3_backlog{0};        // L3 dumps queued
+    
+    static void set(std::atomic<uint64_t>& value, uint64_t to) noexcept {
+        value.store(to, std::memory_order_relaxed);
+    }
+    
+    static uint64_t get(const std::atomic<uint64_t>& value) noexcept {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+// A plain copy of ReplayMetrics, with the rates over the last interval.
+struct MetricsSample {
+    uint64_t events = 0;
+    uint64_t snapshots = 0;
+    uint64_t trades = 0;
+    uint64_t active_orders = 0;
+    uint64_t price_levels = 0;
+    uint64_t pool_high_water = 0;
+    uint64_t pool_capacity = 0;
+    uint64_t output_backlog = 0;
+    uint64_t l3_backlog = 0;
+    double events_per_second = 0.0;
+    double snapshots_per_second = 0.0;
+    
+    static MetricsSample read(const ReplayMetrics& metrics) noexcept {
+        MetricsSample sample;
+        sample.events = ReplayMetrics::get(metrics.events);
+        sample.snapshots = ReplayMetrics::get(metrics.snapshots);
+        sample.trades = ReplayMetrics::get(metrics.trades);
+        sample.active_orders = ReplayMetrics::get(metrics.active_orders);
+        sample.price_levels = ReplayMetrics::get(metrics.price_levels);
+        sample.pool_high_water = ReplayMetrics::get(metrics.pool_high_water);
+        sample.pool_capacity = ReplayMetrics::get(metrics.pool_capacity);
+        sample.output_backlog = ReplayMetrics::get(metrics.output_backlog);
+        sample.l3_backlog = ReplayMetrics::get(metrics.l3_backlog);
+        return sample;
+    }
+    
+    // The Prometheus text exposition format.
+    std::string to_prometheus() const {
+        std::string text;
+        append(text, "mbp_events_total", "counter", "MBO events applied.", events);
+        append(text, "mbp_snapshots_total", "counter", "MBP-10 snapshots emitted.", snapshots);
+        append(text, "mbp_trades_total", "counter", "T+F+C trades aggregated.", trades);
+        append(text, "mbp_events_per_second", "gauge", "Events applied per second, last interval.",
+               events_per_second);
+        append(text, "mbp_snapshots_per_second", "gauge",
+               "Snapshots emitted per second, last interval.", snapshots_per_second);
+        append(text, "mbp_active_orders", "gauge", "Orders resting in the book.", active_orders);
+        append(text, "mbp_price_levels", "gauge", "Price levels in the book.", price_levels);
+        append(text, "mbp_order_pool_high_water", "gauge", "Order pool slots ever used.",
+               pool_high_water);
+        append(text, "mbp_order_pool_capacity", "gauge", "Order pool slots allocated.",
+               pool_capacity);
+        append(text, "mbp_output_backlog_frames", "gauge",
+               "Output frames queued for compression.", output_backlog);
+        append(text, "mbp_l3_backlog_dumps", "gauge", "L3 dumps queued for writing.", l3_backlog);
+        return text;
+    }
+    
+private:
+    static void append(std::string& text, const char* name, const char* type, const char* help,
+                       double value) {
+        char buffer[256];
+        int n = std::snprintf(buffer, sizeof(buffer), "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n",
+                              name, help, name, type, name, value);
+        text.append(buffer, n);
+    }
+};
+
+// Reports ReplayMetrics from a thread of its own every interval: a progress
+// line on stderr, and/or the Prometheus text rewritten in place (a
+// temporary file renamed over it, as node_exporter's textfile collector
+// expects). stop() takes a last sample, so the file ends up with the final
+// figures.
+class MetricsReporter {
+private:
+    const ReplayMetrics& metrics_;
+    std::chrono::milliseconds interval_;
+    bool log_progress_;
+    std::string prometheus_path_;
+    
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_;
+    std::thread thread_;
+    
+    MetricsSample last_;
+    std::chrono::steady_clock::time_point last_time_;
+    
+public:
+    MetricsReporter(const ReplayMetrics& metrics, std::chrono::milliseconds interval,
+                    bool log_progress, std::string prometheus_path = {})
+        : metrics_(metrics), interval_(interval), log_progress_(log_progress),
+          prometheus_path_(std::move(prometheus_path)), stopping_(false),
+          last_time_(std::chrono::steady_clock::now()) {
+        thread_ = std::thread([this] { run(); });
+    }
+    
+    ~MetricsReporter() { stop(); }
+    
+    MetricsReporter(const MetricsReporter&) = delete;
+    MetricsReporter& operator=(const MetricsReporter&) = delete;
+    
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_) return;
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+    
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!wake_.wait_for(lock, interval_, [this] { return stopping_; })) {
+            lock.unlock();
+            report(false);
+            lock.lock();
+        }
+        lock.unlock();
+        report(true);
+    }
+    
+    void report(bool final) {
+        auto now = std::chrono::steady_clock::now();
+        MetricsSample sample = MetricsSample::read(metrics_);
+        double seconds = std::chrono::duration<double>(now - last_time_).count();
+        if (seconds > 0) {
+            sample.events_per_second = (sample.events - last_.events) / seconds;
+            sample.snapshots_per_second = (sample.snapshots - last_.snapshots) / seconds;
+        }
+        
+        if (log_progress_ && !final) {
+            std::fprintf(stderr, "Processed %llu events (%.0f events/s, %.0f snapshots/s), "
+                         "%llu orders, %llu levels, pool %llu/%llu, backlog %llu frames, "
+                         "%llu dumps\n",
+                         (unsigned long long)sample.events, sample.events_per_second,
+                         sample.snapshots_per_second, (unsigned long long)sample.active_orders,
+                         (unsigned long long)sample.price_levels,
+                         (unsigned long long)sample.pool_high_water,
+                         (unsigned long long)sample.pool_capacity,
+                         (unsigned long long)sample.output_backlog,
+                         (unsigned long long)sample.l3_backlog);
+        }
+        if (!prometheus_path_.empty()) {
+            write_prometheus(sample);
+        }
+        
+        last_ = sample;
+        last_time_ = now;
+    }
+    
+    void write_prometheus(const MetricsSample& sample) {
+        std::string text = sample.to_prometheus();
+        std::string temporary = prometheus_path_ + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "w");
+        if (!file) return;          // monitoring must not stop the replay
+        bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+        written = std::fclose(file) == 0 && written;
+        if (written) {
+            std::rename(temporary.c_str(), prometheus_path_.c_str());
+        }
+    }
+};
+
+} // namespace mbp_reconstructor
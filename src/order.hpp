@@ -1,10 +1,14 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 
 namespace mbp_reconstructor {
 
+// MBO record flags (the feed's flags column).
+constexpr uint8_t F_LAST = 1 << 7;    // last record of an exchange event
+
 struct alignas(32) Event {
     uint64_t timestamp_ns;
     uint64_t order_id;
@@ -13,13 +17,15 @@ struct alignas(32) Event {
     uint16_t sequence;
     char     action;          // A,M,C,T,F,R,N
     char     side;            // B,A,N
-    char     padding[6];
+    uint8_t  flags;
+    char     padding[5];
     
     Event() = default;
     
-    Event(uint64_t ts, char act, char sd, int64_t px, uint32_t sz, uint64_t oid)
+    Event(uint64_t ts, char act, char sd, int64_t px, uint32_t sz, uint64_t oid,
+          uint8_t fl = F_LAST)
         : timestamp_ns(ts), order_id(oid), price_raw(px), size(sz), 
-          sequence(0), action(act), side(sd) {
+          sequence(0), action(act), side(sd), flags(fl) {
         std::memset(padding, 0, sizeof(padding));
     }
     
@@ -31,79 +37,168 @@ struct alignas(32) Event {
     bool is_cancel() const noexcept { return action == 'C'; }
     bool is_fill() const noexcept { return action == 'F'; }
     bool is_clear() const noexcept { return action == 'R'; }
+    bool is_last_in_event() const noexcept { return (flags & F_LAST) != 0; }
 } __attribute__((packed));
 
 static_assert(sizeof(Event) <= 64, "Event structure should be reasonably sized for cache efficiency");
 
+// A block of events stored column by column, as the parsers fill it
+// (parse_events(EventBlock&)). Passes that only need a field or two, such
+// as picking out the records that look up a resting order, read those
+// columns contiguously instead of striding over whole records. Rows past
+// count are zero or stale but always initialized, so a pass may run over
+// whole 64-row groups. Too large for the stack; allocate it.
+struct EventBlock {
+    static constexpr size_t CAPACITY = 4096;
+    
+    size_t count = 0;
+    alignas(64) uint64_t timestamps[CAPACITY] = {};
+    alignas(64) uint64_t order_ids[CAPACITY] = {};
+    alignas(64) int64_t  prices[CAPACITY] = {};
+    alignas(64) uint32_t sizes[CAPACITY] = {};
+    alignas(64) char     actions[CAPACITY] = {};
+    alignas(64) char     sides[CAPACITY] = {};
+    alignas(64) uint8_t  flags[CAPACITY] = {};
+    
+    bool full() const noexcept { return count == CAPACITY; }
+    
+    void push_back(const Event& event) noexcept {
+        timestamps[count] = event.timestamp_ns;
+        order_ids[count] = event.order_id;
+        prices[count] = event.price_raw;
+        sizes[count] = event.size;
+        actions[count] = event.action;
+        sides[count] = event.side;
+        flags[count] = event.flags;
+        ++count;
+    }
+    
+    Event operator[](size_t i) const noexcept {
+        return Event(timestamps[i], actions[i], sides[i], prices[i], sizes[i], order_ids[i], flags[i]);
+    }
+};
+
+static_assert(EventBlock::CAPACITY % 64 == 0, "passes run over whole 64-row groups");
+
+// Orders live in a single arena (OrderPool) and are linked by 32-bit
+// indices instead of pointers, so the per-level FIFO stays compact and the
+// arena can grow without invalidating links. Anything indexable by
+// OrderIndex works as the arena argument below.
+using OrderIndex = uint32_t;
+constexpr OrderIndex NULL_ORDER = UINT32_MAX;
+
+// Hot half of an order: everything touched when a fill or cancel walks or
+// relinks the level queue. Rarely read fields live in OrderInfo, a side
+// table indexed by the same OrderIndex, so more live orders fit in L1/L2.
 struct Order {
-    uint64_t order_id;
-    int64_t  price_raw;
-    uint32_t size;
-    uint32_t original_size;
-    uint64_t timestamp_ns;
-    Order*   next;
-    Order*   prev;
+    int64_t    price_raw;
+    uint32_t   size;
+    OrderIndex next;
+    OrderIndex prev;
+    char       side;          // B,A
     
     Order() = default;
     
-    Order(uint64_t oid, int64_t px, uint32_t sz, uint64_t ts)
-        : order_id(oid), price_raw(px), size(sz), original_size(sz),
-          timestamp_ns(ts), next(nullptr), prev(nullptr) {}
+    Order(int64_t px, uint32_t sz, char sd)
+        : price_raw(px), size(sz), next(NULL_ORDER), prev(NULL_ORDER), side(sd) {}
           
-    void unlink() noexcept {
-        if (next) next->prev = prev;
-        if (prev) prev->next = next;
-        next = prev = nullptr;
+    template<typename Arena>
+    void unlink(Arena& arena) noexcept {
+        if (next != NULL_ORDER) arena[next].prev = prev;
+        if (prev != NULL_ORDER) arena[prev].next = next;
+        next = prev = NULL_ORDER;
     }
 };
 
+static_assert(sizeof(Order) == 24, "Order should only carry hot matching fields");
+
+// Cold half of an order, read on full fills and for reporting.
+struct OrderInfo {
+    uint64_t order_id;
+    uint64_t timestamp_ns;
+    uint32_t original_size;
+    uint32_t queue_ticket;    // book-wide enqueue counter; orders earlier in a
+                              // level queue hold earlier tickets
+    
+    OrderInfo() = default;
+    
+    OrderInfo(uint64_t oid, uint32_t sz, uint64_t ts)
+        : order_id(oid), timestamp_ns(ts), original_size(sz), queue_ticket(0) {}
+};
+
+static_assert(sizeof(OrderInfo) == 24, "queue_ticket fills OrderInfo's padding");
+
+// Whether ticket a was issued before ticket b. Wrap-safe while the live
+// orders of a level span fewer than 2^31 enqueues.
+constexpr bool queue_ticket_before(uint32_t a, uint32_t b) noexcept {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
 struct Level {
-    int64_t  price_raw;
-    uint64_t total_size;
-    uint32_t order_count;
-    Order*   first_order;
-    Order*   last_order;
+    int64_t    price_raw;
+    uint64_t   total_size;
+    uint32_t   order_count;
+    OrderIndex first_order;
+    OrderIndex last_order;
+    uint32_t   watchers;      // watched orders resting here (QueueTracker)
     
     Level() : price_raw(0), total_size(0), order_count(0), 
-              first_order(nullptr), last_order(nullptr) {}
+              first_order(NULL_ORDER), last_order(NULL_ORDER), watchers(0) {}
               
     explicit Level(int64_t px) : price_raw(px), total_size(0), order_count(0),
-                                 first_order(nullptr), last_order(nullptr) {}
+                                 first_order(NULL_ORDER), last_order(NULL_ORDER), watchers(0) {}
     
-    void add_order(Order* order) noexcept {
-        if (!first_order) {
-            first_order = last_order = order;
+    template<typename Arena>
+    void add_order(Arena& arena, OrderIndex idx) noexcept {
+        Order& order = arena[idx];
+        if (first_order == NULL_ORDER) {
+            first_order = last_order = idx;
         } else {
-            last_order->next = order;
-            order->prev = last_order;
-            last_order = order;
+            arena[last_order].next = idx;
+            order.prev = last_order;
+            last_order = idx;
         }
-        total_size += order->size;
+        total_size += order.size;
         ++order_count;
     }
     
-    void remove_order(Order* order) noexcept {
-        if (order == first_order) first_order = order->next;
-        if (order == last_order) last_order = order->prev;
+    template<typename Arena>
+    void remove_order(Arena& arena, OrderIndex idx) noexcept {
+        Order& order = arena[idx];
+        if (idx == first_order) first_order = order.next;
+        if (idx == last_order) last_order = order.prev;
         
-        total_size -= order->size;
+        total_size -= order.size;
         --order_count;
-        order->unlink();
+        order.unlink(arena);
     }
     
-    void modify_order_size(Order* /*order*/, uint32_t old_size, uint32_t new_size) noexcept {
+    void modify_order_size(OrderIndex /*idx*/, uint32_t old_size, uint32_t new_size) noexcept {
         total_size = total_size - old_size + new_size;
     }
     
     bool empty() const noexcept { return order_count == 0; }
 };
 
+static_assert(sizeof(Level) == 32, "watchers fills Level's padding");
+
+// Level bits of a snapshot change mask: bit i is bid level i, bit 10 + i
+// is ask level i.
+constexpr uint32_t BID_LEVELS_MASK = 0x3FF;
+constexpr uint32_t ASK_LEVELS_MASK = 0x3FF << 10;
+constexpr uint32_t ALL_LEVELS_MASK = BID_LEVELS_MASK | ASK_LEVELS_MASK;
+
+constexpr uint32_t bid_level_bit(int level) noexcept { return 1u << level; }
+constexpr uint32_t ask_level_bit(int level) noexcept { return 1u << (10 + level); }
+
 struct MBPSnapshot {
     uint64_t timestamp_ns;
     int64_t  bid_px[10];
     uint64_t bid_sz[10];
     int64_t  ask_px[10];
     uint64_t ask_sz[10];
+    uint32_t bid_ct[10];      // resting orders per level
+    uint32_t ask_ct[10];
     
     MBPSnapshot() {
         timestamp_ns = 0;
@@ -111,13 +206,36 @@ struct MBPSnapshot {
         std::memset(bid_sz, 0, sizeof(bid_sz));
         std::memset(ask_px, 0, sizeof(ask_px));
         std::memset(ask_sz, 0, sizeof(ask_sz));
+        std::memset(bid_ct, 0, sizeof(bid_ct));
+        std::memset(ask_ct, 0, sizeof(ask_ct));
     }
     
-    bool differs_from(const MBPSnapshot& other) const noexcept {
+    // Whether any level's price or size differs from other; with counts,
+    // its order count too.
+    bool differs_from(const MBPSnapshot& other, bool counts = false) const noexcept {
         return std::memcmp(bid_px, other.bid_px, sizeof(bid_px)) != 0 ||
                std::memcmp(bid_sz, other.bid_sz, sizeof(bid_sz)) != 0 ||
                std::memcmp(ask_px, other.ask_px, sizeof(ask_px)) != 0 ||
-               std::memcmp(ask_sz, other.ask_sz, sizeof(ask_sz)) != 0;
+               std::memcmp(ask_sz, other.ask_sz, sizeof(ask_sz)) != 0 ||
+               (counts && (std::memcmp(bid_ct, other.bid_ct, sizeof(bid_ct)) != 0 ||
+                           std::memcmp(ask_ct, other.ask_ct, sizeof(ask_ct)) != 0));
+    }
+    
+    // Levels whose price or size (with counts, also order count) differs
+    // from other, as a level mask.
+    uint32_t changed_levels(const MBPSnapshot& other, bool counts = false) const noexcept {
+        uint32_t mask = 0;
+        for (int i = 0; i < 10; ++i) {
+            if (bid_px[i] != other.bid_px[i] || bid_sz[i] != other.bid_sz[i] ||
+                (counts && bid_ct[i] != other.bid_ct[i])) {
+                mask |= bid_level_bit(i);
+            }
+            if (ask_px[i] != other.ask_px[i] || ask_sz[i] != other.ask_sz[i] ||
+                (counts && ask_ct[i] != other.ask_ct[i])) {
+                mask |= ask_level_bit(i);
+            }
+        }
+        return mask;
     }
 };
 
@@ -126,14 +244,15 @@ struct TradeInfo {
     uint64_t trade_id;
     int64_t  price_raw;
     uint32_t size;
-    char     side;
+    uint32_t orders_filled;   // resting orders hit, set once executed
+    char     side;            // aggressor side
     bool     is_aggressor_fill;
     
     TradeInfo() = default;
     
     TradeInfo(uint64_t ts, uint64_t tid, int64_t px, uint32_t sz, char sd)
         : timestamp_ns(ts), trade_id(tid), price_raw(px), size(sz), 
-          side(sd), is_aggressor_fill(false) {}
+          orders_filled(0), side(sd), is_aggressor_fill(false) {}
 };
 
 struct BidComparator {
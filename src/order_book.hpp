@@ -1,150 +1,344 @@
 #pragma once
 
 #include "order.hpp"
-#include "../include/robin_hood.h"
+#include "order_index.hpp"
+#include "queue_tracker.hpp"
 #include <map>
 #include <memory>
 #include <array>
 #include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <vector>
+#include <new>
 
 namespace mbp_reconstructor {
 
+// Orders and their cold OrderInfo live in fixed-size chunks, so the arena
+// grows one chunk at a time instead of copying every live order when a
+// contiguous buffer would have to be reallocated.
+//
+// Chunks are shared with the copies share_with() makes, copy-on-write: a
+// pool writing to a chunk it shares (anything reached through the
+// non-const accessors) first gives itself a private copy of just that
+// chunk, so a copy reads on another thread while the original changes.
 class OrderPool {
 private:
-    static constexpr size_t POOL_SIZE = 50000;
-    std::array<Order, POOL_SIZE> pool_;
-    std::vector<Order*> free_list_;
+    static constexpr unsigned CHUNK_BITS = 10;
+    static constexpr size_t   CHUNK_SIZE = size_t{1} << CHUNK_BITS;
+    static constexpr size_t   CHUNK_MASK = CHUNK_SIZE - 1;
+    
+    // shared_ bits per chunk
+    static constexpr uint8_t ORDERS_SHARED = 1;
+    static constexpr uint8_t INFOS_SHARED = 2;
+    
+    std::vector<std::shared_ptr<Order[]>> order_chunks_;
+    std::vector<std::shared_ptr<OrderInfo[]>> info_chunks_;
+    mutable std::vector<uint8_t> shared_;
+    mutable size_t shared_count_;     // set bits in shared_; 0 skips the per-chunk check
+    size_t size_;
+    std::vector<OrderIndex> free_list_;
     
 public:
-    OrderPool() {
-        free_list_.reserve(POOL_SIZE);
-        for (size_t i = 0; i < POOL_SIZE; ++i) {
-            free_list_.push_back(&pool_[i]);
-        }
+    OrderPool() : shared_count_(0), size_(0) {
+        free_list_.reserve(CHUNK_SIZE);
     }
     
-    Order* allocate() {
+    OrderIndex allocate() {
         if (!free_list_.empty()) {
-            Order* order = free_list_.back();
+            OrderIndex idx = free_list_.back();
             free_list_.pop_back();
-            return order;
+            return idx;
+        }
+        
+        if ((size_ & CHUNK_MASK) == 0) {
+            order_chunks_.emplace_back(new Order[CHUNK_SIZE]);
+            info_chunks_.emplace_back(new OrderInfo[CHUNK_SIZE]);
+            shared_.push_back(0);
+        }
+        return static_cast<OrderIndex>(size_++);
+    }
+    
+    void deallocate(OrderIndex idx) {
+        free_list_.push_back(idx);
+    }
+    
+    // Frees every slot at once: the arena starts over from slot 0 in the
+    // chunks it already has. Slots are overwritten on allocation, so their
+    // old contents are left in place.
+    void reset() noexcept {
+        size_ = 0;
+        free_list_.clear();
+    }
+    
+    // Slots ever handed out (live or on the free list), and slots backed
+    // by allocated chunks.
+    size_t high_water() const noexcept { return size_; }
+    size_t capacity() const noexcept { return order_chunks_.size() * CHUNK_SIZE; }
+    
+    Order& operator[](OrderIndex idx) {
+        size_t chunk = idx >> CHUNK_BITS;
+        if (shared_count_ != 0) [[unlikely]] {
+            unshare(chunk, ORDERS_SHARED);
+        }
+        return order_chunks_[chunk][idx & CHUNK_MASK];
+    }
+    const Order& operator[](OrderIndex idx) const noexcept { 
+        return order_chunks_[idx >> CHUNK_BITS][idx & CHUNK_MASK]; 
+    }
+    
+    OrderInfo& info(OrderIndex idx) {
+        size_t chunk = idx >> CHUNK_BITS;
+        if (shared_count_ != 0) [[unlikely]] {
+            unshare(chunk, INFOS_SHARED);
         }
+        return info_chunks_[chunk][idx & CHUNK_MASK];
+    }
+    const OrderInfo& info(OrderIndex idx) const noexcept { 
+        return info_chunks_[idx >> CHUNK_BITS][idx & CHUNK_MASK]; 
+    }
+    
+    // Makes other a copy of the used part of the arena by sharing chunks
+    // rather than copying them; the first write to a chunk on either side
+    // copies it then. Free slots come along; only indices reachable from a
+    // level are meaningful in the copy. Chunks other held before are
+    // released.
+    void share_with(OrderPool& other) const {
+        size_t used = (size_ + CHUNK_MASK) >> CHUNK_BITS;
+        other.order_chunks_.assign(order_chunks_.begin(), order_chunks_.begin() + used);
+        other.info_chunks_.assign(info_chunks_.begin(), info_chunks_.begin() + used);
+        other.shared_.assign(used, ORDERS_SHARED | INFOS_SHARED);
+        other.shared_count_ = 2 * used;
+        other.size_ = size_;
+        other.free_list_.clear();
         
-        return new Order();
+        for (size_t i = 0; i < used; ++i) {
+            shared_count_ += (~shared_[i] & ORDERS_SHARED) + ((~shared_[i] & INFOS_SHARED) >> 1);
+            shared_[i] = ORDERS_SHARED | INFOS_SHARED;
+        }
     }
     
-    void deallocate(Order* order) {
-        if (order >= &pool_[0] && order < &pool_[POOL_SIZE]) {
-            *order = Order{};
-            free_list_.push_back(order);
+    // Drops every chunk, so a reader done with a copy frees the ones only
+    // it still holds on its own thread rather than at the next share_with().
+    void release() noexcept {
+        order_chunks_.clear();
+        info_chunks_.clear();
+        shared_.clear();
+        shared_count_ = 0;
+        size_ = 0;
+        free_list_.clear();
+    }
+    
+private:
+    // Copies the used slots of a shared chunk into one of this pool's own
+    // before it is written.
+    __attribute__((noinline, cold)) void unshare(size_t chunk, uint8_t which) {
+        if (!(shared_[chunk] & which)) return;
+        
+        size_t base = chunk << CHUNK_BITS;
+        size_t used = size_ > base ? std::min(CHUNK_SIZE, size_ - base) : 0;
+        if (which == ORDERS_SHARED) {
+            std::shared_ptr<Order[]> copy(new Order[CHUNK_SIZE]);
+            std::memcpy(copy.get(), order_chunks_[chunk].get(), used * sizeof(Order));
+            order_chunks_[chunk] = std::move(copy);
         } else {
-            delete order;
+            std::shared_ptr<OrderInfo[]> copy(new OrderInfo[CHUNK_SIZE]);
+            std::memcpy(copy.get(), info_chunks_[chunk].get(), used * sizeof(OrderInfo));
+            info_chunks_[chunk] = std::move(copy);
         }
+        shared_[chunk] &= static_cast<uint8_t>(~which);
+        --shared_count_;
     }
 };
 
+// Keeps the nodes a std::map frees for its next insertions, threaded
+// through the nodes themselves, so levels that come and go (and a clear
+// followed by a rebuild) cost no trips to malloc. Only blocks of the size
+// first freed are kept; the bid and ask maps share one recycler since
+// their nodes are the same size.
+class NodeRecycler {
+private:
+    struct FreeNode {
+        FreeNode* next;
+    };
+    
+    FreeNode* free_;
+    size_t node_size_;
+    
+public:
+    NodeRecycler() : free_(nullptr), node_size_(0) {}
+    
+    ~NodeRecycler() {
+        while (free_) {
+            FreeNode* node = free_;
+            free_ = node->next;
+            ::operator delete(node);
+        }
+    }
+    
+    NodeRecycler(const NodeRecycler&) = delete;
+    NodeRecycler& operator=(const NodeRecycler&) = delete;
+    
+    void* allocate(size_t bytes) {
+        if (free_ && bytes == node_size_) {
+            FreeNode* node = free_;
+            free_ = node->next;
+            return node;
+        }
+        return ::operator new(bytes);
+    }
+    
+    void deallocate(void* p, size_t bytes) noexcept {
+        if (node_size_ == 0 && bytes >= sizeof(FreeNode)) {
+            node_size_ = bytes;
+        }
+        if (bytes != node_size_) {
+            ::operator delete(p);
+            return;
+        }
+        free_ = new (p) FreeNode{free_};
+    }
+};
+
+template<typename T>
+class RecyclingAllocator {
+public:
+    using value_type = T;
+    
+    NodeRecycler* recycler;
+    
+    explicit RecyclingAllocator(NodeRecycler& r) noexcept : recycler(&r) {}
+    
+    template<typename U>
+    RecyclingAllocator(const RecyclingAllocator<U>& other) noexcept : recycler(other.recycler) {}
+    
+    T* allocate(size_t n) { return static_cast<T*>(recycler->allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) noexcept { recycler->deallocate(p, n * sizeof(T)); }
+    
+    template<typename U>
+    bool operator==(const RecyclingAllocator<U>& other) const noexcept {
+        return recycler == other.recycler;
+    }
+};
+
+// Flat copy of the whole book for a reader on another thread: the levels
+// in priority order with their FIFO links, and the order arena those links
+// index, shared with the book until either side writes to it. Taken with
+// OrderBook::copy_image().
+struct BookImage {
+    std::vector<Level> bids;      // best first
+    std::vector<Level> asks;      // best first
+    OrderPool orders;
+};
+
 class OrderBook {
 private:
-    std::map<int64_t, Level, BidComparator> bid_levels_;
-    std::map<int64_t, Level, AskComparator> ask_levels_;
+    using LevelAllocator = RecyclingAllocator<std::pair<const int64_t, Level>>;
     
-    robin_hood::unordered_flat_map<uint64_t, Order*> order_map_;
+    NodeRecycler level_nodes_;      // outlives the maps below
+    std::map<int64_t, Level, BidComparator, LevelAllocator> bid_levels_;
+    std::map<int64_t, Level, AskComparator, LevelAllocator> ask_levels_;
+    
+    OrderIdIndex order_map_;
     
     OrderPool order_pool_;
     
-    mutable std::array<int64_t, 10> cached_bid_prices_;
-    mutable std::array<uint64_t, 10> cached_bid_sizes_;
-    mutable std::array<int64_t, 10> cached_ask_prices_;
-    mutable std::array<uint64_t, 10> cached_ask_sizes_;
+    QueueTracker queue_tracker_;
+    uint32_t next_queue_ticket_;
+    
+    mutable MBPSnapshot cached_top_;      // timestamp unused
     mutable bool cache_valid_;
     
     mutable uint64_t total_orders_processed_;
     mutable uint64_t price_levels_created_;
     
 public:
-    OrderBook() : cache_valid_(false), total_orders_processed_(0), 
-                  price_levels_created_(0) {
+    explicit OrderBook(OrderIndexKind index_kind = OrderIndexKind::Hash) 
+        : bid_levels_(LevelAllocator(level_nodes_)), ask_levels_(LevelAllocator(level_nodes_)),
+          order_map_(index_kind), next_queue_ticket_(0), cache_valid_(false), total_orders_processed_(0), 
+          price_levels_created_(0) {
         order_map_.reserve(10000);
         
-        cached_bid_prices_.fill(0);
-        cached_bid_sizes_.fill(0);
-        cached_ask_prices_.fill(0);
-        cached_ask_sizes_.fill(0);
     }
     
     ~OrderBook() {
         clear();
     }
     
+    OrderBook(const OrderBook&) = delete;
+    OrderBook& operator=(const OrderBook&) = delete;
+    
     bool add_order(uint64_t order_id, int64_t price, uint32_t size, char side, uint64_t timestamp) {
-        if (order_map_.count(order_id)) {
+        if (order_map_.contains(order_id)) {
             return false;
         }
         
-        Order* order = order_pool_.allocate();
-        *order = Order(order_id, price, size, timestamp);
+        OrderIndex idx = order_pool_.allocate();
+        order_pool_[idx] = Order(price, size, side);
+        order_pool_.info(idx) = OrderInfo(order_id, size, timestamp);
         
         bool success = false;
         if (side == 'B') {
-            success = add_to_side(order, bid_levels_);
+            success = add_to_side(idx, bid_levels_);
         } else if (side == 'A') {
-            success = add_to_side(order, ask_levels_);
+            success = add_to_side(idx, ask_levels_);
         }
         
         if (success) {
-            order_map_[order_id] = order;
+            order_map_.insert(order_id, idx);
             cache_valid_ = false;
             ++total_orders_processed_;
         } else {
-            order_pool_.deallocate(order);
+            order_pool_.deallocate(idx);
         }
         
         return success;
     }
     
     bool modify_order(uint64_t order_id, int64_t new_price, uint32_t new_size) {
-        auto it = order_map_.find(order_id);
-        if (it == order_map_.end()) {
+        OrderIndex idx = order_map_.find(order_id);
+        if (idx == NULL_ORDER) {
             return false;
         }
         
-        Order* order = it->second;
-        int64_t old_price = order->price_raw;
-        uint32_t old_size = order->size;
+        Order& order = order_pool_[idx];
+        int64_t old_price = order.price_raw;
+        uint32_t old_size = order.size;
         
         if (old_price != new_price) {
-            char side = determine_side(order);
-            remove_order_from_level(order, side);
+            char side = determine_side(idx);
+            remove_order_from_level(idx, side);
             
-            order->price_raw = new_price;
-            order->size = new_size;
+            order.price_raw = new_price;
+            order.size = new_size;
             
             bool success = false;
             if (side == 'B') {
-                success = add_to_side(order, bid_levels_);
+                success = add_to_side(idx, bid_levels_);
             } else {
-                success = add_to_side(order, ask_levels_);
+                success = add_to_side(idx, ask_levels_);
             }
             
             if (!success) {
-                order_map_.erase(it);
-                order_pool_.deallocate(order);
+                order_map_.erase(order_id);
+                order_pool_.deallocate(idx);
                 return false;
             }
         } else {
-            char side = determine_side(order);
+            char side = determine_side(idx);
             if (side == 'B') {
                 auto level_it = bid_levels_.find(old_price);
                 if (level_it != bid_levels_.end()) {
-                    level_it->second.modify_order_size(order, old_size, new_size);
-                    order->size = new_size;
+                    level_it->second.modify_order_size(idx, old_size, new_size);
+                    order.size = new_size;
+                    track_resize(level_it->second, idx, old_size);
                 }
             } else {
                 auto level_it = ask_levels_.find(old_price);
                 if (level_it != ask_levels_.end()) {
-                    level_it->second.modify_order_size(order, old_size, new_size);
-                    order->size = new_size;
+                    level_it->second.modify_order_size(idx, old_size, new_size);
+                    order.size = new_size;
+                    track_resize(level_it->second, idx, old_size);
                 }
             }
         }
@@ -154,35 +348,44 @@ public:
     }
     
     bool cancel_order(uint64_t order_id) {
-        auto it = order_map_.find(order_id);
-        if (it == order_map_.end()) {
+        OrderIndex idx = order_map_.find(order_id);
+        if (idx == NULL_ORDER) {
             return false;
         }
         
-        Order* order = it->second;
-        char side = determine_side(order);
+        char side = determine_side(idx);
         
-        remove_order_from_level(order, side);
-        order_map_.erase(it);
-        order_pool_.deallocate(order);
+        remove_order_from_level(idx, side);
+        order_map_.erase(order_id);
+        order_pool_.deallocate(idx);
         
         cache_valid_ = false;
         return true;
     }
     
-    bool execute_trade(int64_t price, uint32_t size, char aggressor_side) {
+    // orders_filled, when given, receives the number of resting orders the
+    // trade (partially) filled.
+    bool execute_trade(int64_t price, uint32_t size, char aggressor_side,
+                       uint32_t* orders_filled = nullptr) {
         char passive_side = (aggressor_side == 'B') ? 'A' : 'B';
+        uint32_t filled = 0;
+        bool success;
         
         if (passive_side == 'B') {
-            return execute_trade_on_side(price, size, bid_levels_);
+            success = execute_trade_on_side(price, size, bid_levels_, filled);
         } else {
-            return execute_trade_on_side(price, size, ask_levels_);
+            success = execute_trade_on_side(price, size, ask_levels_, filled);
         }
+        
+        if (orders_filled) {
+            *orders_filled = filled;
+        }
+        return success;
     }
 
 private:
     template<typename LevelMap>
-    bool execute_trade_on_side(int64_t price, uint32_t size, LevelMap& levels) {
+    bool execute_trade_on_side(int64_t price, uint32_t size, LevelMap& levels, uint32_t& filled) {
         auto level_it = levels.find(price);
         if (level_it == levels.end()) {
             return false;
@@ -191,19 +394,23 @@ private:
         Level& level = level_it->second;
         uint32_t remaining_size = size;
         
-        while (remaining_size > 0 && level.first_order != nullptr) {
-            Order* order = level.first_order;
+        while (remaining_size > 0 && level.first_order != NULL_ORDER) {
+            OrderIndex idx = level.first_order;
+            Order& order = order_pool_[idx];
+            ++filled;
             
-            if (order->size <= remaining_size) {
-                remaining_size -= order->size;
+            if (order.size <= remaining_size) {
+                remaining_size -= order.size;
                 
-                order_map_.erase(order->order_id);
-                level.remove_order(order);
-                order_pool_.deallocate(order);
+                track_removal(level, idx);
+                order_map_.erase(order_pool_.info(idx).order_id);
+                level.remove_order(order_pool_, idx);
+                order_pool_.deallocate(idx);
             } else {
-                uint32_t old_size = order->size;
-                order->size -= remaining_size;
-                level.modify_order_size(order, old_size, order->size);
+                uint32_t old_size = order.size;
+                order.size -= remaining_size;
+                level.modify_order_size(idx, old_size, order.size);
+                track_resize(level, idx, old_size);
                 remaining_size = 0;
             }
         }
@@ -219,13 +426,11 @@ private:
 public:
      
     void clear() {
-        for (auto& [order_id, order] : order_map_) {
-            order_pool_.deallocate(order);
-        }
-        
+        order_pool_.reset();
         order_map_.clear();
         bid_levels_.clear();
         ask_levels_.clear();
+        queue_tracker_.on_clear();
         cache_valid_ = false;
     }
     
@@ -234,10 +439,21 @@ public:
             update_cache();
         }
         
-        std::copy(cached_bid_prices_.begin(), cached_bid_prices_.end(), snapshot.bid_px);
-        std::copy(cached_bid_sizes_.begin(), cached_bid_sizes_.end(), snapshot.bid_sz);
-        std::copy(cached_ask_prices_.begin(), cached_ask_prices_.end(), snapshot.ask_px);
-        std::copy(cached_ask_sizes_.begin(), cached_ask_sizes_.end(), snapshot.ask_sz);
+        // The level arrays are contiguous: one copy instead of one per array.
+        std::memcpy(snapshot.bid_px, cached_top_.bid_px,
+                    sizeof(MBPSnapshot) - offsetof(MBPSnapshot, bid_px));
+    }
+    
+    // The caller pays a copy of the levels (reusing the image's buffers)
+    // and a pointer per arena chunk, not a walk of every order queue nor a
+    // copy of the arena: the image shares the book's chunks, and the book
+    // copies a chunk only when it next writes to it (OrderPool::share_with).
+    void copy_image(BookImage& image) const {
+        image.bids.clear();
+        image.asks.clear();
+        for (const auto& [price, level] : bid_levels_) image.bids.push_back(level);
+        for (const auto& [price, level] : ask_levels_) image.asks.push_back(level);
+        order_pool_.share_with(image.orders);
     }
     
     std::pair<int64_t, uint64_t> get_best_bid() const {
@@ -252,48 +468,127 @@ public:
         return {it->first, it->second.total_size};
     }
     
+    // Pulls the order's index entry and pooled Order into cache ahead of a
+    // cancel/modify. The lookahead lookup itself warms the hash bucket (or
+    // dense window slot) for the later find().
+    void prefetch_order(uint64_t order_id) const noexcept {
+        OrderIndex idx = order_map_.find(order_id);
+        if (idx != NULL_ORDER) {
+            __builtin_prefetch(&order_pool_[idx], 1, 3);
+        }
+    }
+    
+    // Starts maintaining the queue position of order_id, which need not
+    // have arrived yet. Watching an order that is already resting walks
+    // its level once; after that the position is kept up to date as the
+    // book changes.
+    void watch_order(uint64_t order_id) {
+        if (!queue_tracker_.watch(order_id)) {
+            return;
+        }
+        
+        OrderIndex idx = order_map_.find(order_id);
+        if (idx == NULL_ORDER) {
+            return;
+        }
+        const Order& order = order_pool_[idx];
+        Level* level = find_level(order.side, order.price_raw);
+        if (!level) {
+            return;
+        }
+        
+        uint64_t size_ahead = 0;
+        uint32_t orders_ahead = 0;
+        for (OrderIndex i = level->first_order; i != idx; i = order_pool_[i].next) {
+            size_ahead += order_pool_[i].size;
+            ++orders_ahead;
+        }
+        queue_tracker_.place(order_id, order, order_pool_.info(idx).queue_ticket, *level,
+                             size_ahead, orders_ahead);
+    }
+    
+    void unwatch_order(uint64_t order_id) {
+        QueuePosition last;
+        if (queue_tracker_.unwatch(order_id, last) && last.resting) {
+            if (Level* level = find_level(last.side, last.price_raw)) {
+                --level->watchers;
+            }
+        }
+    }
+    
+    // nullptr unless order_id is watched.
+    const QueuePosition* queue_position(uint64_t order_id) const {
+        return queue_tracker_.find(order_id);
+    }
+    
     uint64_t get_total_orders() const { return total_orders_processed_; }
     size_t get_active_orders() const { return order_map_.size(); }
     size_t get_price_levels() const { return bid_levels_.size() + ask_levels_.size(); }
+    size_t get_pool_high_water() const { return order_pool_.high_water(); }
+    size_t get_pool_capacity() const { return order_pool_.capacity(); }
     
 private:
     template<typename LevelMap>
-    bool add_to_side(Order* order, LevelMap& levels) {
-        auto& level = levels[order->price_raw];
+    bool add_to_side(OrderIndex idx, LevelMap& levels) {
+        int64_t price = order_pool_[idx].price_raw;
+        auto& level = levels[price];
         
         if (level.empty()) {
-            level.price_raw = order->price_raw;
+            level.price_raw = price;
             ++price_levels_created_;
         }
         
-        level.add_order(order);
+        order_pool_.info(idx).queue_ticket = next_queue_ticket_++;
+        if (!queue_tracker_.empty()) [[unlikely]] {
+            queue_tracker_.on_enqueue(order_pool_[idx], order_pool_.info(idx), level);
+        }
+        
+        level.add_order(order_pool_, idx);
         return true;
     }
     
-    char determine_side(const Order* order) const {
-        auto bid_it = bid_levels_.find(order->price_raw);
-        if (bid_it != bid_levels_.end()) {
-            for (Order* o = bid_it->second.first_order; o != nullptr; o = o->next) {
-                if (o == order) return 'B';
-            }
+    Level* find_level(char side, int64_t price) {
+        if (side == 'B') {
+            auto it = bid_levels_.find(price);
+            return it != bid_levels_.end() ? &it->second : nullptr;
         }
-        
-        return 'A';
+        auto it = ask_levels_.find(price);
+        return it != ask_levels_.end() ? &it->second : nullptr;
+    }
+    
+    // Queue tracking hooks: a branch unless the level holds a watched order.
+    void track_removal(Level& level, OrderIndex idx) {
+        if (level.watchers != 0) [[unlikely]] {
+            queue_tracker_.on_remove(order_pool_[idx], order_pool_.info(idx), level);
+        }
+    }
+    
+    void track_resize(const Level& level, OrderIndex idx, uint32_t old_size) {
+        if (level.watchers != 0) [[unlikely]] {
+            queue_tracker_.on_resize(order_pool_[idx], order_pool_.info(idx), old_size);
+        }
+    }
+    
+    char determine_side(OrderIndex idx) const {
+        return order_pool_[idx].side;
     }
     
-    void remove_order_from_level(Order* order, char side) {
+    void remove_order_from_level(OrderIndex idx, char side) {
+        int64_t price = order_pool_[idx].price_raw;
         if (side == 'B') {
-            auto level_it = bid_levels_.find(order->price_raw);
+            auto level_it = bid_levels_.find(price);
             if (level_it != bid_levels_.end()) {
-                level_it->second.remove_order(order);
+                track_removal(level_it->second, idx);
+                level_it->second.remove_order(order_pool_, idx);
                 if (level_it->second.empty()) {
                     bid_levels_.erase(level_it);
                 }
             }
         } else {
-            auto level_it = ask_levels_.find(order->price_raw);
+            auto level_it = ask_levels_.find(price);
             if (level_it != ask_levels_.end()) {
-                level_it->second.remove_order(order);
+                track_removal(level_it->second, idx);
+                level_it->second.remove_order(order_pool_, idx);
                 if (level_it->second.empty()) {
                     ask_levels_.erase(level_it);
                 }
@@ -302,21 +597,20 @@ private:
     }
     
     void update_cache() const {
-        cached_bid_prices_.fill(0);
-        cached_bid_sizes_.fill(0);
-        cached_ask_prices_.fill(0);
-        cached_ask_sizes_.fill(0);
+        cached_top_ = MBPSnapshot();
         
         size_t bid_idx = 0;
         for (auto it = bid_levels_.begin(); it != bid_levels_.end() && bid_idx < 10; ++it, ++bid_idx) {
-            cached_bid_prices_[bid_idx] = it->first;
-            cached_bid_sizes_[bid_idx] = it->second.total_size;
+            cached_top_.bid_px[bid_idx] = it->first;
+            cached_top_.bid_sz[bid_idx] = it->second.total_size;
+            cached_top_.bid_ct[bid_idx] = it->second.order_count;
         }
         
         size_t ask_idx = 0;
         for (auto it = ask_levels_.begin(); it != ask_levels_.end() && ask_idx < 10; ++it, ++ask_idx) {
-            cached_ask_prices_[ask_idx] = it->first;
-            cached_ask_sizes_[ask_idx] = it->second.total_size;
+            cached_top_.ask_px[ask_idx] = it->first;
+            cached_top_.ask_sz[ask_idx] = it->second.total_size;
+            cached_top_.ask_ct[ask_idx] = it->second.order_count;
         }
         
         cache_valid_ = true;
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "order.hpp"
+#include "incremental_map.hpp"
+#include <memory>
+#include <vector>
+#include <cstring>
+
+namespace mbp_reconstructor {
+
+enum class OrderIndexKind {
+    Hash,   // hash map for every id
+    Dense   // direct-mapped sliding window, hash fallback for outliers
+};
+
+// Maps exchange order ids to arena indices.
+//
+// Venue order ids are usually assigned near-sequentially, so in Dense mode
+// the live ids are covered by a window of fixed-size pages addressed
+// directly by (id >> PAGE_BITS); a lookup is two array loads with no
+// hashing or probing. The page directory is a power-of-two ring, so the
+// window slides forward as the oldest pages drain, or as new ids run past
+// its top, in which case long-lived stragglers on the oldest pages are
+// spilled into the hash fallback. Ids below the window and far outliers go
+// straight to the fallback.
+class OrderIdIndex {
+private:
+    static constexpr unsigned PAGE_BITS = 12;
+    static constexpr size_t   PAGE_SIZE = size_t{1} << PAGE_BITS;
+    static constexpr uint64_t PAGE_MASK = PAGE_SIZE - 1;
+    static constexpr size_t   WINDOW_PAGES = 16384;       // 64M ids of span
+    static constexpr uint64_t DIR_MASK = WINDOW_PAGES - 1;
+    static constexpr size_t   MAX_SPARE_PAGES = 64;
+    
+    struct Page {
+        OrderIndex slots[PAGE_SIZE];
+        uint32_t   live;
+        
+        Page() : live(0) {
+            std::memset(slots, 0xFF, sizeof(slots));  // NULL_ORDER
+        }
+    };
+    
+    static_assert((WINDOW_PAGES & (WINDOW_PAGES - 1)) == 0, "window must be a power of two");
+    static_assert(NULL_ORDER == UINT32_MAX, "Page() relies on an all-ones sentinel");
+    
+    OrderIndexKind kind_;
+    
+    std::vector<std::unique_ptr<Page>> dir_;
+    std::vector<std::unique_ptr<Page>> spare_pages_;
+    uint64_t base_page_;
+    size_t   live_pages_;
+    size_t   window_size_;
+    
+    IncrementalHashMap<OrderIndex> fallback_;
+    
+public:
+    explicit OrderIdIndex(OrderIndexKind kind = OrderIndexKind::Hash)
+        : kind_(kind), base_page_(0), live_pages_(0), window_size_(0) {
+        if (kind_ == OrderIndexKind::Dense) {
+            dir_.resize(WINDOW_PAGES);
+        }
+    }
+    
+    OrderIndexKind kind() const noexcept { return kind_; }
+    
+    OrderIndex find(uint64_t order_id) const noexcept {
+        if (kind_ == OrderIndexKind::Dense) {
+            uint64_t page = order_id >> PAGE_BITS;
+            if (page - base_page_ < WINDOW_PAGES) {
+                const Page* p = dir_[page & DIR_MASK].get();
+                if (p) {
+                    OrderIndex idx = p->slots[order_id & PAGE_MASK];
+                    if (idx != NULL_ORDER) return idx;
+                }
+            }
+            if (fallback_.empty()) return NULL_ORDER;
+        }
+        
+        const OrderIndex* idx = fallback_.find(order_id);
+        return idx ? *idx : NULL_ORDER;
+    }
+    
+    bool contains(uint64_t order_id) const noexcept {
+        return find(order_id) != NULL_ORDER;
+    }
+    
+    // The caller guarantees order_id is not already present.
+    void insert(uint64_t order_id, OrderIndex idx) {
+        if (kind_ == OrderIndexKind::Dense && insert_dense(order_id, idx)) {
+            return;
+        }
+        fallback_.insert(order_id, idx);
+    }
+    
+    bool erase(uint64_t order_id) {
+        if (kind_ == OrderIndexKind::Dense) {
+            uint64_t page = order_id >> PAGE_BITS;
+            if (page - base_page_ < WINDOW_PAGES) {
+                auto& p = dir_[page & DIR_MASK];
+                if (p && p->slots[order_id & PAGE_MASK] != NULL_ORDER) {
+                    p->slots[order_id & PAGE_MASK] = NULL_ORDER;
+                    --window_size_;
+                    if (--p->live == 0) {
+                        release_page(p);
+                        advance_base();
+                    }
+                    return true;
+                }
+            }
+        }
+        
+        return fallback_.erase(order_id);
+    }
+    
+    size_t size() const noexcept { return window_size_ + fallback_.size(); }
+    size_t fallback_size() const noexcept { return fallback_.size(); }
+    
+    void reserve(size_t count) {
+        if (kind_ == OrderIndexKind::Hash) {
+            fallback_.reserve(count);
+        }
+    }
+    
+    template<typename Fn>
+    void for_each(Fn&& fn) const {
+        if (kind_ == OrderIndexKind::Dense && live_pages_ > 0) {
+            for (size_t rel = 0; rel < WINDOW_PAGES; ++rel) {
+                uint64_t page = base_page_ + rel;
+                const Page* p = dir_[page & DIR_MASK].get();
+                if (!p) continue;
+                for (size_t slot = 0; slot < PAGE_SIZE; ++slot) {
+                    if (p->slots[slot] != NULL_ORDER) {
+                        fn((page << PAGE_BITS) | slot, p->slots[slot]);
+                    }
+                }
+            }
+        }
+        fallback_.for_each(fn);
+    }
+    
+    void clear() {
+        if (kind_ == OrderIndexKind::Dense) {
+            for (auto& p : dir_) {
+                if (p) release_page(p);
+            }
+            window_size_ = 0;
+        }
+        fallback_.clear();
+    }
+    
+private:
+    bool insert_dense(uint64_t order_id, OrderIndex idx) {
+        uint64_t page = order_id >> PAGE_BITS;
+        
+        if (live_pages_ == 0) {
+            base_page_ = page;
+        } else if (page - base_page_ >= WINDOW_PAGES) {
+            if (page < base_page_ || page - base_page_ >= 2 * WINDOW_PAGES) {
+                return false;
+            }
+            slide_to(page - (WINDOW_PAGES - 1));
+        }
+        
+        auto& p = dir_[page & DIR_MASK];
+        if (!p) {
+            acquire_page(p);
+        }
+        
+        p->slots[order_id & PAGE_MASK] = idx;
+        ++p->live;
+        ++window_size_;
+        return true;
+    }
+    
+    void acquire_page(std::unique_ptr<Page>& p) {
+        if (!spare_pages_.empty()) {
+            p = std::move(spare_pages_.back());
+            spare_pages_.pop_back();
+        } else {
+            p = std::make_unique<Page>();
+        }
+        ++live_pages_;
+    }
+    
+    // Pages are only released once all their slots are back to NULL_ORDER
+    // (or on clear, which wipes the ones kept as spares), so spares can be
+    // reused as-is.
+    void release_page(std::unique_ptr<Page>& p) {
+        if (spare_pages_.size() < MAX_SPARE_PAGES) {
+            if (p->live != 0) {
+                std::memset(p->slots, 0xFF, sizeof(p->slots));
+                p->live = 0;
+            }
+            spare_pages_.push_back(std::move(p));
+        } else {
+            p.reset();
+        }
+        --live_pages_;
+    }
+    
+    // Move the window base up to new_base, spilling whatever is still live
+    // on the pages that fall out of it into the fallback.
+    void slide_to(uint64_t new_base) {
+        while (base_page_ < new_base && live_pages_ > 0) {
+            auto& p = dir_[base_page_ & DIR_MASK];
+            if (p) {
+                for (size_t slot = 0; slot < PAGE_SIZE; ++slot) {
+                    if (p->slots[slot] != NULL_ORDER) {
+                        fallback_.insert((base_page_ << PAGE_BITS) | slot, p->slots[slot]);
+                    }
+                }
+                window_size_ -= p->live;
+                release_page(p);
+            }
+            ++base_page_;
+        }
+        base_page_ = new_base;
+    }
+    
+    // Slide the window forward over drained pages so the base page is
+    // always live, letting newer ids claim the freed ring slots.
+    void advance_base() {
+        if (live_pages_ == 0) return;
+        while (!dir_[base_page_ & DIR_MASK]) {
+            ++base_page_;
+        }
+    }
+};
+
+} // namespace mbp_reconstructor
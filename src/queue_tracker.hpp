@@ -0,0 +1,128 @@
+#pragma once
+
+#include "order.hpp"
+#include <cstdint>
+#include <unordered_map>
+
+namespace mbp_reconstructor {
+
+// Where a watched order stands in its level's queue.
+struct QueuePosition {
+    bool     resting = false;     // false until the order is added, and once it is gone
+    char     side = 'N';
+    int64_t  price_raw = 0;
+    uint32_t size = 0;
+    uint64_t size_ahead = 0;      // resting size queued in front of the order
+    uint32_t orders_ahead = 0;
+};
+
+// Keeps QueuePosition up to date for a set of watched order ids.
+//
+// Positions are adjusted as the book changes instead of being found by
+// walking a level's queue: an order leaving or resizing at a level moves
+// the watched orders queued behind it, and queue tickets (OrderInfo) tell
+// which those are. OrderBook only calls in for levels whose watchers count
+// is non-zero, plus one lookup per enqueue while anything is watched, so
+// unwatched levels pay a single branch. The watch set is expected to be
+// small; each call scans it.
+class QueueTracker {
+private:
+    struct Watch {
+        QueuePosition position;
+        uint32_t ticket = 0;
+    };
+    
+    std::unordered_map<uint64_t, Watch> watches_;
+    
+public:
+    bool empty() const noexcept { return watches_.empty(); }
+    size_t size() const noexcept { return watches_.size(); }
+    
+    // Returns false if order_id was already watched.
+    bool watch(uint64_t order_id) {
+        return watches_.try_emplace(order_id).second;
+    }
+    
+    // Stops watching; returns the position it had so the caller can
+    // release its level.
+    bool unwatch(uint64_t order_id, QueuePosition& last) {
+        auto it = watches_.find(order_id);
+        if (it == watches_.end()) return false;
+        last = it->second.position;
+        watches_.erase(it);
+        return true;
+    }
+    
+    const QueuePosition* find(uint64_t order_id) const {
+        auto it = watches_.find(order_id);
+        return it == watches_.end() ? nullptr : &it->second.position;
+    }
+    
+    // Starts tracking a watched order found resting, with its position
+    // counted by the caller.
+    void place(uint64_t order_id, const Order& order, uint32_t ticket, Level& level,
+               uint64_t size_ahead, uint32_t orders_ahead) {
+        Watch& watch = watches_[order_id];
+        watch.position = QueuePosition{true, order.side, order.price_raw, order.size,
+                                       size_ahead, orders_ahead};
+        watch.ticket = ticket;
+        ++level.watchers;
+    }
+    
+    // The order is about to join the back of level.
+    void on_enqueue(const Order& order, const OrderInfo& info, Level& level) {
+        auto it = watches_.find(info.order_id);
+        if (it == watches_.end()) return;
+        
+        Watch& watch = it->second;
+        watch.position = QueuePosition{true, order.side, order.price_raw, order.size,
+                                       level.total_size, level.order_count};
+        watch.ticket = info.queue_ticket;
+        ++level.watchers;
+    }
+    
+    // The order is about to leave level (cancel, full fill, price change).
+    void on_remove(const Order& order, const OrderInfo& info, Level& level) {
+        for (auto& [order_id, watch] : watches_) {
+            QueuePosition& position = watch.position;
+            if (!at_level(position, order)) continue;
+            
+            if (order_id == info.order_id) {
+                position.resting = false;
+                --level.watchers;
+            } else if (queue_ticket_before(info.queue_ticket, watch.ticket)) {
+                position.size_ahead -= order.size;
+                --position.orders_ahead;
+            }
+        }
+    }
+    
+    // The order's size changed in place (same-price modify, partial fill);
+    // order.size is already the new size.
+    void on_resize(const Order& order, const OrderInfo& info, uint32_t old_size) {
+        for (auto& [order_id, watch] : watches_) {
+            QueuePosition& position = watch.position;
+            if (!at_level(position, order)) continue;
+            
+            if (order_id == info.order_id) {
+                position.size = order.size;
+            } else if (queue_ticket_before(info.queue_ticket, watch.ticket)) {
+                position.size_ahead = position.size_ahead - old_size + order.size;
+            }
+        }
+    }
+    
+    // The book was cleared; its levels, and their watcher counts, are gone.
+    void on_clear() {
+        for (auto& [order_id, watch] : watches_) {
+            watch.position.resting = false;
+        }
+    }
+    
+private:
+    static bool at_level(const QueuePosition& position, const Order& order) noexcept {
+        return position.resting && position.price_raw == order.price_raw && position.side == order.side;
+    }
+};
+
+} // namespace mbp_reconstructor
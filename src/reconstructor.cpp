@@ -0,0 +1,112 @@
+#include "reconstructor.hpp"
+#include <algorithm>
+
+namespace mbp_reconstructor {
+
+BookReconstructor::BookReconstructor(BookListener& listener, OrderIndexKind order_index,
+                                     size_t prefetch_distance)
+    : listener_(listener), order_book_(order_index), action_engine_(order_book_),
+      prefetch_distance_(prefetch_distance), next_checkpoint_(NO_CHECKPOINT),
+      conflate_(false), change_pending_(false), pending_timestamp_(0),
+      sample_interval_(0), next_sample_(NO_CHECKPOINT),
+      events_processed_(0), book_updates_(0), records_conflated_(0),
+      lookups_(EventBlock::CAPACITY) {}
+
+void BookReconstructor::on_event(const Event& event) {
+    apply(event);
+}
+
+void BookReconstructor::finish() {
+    if (sample_interval_ != 0) {
+        if (events_processed_ > 0) {
+            take_sample(next_sample_);
+            next_sample_ += sample_interval_;
+        }
+    } else if (change_pending_) {
+        report_book_change();
+    }
+}
+
+void BookReconstructor::on_events(const Event* events, size_t count) {
+    // Warm the order lookups for the first K events, then keep the
+    // prefetch stream K events ahead of the apply loop.
+    size_t lead = std::min(prefetch_distance_, count);
+    for (size_t i = 0; i < lead; ++i) {
+        action_engine_.prefetch_event(events[i]);
+    }
+    
+    for (size_t i = 0; i < count; ++i) {
+        if (i + lead < count) {
+            action_engine_.prefetch_event(events[i + lead]);
+        }
+        apply(events[i]);
+    }
+}
+
+void BookReconstructor::on_events(const EventBlock& block) {
+    static_assert(EventBlock::CAPACITY <= UINT16_MAX + 1, "rows are stored as uint16_t");
+    
+    // Classify 64 rows at a time into a bit mask (rows past count are
+    // initialized, so the inner loop has a fixed trip count and
+    // vectorizes), then expand the set bits into the rows to look up.
+    size_t lookups = 0;
+    for (size_t group = 0; group < block.count; group += 64) {
+        uint64_t mask = 0;
+        for (size_t j = 0; j < 64; ++j) {
+            mask |= static_cast<uint64_t>(ActionEngine::looks_up_order(
+                block.actions[group + j], block.sides[group + j])) << j;
+        }
+        if (block.count - group < 64) {
+            mask &= (uint64_t{1} << (block.count - group)) - 1;
+        }
+        while (mask) {
+            lookups_[lookups++] = static_cast<uint16_t>(group + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+    
+    size_t ahead = std::min(prefetch_distance_, lookups);
+    for (size_t k = 0; k < ahead; ++k) {
+        action_engine_.prefetch_order(block.order_ids[lookups_[k]]);
+    }
+    
+    size_t next_lookup = 0;
+    for (size_t i = 0; i < block.count; ++i) {
+        if (next_lookup < lookups && lookups_[next_lookup] == i) {
+            ++next_lookup;
+            if (ahead < lookups) {
+                action_engine_.prefetch_order(block.order_ids[lookups_[ahead++]]);
+            }
+        }
+        apply(block[i]);
+    }
+}
+
+void BookReconstructor::reach_checkpoints(uint64_t next_event_ts) {
+    // Several checkpoints may fall in the gap before this event.
+    while (next_event_ts > next_checkpoint_) {
+        next_checkpoint_ = listener_.on_checkpoint(next_checkpoint_, order_book_, next_event_ts);
+    }
+}
+
+void BookReconstructor::reach_samples(uint64_t next_event_ts) {
+    if (events_processed_ == 0) {
+        // The grid starts at the first boundary at or after the first event.
+        next_sample_ = (next_event_ts + sample_interval_ - 1) / sample_interval_ * sample_interval_;
+        return;
+    }
+    
+    // Quiet stretches still get a sample per boundary.
+    while (next_event_ts > next_sample_) {
+        take_sample(next_sample_);
+        next_sample_ += sample_interval_;
+    }
+}
+
+void BookReconstructor::take_sample(uint64_t boundary) {
+    ++book_updates_;
+    uint32_t changed = snapshots_.sample(order_book_, boundary);
+    listener_.on_book_change(snapshots_.get_current_snapshot(), changed);
+}
+
+} // namespace mbp_reconstructor
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "order.hpp"
+#include "order_book.hpp"
+#include "action_engine.hpp"
+#include "snapshot.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mbp_reconstructor {
+
+constexpr uint64_t NO_CHECKPOINT = UINT64_MAX;
+
+// Receives results from a BookReconstructor. Both callbacks run on the
+// thread that pushes events, synchronously, and hand out references to the
+// reconstructor's own state, valid until the next event is pushed: copy
+// what has to outlive the call.
+class BookListener {
+public:
+    virtual ~BookListener() = default;
+    
+    // The top 10 changed. changed_mask has a bit per level whose price or
+    // size differs from the previous snapshot (bid_level_bit(i) /
+    // ask_level_bit(i)); the first snapshot reports every level. In
+    // sampling mode this is called at every sample boundary instead, with
+    // a 0 mask when nothing changed since the last sample.
+    virtual void on_book_change(const MBPSnapshot& /*snapshot*/, uint32_t /*changed_mask*/) {}
+    
+    // A T+F+C sequence was executed against the book. Delivered before the
+    // book change it causes.
+    virtual void on_trade(const TradeInfo& /*trade*/) {}
+    
+    // The book as of time (every event stamped at or before it applied),
+    // delivered when the first later event, stamped next_event_ts, arrives
+    // and before it is applied. Returns the next checkpoint time, which
+    // must be later than time, or NO_CHECKPOINT. See BookReconstructor::set_checkpoint().
+    virtual uint64_t on_checkpoint(uint64_t /*time*/, const OrderBook& /*book*/,
+                                   uint64_t /*next_event_ts*/) {
+        return NO_CHECKPOINT;
+    }
+};
+
+// Push-style order book reconstruction: feed MBO events in with on_event()
+// or on_events() and get MBP-10 changes and trades back through a
+// BookListener. Nothing on this path formats text or does I/O; main.cpp is
+// one listener, which renders the snapshots as CSV rows.
+class BookReconstructor {
+public:
+    static constexpr size_t DEFAULT_PREFETCH_DISTANCE = 8;
+    
+private:
+    BookListener& listener_;
+    OrderBook order_book_;
+    ActionEngine action_engine_;
+    SnapshotManager snapshots_;
+    size_t prefetch_distance_;
+    uint64_t next_checkpoint_;
+    bool conflate_;
+    bool change_pending_;         // the event in progress has changed the book
+    uint64_t pending_timestamp_;
+    uint64_t sample_interval_;    // 0: report every change
+    uint64_t next_sample_;
+    
+    uint64_t events_processed_;
+    uint64_t book_updates_;
+    uint64_t records_conflated_;
+    
+    std::vector<uint16_t> lookups_;     // rows of the block being applied
+    
+public:
+    explicit BookReconstructor(BookListener& listener,
+                               OrderIndexKind order_index = OrderIndexKind::Hash,
+                               size_t prefetch_distance = DEFAULT_PREFETCH_DISTANCE);
+    
+    BookReconstructor(const BookReconstructor&) = delete;
+    BookReconstructor& operator=(const BookReconstructor&) = delete;
+    
+    void on_event(const Event& event);
+    
+    // Applies a block of events, keeping the order lookups
+    // prefetch_distance events ahead of the apply loop.
+    void on_events(const Event* events, size_t count);
+    
+    // The same for a column-wise block: one pass over its action and side
+    // columns finds the records that look up an order, and those are
+    // prefetched prefetch_distance lookups ahead, skipping the adds,
+    // trades and fills in between.
+    void on_events(const EventBlock& block);
+    
+    // Arms a checkpoint: on_checkpoint() is called with the book as of
+    // time, then re-armed with whatever it returns.
+    void set_checkpoint(uint64_t time) noexcept { next_checkpoint_ = time; }
+    
+    // Compares the top 10 only after the record flagged F_LAST, so an
+    // exchange event spread over several records yields at most one book
+    // change, stamped with its last record. Without it every record is its
+    // own event. Call finish() at the end of the input.
+    void conflate_events(bool enabled) noexcept { conflate_ = enabled; }
+    
+    // Samples the book on a fixed time grid instead of reporting each
+    // change: on_book_change() gets the top 10 as of every multiple of
+    // interval_ns from the first event on (events stamped at or before the
+    // boundary applied), and the book is not read in between. finish()
+    // takes the sample at the boundary after the last event. Call before
+    // the first event.
+    void sample_every(uint64_t interval_ns) noexcept {
+        sample_interval_ = interval_ns;
+        next_sample_ = interval_ns > 0 ? 0 : NO_CHECKPOINT;
+    }
+    
+    // Reports the change from an event whose last record never arrived,
+    // or in sampling mode the final sample.
+    void finish();
+    
+    // Maintains mid, microprice, spread and top-depth imbalance alongside
+    // the snapshots; read them with snapshot_manager().derived_fields()
+    // from on_book_change(). Call before the first event.
+    void enable_derived_fields(int depth) { snapshots_.enable_derived_fields(depth); }
+    
+    // Reports a change in a level's order count alone as a book change
+    // (see SnapshotManager::compare_order_counts).
+    void compare_order_counts(bool enabled) noexcept { snapshots_.compare_order_counts(enabled); }
+    
+    // Queue positions of chosen orders, kept up to date as events apply
+    // (see OrderBook::watch_order).
+    void watch_order(uint64_t order_id) { order_book_.watch_order(order_id); }
+    void unwatch_order(uint64_t order_id) { order_book_.unwatch_order(order_id); }
+    const QueuePosition* queue_position(uint64_t order_id) const {
+        return order_book_.queue_position(order_id);
+    }
+    
+    const OrderBook& book() const noexcept { return order_book_; }
+    const ActionEngine& action_engine() const noexcept { return action_engine_; }
+    const SnapshotManager& snapshot_manager() const noexcept { return snapshots_; }
+    
+    uint64_t events_processed() const noexcept { return events_processed_; }
+    // Events that touched the book and had their top 10 compared.
+    uint64_t book_updates() const noexcept { return book_updates_; }
+    // Book-changing records folded into a later record's comparison.
+    uint64_t records_conflated() const noexcept { return records_conflated_; }
+    
+private:
+    void apply(const Event& event) {
+        if (event.timestamp_ns > next_checkpoint_) [[unlikely]] {
+            reach_checkpoints(event.timestamp_ns);
+        }
+        if (event.timestamp_ns > next_sample_) [[unlikely]] {
+            reach_samples(event.timestamp_ns);
+        }
+        
+        ++events_processed_;
+        
+        bool book_changed = action_engine_.process_event(event);
+        
+        if (const TradeInfo* trade = action_engine_.executed_trade()) {
+            listener_.on_trade(*trade);
+        }
+        
+        if (sample_interval_ != 0) return;
+        
+        if (book_changed) {
+            if (change_pending_) ++records_conflated_;
+            change_pending_ = true;
+        }
+        
+        // Stamp with the latest record, so a conflated event carries the
+        // time of the record that closes it even if that one is a no-op.
+        if (change_pending_) {
+            pending_timestamp_ = event.timestamp_ns;
+            if (!conflate_ || event.is_last_in_event()) report_book_change();
+        }
+    }
+    
+    void report_book_change() {
+        change_pending_ = false;
+        ++book_updates_;
+        uint32_t changed = snapshots_.update(order_book_, pending_timestamp_);
+        if (changed != 0) {
+            listener_.on_book_change(snapshots_.get_current_snapshot(), changed);
+        }
+    }
+    
+    void reach_checkpoints(uint64_t next_event_ts);
+    void reach_samples(uint64_t next_event_ts);
+    void take_sample(uint64_t boundary);
+};
+
+} // namespace mbp_reconstructor
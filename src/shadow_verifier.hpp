@@ -0,0 +1,450 @@
+#pragma once
+
+#include "order.hpp"
+#include "order_book.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mbp_reconstructor {
+
+// A second, independent model of the book for verification: std::map
+// levels of std::list queues and a plain unordered_map of order ids, no
+// arena, index or cached top. Slow and plainly correct, where OrderBook is
+// fast. apply() follows ActionEngine's rules, T+F+C aggregation included.
+class ReferenceBook {
+private:
+    struct RestingOrder {
+        uint64_t order_id;
+        uint32_t size;
+    };
+    using Queue = std::list<RestingOrder>;
+    
+    struct Location {
+        char side;
+        int64_t price_raw;
+        Queue::iterator it;
+    };
+    
+    std::map<int64_t, Queue, std::greater<int64_t>> bids_;
+    std::map<int64_t, Queue> asks_;
+    std::unordered_map<uint64_t, Location> orders_;
+    
+    enum class TradeStep { None, Trade, Fill };
+    TradeStep trade_step_ = TradeStep::None;
+    uint64_t trade_id_ = 0;
+    int64_t trade_price_raw_ = 0;
+    uint32_t trade_size_ = 0;
+    char trade_side_ = 'N';
+    bool first_clear_seen_ = false;
+    
+public:
+    void apply(const Event& event) {
+        switch (event.action) {
+            case 'A':
+                if ((event.side == 'B' || event.side == 'A') && !orders_.count(event.order_id)) {
+                    enqueue(event.order_id, event.side, event.price_raw, event.size);
+                }
+                break;
+            case 'M': {
+                auto it = orders_.find(event.order_id);
+                if (event.side == 'N' || it == orders_.end()) break;
+                Location& location = it->second;
+                if (location.price_raw == event.price_raw) {
+                    location.it->size = event.size;     // keeps its place
+                } else {
+                    char side = location.side;
+                    remove(it);
+                    enqueue(event.order_id, side, event.price_raw, event.size);
+                }
+                break;
+            }
+            case 'C':
+                if (trade_step_ == TradeStep::Fill) {
+                    execute();
+                    trade_step_ = TradeStep::None;
+                } else if (auto it = orders_.find(event.order_id); it != orders_.end()) {
+                    remove(it);
+                }
+                break;
+            case 'T':
+                trade_step_ = TradeStep::Trade;
+                trade_id_ = event.order_id;
+                trade_price_raw_ = event.price_raw;
+                trade_size_ = event.size;
+                trade_side_ = event.side;
+                break;
+            case 'F':
+                // A stray F leaves the sequence as it was.
+                if (trade_step_ == TradeStep::Trade) {
+                    trade_step_ = event.order_id == trade_id_ ? TradeStep::Fill : TradeStep::None;
+                }
+                break;
+            case 'R':
+                if (first_clear_seen_) {
+                    bids_.clear();
+                    asks_.clear();
+                    orders_.clear();
+                    trade_step_ = TradeStep::None;
+                }
+                first_clear_seen_ = true;
+                break;
+            default:
+                break;
+        }
+    }
+    
+    void top10(MBPSnapshot& snapshot) const {
+        fill_side(bids_, snapshot.bid_px, snapshot.bid_sz, snapshot.bid_ct);
+        fill_side(asks_, snapshot.ask_px, snapshot.ask_sz, snapshot.ask_ct);
+    }
+    
+    bool crossed() const {
+        return !bids_.empty() && !asks_.empty() && bids_.begin()->first >= asks_.begin()->first;
+    }
+    
+    size_t orders() const noexcept { return orders_.size(); }
+    
+    // Checks a copy of the production book against this one, level by
+    // level and order by order, and the copy's own bookkeeping (each
+    // level's total size and order count against its queue). Returns the
+    // first difference, or an empty string.
+    std::string compare(const BookImage& image) const {
+        std::string difference = compare_side(image, image.bids, bids_, "bid");
+        if (difference.empty()) {
+            difference = compare_side(image, image.asks, asks_, "ask");
+        }
+        return difference;
+    }
+    
+private:
+    void enqueue(uint64_t order_id, char side, int64_t price_raw, uint32_t size) {
+        Queue& queue = side == 'B' ? bids_[price_raw] : asks_[price_raw];
+        queue.push_back({order_id, size});
+        orders_[order_id] = Location{side, price_raw, std::prev(queue.end())};
+    }
+    
+    void remove(std::unordered_map<uint64_t, Location>::iterator it) {
+        const Location& location = it->second;
+        if (location.side == 'B') {
+            erase_from(bids_, location);
+        } else {
+            erase_from(asks_, location);
+        }
+        orders_.erase(it);
+    }
+    
+    template<typename Levels>
+    static void erase_from(Levels& levels, const Location& location) {
+        auto level = levels.find(location.price_raw);
+        level->second.erase(location.it);
+        if (level->second.empty()) {
+            levels.erase(level);
+        }
+    }
+    
+    // Fills the front of the passive side's queue at the trade price.
+    void execute() {
+        if (trade_side_ == 'B') {
+            fill(asks_);
+        } else {
+            fill(bids_);
+        }
+    }
+    
+    template<typename Levels>
+    void fill(Levels& levels) {
+        auto level = levels.find(trade_price_raw_);
+        if (level == levels.end()) return;
+        Queue& queue = level->second;
+        uint32_t remaining = trade_size_;
+        while (remaining > 0 && !queue.empty()) {
+            RestingOrder& order = queue.front();
+            if (order.size <= remaining) {
+                remaining -= order.size;
+                orders_.erase(order.order_id);
+                queue.pop_front();
+            } else {
+                order.size -= remaining;
+                remaining = 0;
+            }
+        }
+        if (queue.empty()) {
+            levels.erase(level);
+        }
+    }
+    
+    template<typename Levels>
+    static void fill_side(const Levels& levels, int64_t* px, uint64_t* sz, uint32_t* ct) {
+        int i = 0;
+        for (auto level = levels.begin(); level != levels.end() && i < 10; ++level, ++i) {
+            px[i] = level->first;
+            sz[i] = 0;
+            for (const RestingOrder& order : level->second) {
+                sz[i] += order.size;
+            }
+            ct[i] = static_cast<uint32_t>(level->second.size());
+        }
+        for (; i < 10; ++i) {
+            px[i] = 0;
+            sz[i] = 0;
+            ct[i] = 0;
+        }
+    }
+    
+    template<typename Levels>
+    static std::string compare_side(const BookImage& image, const std::vector<Level>& production,
+                                    const Levels& reference, const char* side) {
+        if (production.size() != reference.size()) {
+            return std::string(side) + " levels: " + std::to_string(production.size()) +
+                   " in the book, " + std::to_string(reference.size()) + " in the reference";
+        }
+        auto expected = reference.begin();
+        for (const Level& level : production) {
+            std::string where = std::string(side) + " level " + std::to_string(level.price_raw);
+            if (level.price_raw != expected->first) {
+                return where + ": the reference has " + std::to_string(expected->first) + " here";
+            }
+            
+            uint64_t total = 0;
+            uint32_t count = 0;
+            auto order = expected->second.begin();
+            for (OrderIndex idx = level.first_order; idx != NULL_ORDER; idx = image.orders[idx].next) {
+                const Order& resting = image.orders[idx];
+                uint64_t order_id = image.orders.info(idx).order_id;
+                if (order == expected->second.end()) {
+                    return where + ": order " + std::to_string(order_id) + " is not in the reference";
+                }
+                if (order_id != order->order_id || resting.size != order->size) {
+                    return where + ", queue position " + std::to_string(count) + ": order " +
+                           std::to_string(order_id) + " size " + std::to_string(resting.size) +
+                           ", the reference has " + std::to_string(order->order_id) + " size " +
+                           std::to_string(order->size);
+                }
+                if (resting.price_raw != level.price_raw) {
+                    return where + ": order " + std::to_string(order_id) + " has price " +
+                           std::to_string(resting.price_raw);
+                }
+                total += resting.size;
+                ++count;
+                ++order;
+            }
+            if (order != expected->second.end()) {
+                return where + ": " + std::to_string(count) + " orders queued, the reference has " +
+                       std::to_string(expected->second.size());
+            }
+            if (total != level.total_size || count != level.order_count) {
+                return where + ": total size " + std::to_string(level.total_size) + " and count " +
+                       std::to_string(level.order_count) + ", its queue holds " +
+                       std::to_string(total) + " in " + std::to_string(count);
+            }
+            ++expected;
+        }
+        return {};
+    }
+};
+
+// Verifies a replay from a thread of its own. After each block of events
+// the caller submits the block and the book it produced; the verifier
+// applies the block to a ReferenceBook and compares the top 10, checks
+// that the book is not crossed, and every image_every blocks compares the
+// whole book (levels, FIFO queues, size and count bookkeeping) through a
+// BookImage copy. The caller pays an event copy per block plus the
+// occasional image, and waits only when max_queued blocks are already
+// waiting, which stall_seconds() reports.
+class ShadowVerifier {
+public:
+    static constexpr size_t DEFAULT_IMAGE_EVERY = 64;
+    static constexpr size_t MAX_REPORTED = 10;      // differences logged to stderr
+    
+    struct Report {
+        uint64_t blocks = 0;
+        uint64_t events = 0;
+        uint64_t images = 0;
+        uint64_t top_mismatches = 0;
+        uint64_t book_mismatches = 0;
+        uint64_t crossed = 0;                       // blocks that left the book crossed
+        
+        bool passed() const noexcept { return top_mismatches == 0 && book_mismatches == 0 && crossed == 0; }
+    };
+    
+private:
+    struct Block {
+        std::vector<Event> events;
+        MBPSnapshot top;                            // the book's, after the events
+        bool has_image = false;
+        BookImage image;
+    };
+    
+    size_t image_every_;
+    size_t submitted_;
+    
+    std::mutex mutex_;
+    std::condition_variable block_ready_;
+    std::condition_variable block_done_;
+    std::vector<std::unique_ptr<Block>> free_;
+    std::deque<std::unique_ptr<Block>> queued_;
+    bool closing_;
+    
+    std::thread thread_;
+    bool finished_;
+    uint64_t stall_ns_;
+    
+    // Verifier thread only, until finish().
+    ReferenceBook reference_;
+    Report report_;
+    
+public:
+    explicit ShadowVerifier(size_t image_every = DEFAULT_IMAGE_EVERY, size_t max_queued = 8)
+        : image_every_(image_every), submitted_(0), closing_(false), finished_(false),
+          stall_ns_(0) {
+        for (size_t i = 0; i < std::max<size_t>(max_queued, 1); ++i) {
+            free_.push_back(std::make_unique<Block>());
+        }
+        thread_ = std::thread([this] { verify_blocks(); });
+    }
+    
+    ~ShadowVerifier() { finish(); }
+    
+    ShadowVerifier(const ShadowVerifier&) = delete;
+    ShadowVerifier& operator=(const ShadowVerifier&) = delete;
+    
+    // events have just been applied to book, following every block
+    // submitted before.
+    void submit(const Event* events, size_t count, const OrderBook& book) {
+        std::unique_ptr<Block> block = take_free_block();
+        block->events.assign(events, events + count);
+        queue(std::move(block), book);
+    }
+    
+    void submit(const EventBlock& events, const OrderBook& book) {
+        std::unique_ptr<Block> block = take_free_block();
+        block->events.clear();
+        for (size_t i = 0; i < events.count; ++i) {
+            block->events.push_back(events[i]);
+        }
+        queue(std::move(block), book);
+    }
+    
+    // Verifies what is queued and stops the thread; report() is final
+    // after this.
+    void finish() {
+        if (finished_) return;
+        finished_ = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        block_ready_.notify_one();
+        thread_.join();
+    }
+    
+    const Report& report() const noexcept { return report_; }
+    double stall_seconds() const noexcept { return stall_ns_ / 1e9; }
+    
+private:
+    std::unique_ptr<Block> take_free_block() {
+        std::unique_ptr<Block> block;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (free_.empty()) {
+                auto start = std::chrono::steady_clock::now();
+                block_done_.wait(lock, [this] { return !free_.empty(); });
+                stall_ns_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+            }
+            block = std::move(free_.back());
+            free_.pop_back();
+        }
+        return block;
+    }
+    
+    // Adds the book's side of a block whose events are filled in.
+    void queue(std::unique_ptr<Block> block, const OrderBook& book) {
+        book.get_top10_snapshot(block->top);
+        block->has_image = image_every_ > 0 && ++submitted_ % image_every_ == 0;
+        if (block->has_image) {
+            book.copy_image(block->image);
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_.push_back(std::move(block));
+        }
+        block_ready_.notify_one();
+    }
+    
+    void verify_blocks() {
+        for (;;) {
+            std::unique_ptr<Block> block;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                block_ready_.wait(lock, [this] { return !queued_.empty() || closing_; });
+                if (queued_.empty()) return;
+                block = std::move(queued_.front());
+                queued_.pop_front();
+            }
+            
+            verify(*block);
+            block->image.orders.release();
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(std::move(block));
+            }
+            block_done_.notify_one();
+        }
+    }
+    
+    void verify(const Block& block) {
+        for (const Event& event : block.events) {
+            reference_.apply(event);
+        }
+        ++report_.blocks;
+        report_.events += block.events.size();
+        uint64_t ts = block.events.empty() ? 0 : block.events.back().timestamp_ns;
+        
+        MBPSnapshot expected;
+        reference_.top10(expected);
+        expected.timestamp_ns = block.top.timestamp_ns;
+        if (expected.differs_from(block.top, true)) {
+            ++report_.top_mismatches;
+            log(ts, "top 10 differs from the reference book");
+        }
+        if (reference_.crossed()) {
+            ++report_.crossed;
+            log(ts, "book is crossed");
+        }
+        if (block.has_image) {
+            ++report_.images;
+            std::string difference = reference_.compare(block.image);
+            if (!difference.empty()) {
+                ++report_.book_mismatches;
+                log(ts, difference);
+            }
+        }
+    }
+    
+    void log(uint64_t ts, const std::string& what) {
+        uint64_t problems = report_.top_mismatches + report_.book_mismatches + report_.crossed;
+        if (problems <= MAX_REPORTED) {
+            std::fprintf(stderr, "Shadow verification, block ending at %llu: %s\n",
+                         (unsigned long long)ts, what.c_str());
+        }
+    }
+};
+
+} // namespace mbp_reconstructor
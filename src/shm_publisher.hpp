@@ -0,0 +1,258 @@
+#pragma once
+
+#include "order.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace mbp_reconstructor {
+
+// Shared-memory MBP-10 feed: one publisher, any number of local readers.
+//
+// The segment is a header followed by a power-of-two ring of slots. Each
+// slot is a seqlock: the publisher stamps it odd while copying a snapshot
+// in and 2 * (n + 1) once snapshot n is complete, so a reader knows from
+// the stamp alone whether the slot holds the snapshot it wants, one not
+// yet written, or one that has already lapped it. Neither side makes a
+// syscall or takes a lock after setup, and readers never write to the
+// segment, so they can't slow the publisher down.
+namespace shm {
+
+constexpr uint64_t MAGIC = 0x4D42503130534D31ULL;   // "MBP10SM1"
+constexpr uint32_t VERSION = 2;           // 2: per-level order counts
+constexpr size_t   DEFAULT_CAPACITY = 4096;
+
+constexpr size_t SNAPSHOT_WORDS = sizeof(MBPSnapshot) / sizeof(uint64_t);
+static_assert(sizeof(MBPSnapshot) % sizeof(uint64_t) == 0, "snapshot is copied as words");
+
+struct alignas(64) Header {
+    uint64_t magic;           // written last, once the segment is ready
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t capacity;
+    alignas(64) uint64_t published;   // snapshots published so far
+};
+
+struct alignas(64) Slot {
+    uint64_t    sequence;
+    MBPSnapshot snapshot;
+};
+
+inline size_t segment_size(size_t capacity) {
+    return sizeof(Header) + capacity * sizeof(Slot);
+}
+
+// The payload is copied word by word with relaxed atomics, so a torn read
+// racing the publisher is caught by the stamp check instead of being a
+// data race.
+inline void store_words(uint64_t* dst, const uint64_t* src) noexcept {
+    for (size_t i = 0; i < SNAPSHOT_WORDS; ++i) {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+}
+
+inline void load_words(uint64_t* dst, const uint64_t* src) noexcept {
+    for (size_t i = 0; i < SNAPSHOT_WORDS; ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+} // namespace shm
+
+class ShmPublisher {
+private:
+    std::string name_;
+    void* map_;
+    size_t map_size_;
+    shm::Header* header_;
+    shm::Slot* slots_;
+    uint64_t mask_;
+    uint64_t published_;
+    
+public:
+    // Creates the POSIX shared-memory object `name`, e.g. "/mbp10",
+    // replacing any left by an earlier publisher. capacity is rounded up
+    // to a power of two.
+    explicit ShmPublisher(const char* name, size_t capacity = shm::DEFAULT_CAPACITY)
+        : name_(name), map_(MAP_FAILED), map_size_(0), header_(nullptr), slots_(nullptr),
+          mask_(0), published_(0) {
+        size_t slots = 1;
+        while (slots < capacity) slots <<= 1;
+        mask_ = slots - 1;
+        map_size_ = shm::segment_size(slots);
+        
+        // A segment left by an earlier run is unlinked rather than reused:
+        // truncating it would SIGBUS readers still mapping it, while an
+        // unlinked one stays valid for them (it just stops advancing) and
+        // the new object starts zeroed.
+        shm_unlink(name);
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to create shared memory " + name_);
+        }
+        if (ftruncate(fd, static_cast<off_t>(map_size_)) == -1) {
+            close(fd);
+            throw std::runtime_error("Failed to size shared memory " + name_);
+        }
+        map_ = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        close(fd);
+        if (map_ == MAP_FAILED) {
+            throw std::runtime_error("Failed to map shared memory " + name_);
+        }
+        
+        header_ = static_cast<shm::Header*>(map_);
+        slots_ = reinterpret_cast<shm::Slot*>(static_cast<char*>(map_) + sizeof(shm::Header));
+        header_->version = shm::VERSION;
+        header_->slot_size = sizeof(shm::Slot);
+        header_->capacity = slots;
+        __atomic_store_n(&header_->magic, shm::MAGIC, __ATOMIC_RELEASE);
+    }
+    
+    ~ShmPublisher() {
+        if (map_ != MAP_FAILED) {
+            munmap(map_, map_size_);
+            shm_unlink(name_.c_str());
+        }
+    }
+    
+    ShmPublisher(const ShmPublisher&) = delete;
+    ShmPublisher& operator=(const ShmPublisher&) = delete;
+    
+    void publish(const MBPSnapshot& snapshot) noexcept {
+        uint64_t n = published_;
+        shm::Slot& slot = slots_[n & mask_];
+        
+        __atomic_store_n(&slot.sequence, 2 * n + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        shm::store_words(reinterpret_cast<uint64_t*>(&slot.snapshot),
+                         reinterpret_cast<const uint64_t*>(&snapshot));
+        __atomic_store_n(&slot.sequence, 2 * (n + 1), __ATOMIC_RELEASE);
+        
+        published_ = n + 1;
+        __atomic_store_n(&header_->published, published_, __ATOMIC_RELEASE);
+    }
+    
+    uint64_t published() const noexcept { return published_; }
+};
+
+class ShmSubscriber {
+public:
+    enum class ReadResult {
+        Ok,         // snapshot filled in
+        Empty,      // nothing newer published yet
+        Overrun     // fell more than a ring behind; resynced to the oldest kept
+    };
+    
+private:
+    void* map_;
+    size_t map_size_;
+    const shm::Header* header_;
+    const shm::Slot* slots_;
+    uint64_t mask_;
+    uint64_t next_;       // next snapshot number read_next() returns
+    
+public:
+    // Attaches read-only to a segment created by ShmPublisher. Starts at
+    // the newest snapshot, so read_next() returns only what follows.
+    explicit ShmSubscriber(const char* name)
+        : map_(MAP_FAILED), map_size_(0), header_(nullptr), slots_(nullptr), mask_(0), next_(0) {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd == -1) {
+            throw std::runtime_error(std::string("No shared memory feed ") + name);
+        }
+        struct stat sb;
+        if (fstat(fd, &sb) == -1 || static_cast<size_t>(sb.st_size) < sizeof(shm::Header)) {
+            close(fd);
+            throw std::runtime_error(std::string("Shared memory feed not ready: ") + name);
+        }
+        map_size_ = sb.st_size;
+        map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map_ == MAP_FAILED) {
+            throw std::runtime_error(std::string("Failed to map shared memory ") + name);
+        }
+        
+        header_ = static_cast<const shm::Header*>(map_);
+        if (__atomic_load_n(&header_->magic, __ATOMIC_ACQUIRE) != shm::MAGIC ||
+            header_->version != shm::VERSION || header_->slot_size != sizeof(shm::Slot) ||
+            shm::segment_size(header_->capacity) > map_size_) {
+            munmap(map_, map_size_);
+            throw std::runtime_error(std::string("Incompatible shared memory feed ") + name);
+        }
+        slots_ = reinterpret_cast<const shm::Slot*>(static_cast<const char*>(map_) + sizeof(shm::Header));
+        mask_ = header_->capacity - 1;
+        next_ = published();
+    }
+    
+    ~ShmSubscriber() {
+        if (map_ != MAP_FAILED) {
+            munmap(map_, map_size_);
+        }
+    }
+    
+    ShmSubscriber(const ShmSubscriber&) = delete;
+    ShmSubscriber& operator=(const ShmSubscriber&) = delete;
+    
+    uint64_t published() const noexcept {
+        return __atomic_load_n(&header_->published, __ATOMIC_ACQUIRE);
+    }
+    
+    // Most recent snapshot, for readers that only want the current book.
+    bool read_latest(MBPSnapshot& out) const noexcept {
+        while (true) {
+            uint64_t n = published();
+            if (n == 0) return false;
+            if (read_slot(n - 1, out) == 0) return true;
+        }
+    }
+    
+    // Snapshots in publication order.
+    ReadResult read_next(MBPSnapshot& out) noexcept {
+        while (true) {
+            int status = read_slot(next_, out);
+            if (status == 0) {
+                ++next_;
+                return ReadResult::Ok;
+            }
+            if (status < 0) return ReadResult::Empty;
+            
+            // Lapped: skip to the oldest snapshot the ring still holds.
+            uint64_t n = published();
+            next_ = n > mask_ + 1 ? n - mask_ : 0;
+            if (read_slot(next_, out) == 0) {
+                ++next_;
+                return ReadResult::Overrun;
+            }
+        }
+    }
+    
+private:
+    // 0: snapshot n copied, -1: not published yet, 1: overwritten.
+    int read_slot(uint64_t n, MBPSnapshot& out) const noexcept {
+        const shm::Slot& slot = slots_[n & mask_];
+        uint64_t expected = 2 * (n + 1);
+        while (true) {
+            uint64_t before = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+            if (before < expected) {
+                if (before + 1 == expected) continue;   // being written right now
+                return -1;
+            }
+            if (before > expected) return 1;
+            
+            shm::load_words(reinterpret_cast<uint64_t*>(&out),
+                            reinterpret_cast<const uint64_t*>(&slot.snapshot));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot.sequence, __ATOMIC_RELAXED) == expected) {
+                return 0;
+            }
+        }
+    }
+};
+
+} // namespace mbp_reconstructor
@@ -2,36 +2,130 @@
 
 #include "order.hpp"
 #include "order_book.hpp"
+#include <optional>
 #include <string>
 #include <cstdio>
 
 namespace mbp_reconstructor {
 
+// Statistics implied by the top of book, for the optional trailing MBP
+// columns. Prices are in display units (raw / 100).
+struct DerivedFields {
+    bool     two_sided = false;   // both level 0s present; the rest is unset otherwise
+    int64_t  spread_raw = 0;
+    double   mid = 0.0;
+    double   microprice = 0.0;    // level-0 prices weighted by the opposite side's size
+    double   imbalance = 0.0;     // (bid - ask) / (bid + ask) over the top depth levels' sizes
+};
+
+// Keeps DerivedFields current from successive snapshots and their change
+// masks: the top-depth size sums are adjusted only for the levels in the
+// mask, and the level-0 figures are only recomputed when level 0 changed.
+class DerivedFieldTracker {
+private:
+    int depth_;
+    uint32_t depth_mask_;
+    uint32_t touch_mask_;
+    uint64_t bid_depth_size_;
+    uint64_t ask_depth_size_;
+    DerivedFields fields_;
+    
+public:
+    explicit DerivedFieldTracker(int depth)
+        : depth_(depth), depth_mask_(0), touch_mask_(bid_level_bit(0) | ask_level_bit(0)),
+          bid_depth_size_(0), ask_depth_size_(0) {
+        for (int i = 0; i < depth; ++i) {
+            depth_mask_ |= bid_level_bit(i) | ask_level_bit(i);
+        }
+    }
+    
+    int depth() const noexcept { return depth_; }
+    const DerivedFields& fields() const noexcept { return fields_; }
+    
+    // current replaces previous; changed is their changed_levels() mask.
+    void update(const MBPSnapshot& current, const MBPSnapshot& previous, uint32_t changed) {
+        if ((changed & depth_mask_) == 0) return;
+        
+        for (int i = 0; i < depth_; ++i) {
+            if (changed & bid_level_bit(i)) {
+                bid_depth_size_ += current.bid_sz[i] - previous.bid_sz[i];
+            }
+            if (changed & ask_level_bit(i)) {
+                ask_depth_size_ += current.ask_sz[i] - previous.ask_sz[i];
+            }
+        }
+        
+        uint64_t depth_total = bid_depth_size_ + ask_depth_size_;
+        fields_.imbalance = depth_total > 0
+            ? (static_cast<double>(bid_depth_size_) - static_cast<double>(ask_depth_size_)) / depth_total
+            : 0.0;
+        
+        if (changed & touch_mask_) {
+            update_touch(current);
+        }
+    }
+    
+private:
+    void update_touch(const MBPSnapshot& snapshot) {
+        fields_.two_sided = snapshot.bid_sz[0] != 0 && snapshot.ask_sz[0] != 0;
+        if (!fields_.two_sided) return;
+        
+        double bid = snapshot.bid_px[0] / 100.0;
+        double ask = snapshot.ask_px[0] / 100.0;
+        double bid_size = static_cast<double>(snapshot.bid_sz[0]);
+        double ask_size = static_cast<double>(snapshot.ask_sz[0]);
+        
+        fields_.spread_raw = snapshot.ask_px[0] - snapshot.bid_px[0];
+        fields_.mid = (bid + ask) / 2.0;
+        fields_.microprice = (bid * ask_size + ask * bid_size) / (bid_size + ask_size);
+    }
+};
+
 class SnapshotManager {
 private:
     MBPSnapshot current_snapshot_;
     MBPSnapshot previous_snapshot_;
     bool has_previous_;
+    bool order_counts_;
     uint64_t snapshots_generated_;
     uint64_t snapshots_skipped_;
+    std::optional<DerivedFieldTracker> derived_;
     
 public:
-    SnapshotManager() : has_previous_(false), snapshots_generated_(0), snapshots_skipped_(0) {}
+    SnapshotManager()
+        : has_previous_(false), order_counts_(false), snapshots_generated_(0), snapshots_skipped_(0) {}
+    
+    // Treats a change in a level's order count alone (same price and size)
+    // as a change, for output that carries the counts. Off by default, so
+    // price/size output is not padded with count-only snapshots.
+    void compare_order_counts(bool enabled) noexcept { order_counts_ = enabled; }
+    
+    // Maintains DerivedFields, with the imbalance over the top depth
+    // (1-10) levels. Call before the first update().
+    void enable_derived_fields(int depth) {
+        derived_.emplace(depth);
+    }
+    
+    // Null unless enabled; matches the current snapshot.
+    const DerivedFields* derived_fields() const noexcept {
+        return derived_ ? &derived_->fields() : nullptr;
+    }
     
     bool should_generate_snapshot(const OrderBook& book, uint64_t timestamp) {
-        book.get_top10_snapshot(current_snapshot_);
-        current_snapshot_.timestamp_ns = timestamp;
-        
-        if (has_previous_ && !current_snapshot_.differs_from(previous_snapshot_)) {
-            ++snapshots_skipped_;
-            return false;
-        }
-        
-        previous_snapshot_ = current_snapshot_;
-        has_previous_ = true;
-        ++snapshots_generated_;
-        
-        return true;
+        return update(book, timestamp) != 0;
+    }
+    
+    // Refreshes the current snapshot and returns the mask of levels that
+    // changed since the last one generated (every level for the first).
+    // 0 means the top 10 is unchanged and the snapshot is skipped.
+    uint32_t update(const OrderBook& book, uint64_t timestamp) {
+        return refresh(book, timestamp, false);
+    }
+    
+    // As update(), but the snapshot is generated even when nothing
+    // changed (a 0 mask), for output on a fixed time grid.
+    uint32_t sample(const OrderBook& book, uint64_t timestamp) {
+        return refresh(book, timestamp, true);
     }
     
     const MBPSnapshot& get_current_snapshot() const {
@@ -44,17 +138,55 @@ public:
         uint64_t total = snapshots_generated_ + snapshots_skipped_;
         return total > 0 ? static_cast<double>(snapshots_skipped_) / total : 0.0;
     }
+    
+private:
+    uint32_t refresh(const OrderBook& book, uint64_t timestamp, bool always) {
+        book.get_top10_snapshot(current_snapshot_);
+        current_snapshot_.timestamp_ns = timestamp;
+        
+        uint32_t changed = ALL_LEVELS_MASK;
+        if (has_previous_) {
+            if (!current_snapshot_.differs_from(previous_snapshot_, order_counts_)) {
+                if (!always) {
+                    ++snapshots_skipped_;
+                    return 0;
+                }
+                changed = 0;
+            } else {
+                changed = current_snapshot_.changed_levels(previous_snapshot_, order_counts_);
+            }
+        }
+        
+        if (derived_) {
+            // Before the first snapshot previous_snapshot_ is all zeros,
+            // which the all-levels mask turns into a full recount.
+            derived_->update(current_snapshot_, previous_snapshot_, changed);
+        }
+        
+        previous_snapshot_ = current_snapshot_;
+        has_previous_ = true;
+        ++snapshots_generated_;
+        
+        return changed;
+    }
 };
 
 class MBPFormatter {
 private:
     static constexpr size_t BUFFER_SIZE = 1024;
     char buffer_[BUFFER_SIZE];
+    bool order_counts_;
     
 public:
-    std::string format_snapshot(const MBPSnapshot& snapshot) {
+    // order_counts adds a bid_ct/ask_ct column after each size column.
+    explicit MBPFormatter(bool order_counts = false) : order_counts_(order_counts) {}
+    
+    // With derived, appends mid,microprice,spread,imbalance (see
+    // CSVHeader::generate_mbp_header); the first three are empty unless
+    // the book is two-sided.
+    std::string format_snapshot(const MBPSnapshot& snapshot, const DerivedFields* derived = nullptr) {
         std::string result;
-        result.reserve(512);
+        result.reserve(order_counts_ ? 640 : 512);
         
         result += std::to_string(snapshot.timestamp_ns);
         
@@ -67,6 +199,12 @@ public:
             if (snapshot.bid_sz[i] != 0) {
                 result += std::to_string(snapshot.bid_sz[i]);
             }
+            if (order_counts_) {
+                result += ',';
+                if (snapshot.bid_ct[i] != 0) {
+                    result += std::to_string(snapshot.bid_ct[i]);
+                }
+            }
         }
         
         for (int i = 0; i < 10; ++i) {
@@ -78,6 +216,16 @@ public:
             if (snapshot.ask_sz[i] != 0) {
                 result += std::to_string(snapshot.ask_sz[i]);
             }
+            if (order_counts_) {
+                result += ',';
+                if (snapshot.ask_ct[i] != 0) {
+                    result += std::to_string(snapshot.ask_ct[i]);
+                }
+            }
+        }
+        
+        if (derived) {
+            append_derived(result, *derived);
         }
         
         result += '\n';
@@ -112,8 +260,7 @@ public:
         return ptr - output;
     }
     
-private:
-    std::string price_to_string(int64_t price_raw) {
+    static std::string price_to_string(int64_t price_raw) {
         int64_t whole = price_raw / 100;
         int64_t frac = price_raw % 100;
         
@@ -125,28 +272,79 @@ private:
             return std::string(buffer);
         }
     }
+    
+private:
+    void append_derived(std::string& result, const DerivedFields& derived) {
+        if (derived.two_sided) {
+            int n = snprintf(buffer_, BUFFER_SIZE, ",%.3f,%.4f,", derived.mid, derived.microprice);
+            result.append(buffer_, n);
+            result += price_to_string(derived.spread_raw);
+        } else {
+            result += ",,,";
+        }
+        int n = snprintf(buffer_, BUFFER_SIZE, ",%.4f", derived.imbalance);
+        result.append(buffer_, n);
+    }
+};
+
+// One CSV row per aggregated T+F+C trade, in the MBP rows' price format.
+class TradeFormatter {
+public:
+    std::string format_trade(const TradeInfo& trade) {
+        std::string result;
+        result.reserve(64);
+        
+        result += std::to_string(trade.timestamp_ns);
+        result += ',';
+        result += MBPFormatter::price_to_string(trade.price_raw);
+        result += ',';
+        result += std::to_string(trade.size);
+        result += ',';
+        result += trade.side;
+        result += ',';
+        result += std::to_string(trade.orders_filled);
+        result += '\n';
+        return result;
+    }
 };
 
 class CSVHeader {
 public:
-    static std::string generate_mbp_header() {
+    // Matches MBPFormatter(order_counts), with derived fields if derived.
+    static std::string generate_mbp_header(bool order_counts = false, bool derived = false) {
         std::string header = "ts_event";
         
         for (int i = 0; i < 10; ++i) {
             header += ",bid_px_" + format_level_index(i);
             header += ",bid_sz_" + format_level_index(i);
+            if (order_counts) header += ",bid_ct_" + format_level_index(i);
         }
         
         for (int i = 0; i < 10; ++i) {
             header += ",ask_px_" + format_level_index(i);
             header += ",ask_sz_" + format_level_index(i);
+            if (order_counts) header += ",ask_ct_" + format_level_index(i);
+        }
+        
+        if (derived) {
+            header += ",mid,microprice,spread,imbalance";
         }
         
         header += '\n';
         return header;
     }
     
-private:
+    static std::string generate_trade_header() {
+        return "ts_event,price,size,side,orders_filled\n";
+    }
+    
+    // ts_event is the start of the bar's interval.
+    static std::string generate_bar_header() {
+        return "ts_event,open,high,low,close,volume,trades,vwap,mid_close,"
+               "spread_avg,spread_min,spread_max\n";
+    }
+    
+    // Two digits, as in bid_px_00.
     static std::string format_level_index(int index) {
         if (index < 10) {
             return "0" + std::to_string(index);
@@ -180,6 +378,11 @@ public:
         return std::string{};
     }
     
+    // The snapshot behind the last row process_event() returned.
+    const MBPSnapshot& current_snapshot() const noexcept {
+        return manager_.get_current_snapshot();
+    }
+    
     void process_events_batch(const OrderBook& book, 
                              const std::vector<uint64_t>& timestamps,
                              std::vector<std::string>& output) {
@@ -195,17 +398,23 @@ public:
     }
     
     // Performance statistics
-    void print_statistics() const {
-        printf("Snapshot Statistics:\n");
-        printf("  Events processed: %llu\n", (unsigned long long)total_events_processed_);
-        printf("  Snapshots written: %llu\n", (unsigned long long)snapshots_written_);
-        printf("  Snapshots generated: %llu\n", (unsigned long long)manager_.get_snapshots_generated());
-        printf("  Snapshots skipped: %llu\n", (unsigned long long)manager_.get_snapshots_skipped());
-        printf("  Compression ratio: %.2f%%\n", manager_.get_compression_ratio() * 100.0);
-        
-        if (total_events_processed_ > 0) {
-            printf("  Output rate: %.2f%%\n", 
-                   static_cast<double>(snapshots_written_) / total_events_processed_ * 100.0);
+    void print_statistics(FILE* out = stdout) const {
+        print_snapshot_statistics(out, total_events_processed_, snapshots_written_, manager_);
+    }
+    
+    static void print_snapshot_statistics(FILE* out, uint64_t events_processed,
+                                          uint64_t snapshots_written,
+                                          const SnapshotManager& manager) {
+        fprintf(out, "Snapshot Statistics:\n");
+        fprintf(out, "  Events processed: %llu\n", (unsigned long long)events_processed);
+        fprintf(out, "  Snapshots written: %llu\n", (unsigned long long)snapshots_written);
+        fprintf(out, "  Snapshots generated: %llu\n", (unsigned long long)manager.get_snapshots_generated());
+        fprintf(out, "  Snapshots skipped: %llu\n", (unsigned long long)manager.get_snapshots_skipped());
+        fprintf(out, "  Compression ratio: %.2f%%\n", manager.get_compression_ratio() * 100.0);
+        
+        if (events_processed > 0) {
+            fprintf(out, "  Output rate: %.2f%%\n", 
+                    static_cast<double>(snapshots_written) / events_processed * 100.0);
         }
     }
 };
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "csv_parser.hpp"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace mbp_reconstructor {
+
+// Byte source over a file descriptor: stdin, a FIFO, or a regular file
+// another process appends to (follow mode). read() blocks until data is
+// available and returns 0 only at the end of the input.
+class FdSource {
+private:
+    // A followed file is re-polled with bare reads for a while before
+    // falling back to short sleeps, so a busy feed is picked up without
+    // a timer wakeup.
+    static constexpr unsigned FOLLOW_SPIN_READS = 4096;
+    static constexpr long     FOLLOW_POLL_NS = 50 * 1000;
+    
+    int fd_;
+    bool owns_fd_;
+    bool follow_;
+    
+public:
+    // "-" reads standard input. With follow set, reaching the end of a
+    // regular file waits for it to grow instead of ending the stream.
+    explicit FdSource(const char* path, bool follow = false)
+        : FdSource(open_input(path), std::strcmp(path, "-") != 0, follow) {}
+    
+    // Reads from an already open descriptor, which stays owned by the caller.
+    explicit FdSource(int fd, bool follow = false)
+        : FdSource(fd, false, follow) {}
+    
+    FdSource(FdSource&& other) noexcept
+        : fd_(std::exchange(other.fd_, -1)), owns_fd_(std::exchange(other.owns_fd_, false)),
+          follow_(other.follow_) {}
+    
+    ~FdSource() {
+        if (owns_fd_) {
+            close(fd_);
+        }
+    }
+    
+    FdSource(const FdSource&) = delete;
+    FdSource& operator=(const FdSource&) = delete;
+    FdSource& operator=(FdSource&&) = delete;
+    
+    int fd() const noexcept { return fd_; }
+    
+    size_t read(char* buffer, size_t capacity) {
+        unsigned idle_reads = 0;
+        while (true) {
+            ssize_t n = ::read(fd_, buffer, capacity);
+            if (n > 0) {
+                return static_cast<size_t>(n);
+            }
+            if (n < 0) {
+                if (errno != EINTR) {
+                    throw std::runtime_error("Failed to read input");
+                }
+            } else if (follow_) {
+                wait_for_growth(idle_reads++);
+            } else {
+                return 0;
+            }
+        }
+    }
+    
+private:
+    FdSource(int fd, bool owns_fd, bool follow) : fd_(fd), owns_fd_(owns_fd) {
+        struct stat sb;
+        if (fstat(fd_, &sb) == -1) {
+            if (owns_fd_) close(fd_);
+            throw std::runtime_error("Failed to stat input");
+        }
+        // Pipes and FIFOs block in read() until data arrives and report
+        // end of input once the writer is gone, so following only
+        // applies to regular files.
+        follow_ = follow && S_ISREG(sb.st_mode);
+    }
+    
+    static int open_input(const char* path) {
+        if (std::strcmp(path, "-") == 0) {
+            return STDIN_FILENO;
+        }
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open file");
+        }
+        return fd;
+    }
+    
+    static void wait_for_growth(unsigned idle_reads) {
+        if (idle_reads < FOLLOW_SPIN_READS) {
+            sched_yield();
+            return;
+        }
+        struct timespec pause = {0, FOLLOW_POLL_NS};
+        nanosleep(&pause, nullptr);
+    }
+};
+
+// MBO parser over a byte source that is consumed as it arrives: a pipe,
+// a growing file, or a decompressor (see compressed_input.hpp).
+//
+// Bytes are read into a buffer that holds the partial record left over
+// from the previous read followed by the newly arrived data; only the
+// complete lines in it are handed to the record cursor, and the tail is
+// carried to the front before the next read. parse_events() returns as
+// soon as the buffered lines are consumed instead of waiting for a full
+// block, so each event is applied as soon as its line arrives.
+template<typename Source>
+class BasicStreamingCSVParser : private CSVRecordCursor {
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+    
+private:
+    Source source_;
+    bool header_skipped_;
+    bool eof_;
+    std::vector<char> buffer_;
+    size_t filled_;
+    
+public:
+    explicit BasicStreamingCSVParser(Source source, size_t buffer_size = DEFAULT_BUFFER_SIZE)
+        : source_(std::move(source)), header_skipped_(false), eof_(false),
+          buffer_(buffer_size > 0 ? buffer_size : DEFAULT_BUFFER_SIZE), filled_(0) {
+        current_ = end_ = buffer_.data();
+    }
+    
+    BasicStreamingCSVParser(const BasicStreamingCSVParser&) = delete;
+    BasicStreamingCSVParser& operator=(const BasicStreamingCSVParser&) = delete;
+    
+    using CSVRecordCursor::set_filter;
+    using CSVRecordCursor::stop_after;
+    
+    bool parse_next_event(Event& event) {
+        return parse_events(&event, 1) == 1;
+    }
+    
+    // Parses up to max_events of the records already buffered, reading
+    // (and blocking) only when none are left. Returns 0 once the input
+    // has ended.
+    size_t parse_events(Event* events, size_t max_events) {
+        size_t count = 0;
+        while (count < max_events && at_record(count)) {
+            count += take_record(events[count]);
+        }
+        return count;
+    }
+    
+    // The same into a block, which is refilled from its first row.
+    size_t parse_events(EventBlock& block) {
+        block.count = 0;
+        while (!block.full() && at_record(block.count)) {
+            take_record(block);
+        }
+        return block.count;
+    }
+    
+private:
+    // Whether a buffered record is under the cursor, skipping the header
+    // line on first use. Reads only while nothing has been parsed yet in
+    // this call (parsed == 0), and never once stopped.
+    bool at_record(size_t parsed) {
+        if (stopped_) {
+            return false;
+        }
+        while (true) {
+            if (current_ >= end_ && (parsed > 0 || !fill())) {
+                return false;
+            }
+            if (header_skipped_) {
+                return true;
+            }
+            skip_to_next_line();
+            header_skipped_ = true;
+        }
+    }
+    
+    // Reads until the buffer holds at least one complete record or the
+    // input ends. Returns false when nothing is left to parse.
+    bool fill() {
+        // Carry the partial record over to the front of the buffer.
+        size_t carry = static_cast<size_t>(buffer_.data() + filled_ - current_);
+        std::memmove(buffer_.data(), current_, carry);
+        filled_ = carry;
+        
+        while (!eof_) {
+            if (filled_ == buffer_.size()) {
+                buffer_.resize(buffer_.size() * 2);   // record longer than the buffer
+            }
+            
+            size_t n = source_.read(buffer_.data() + filled_, buffer_.size() - filled_);
+            if (n == 0) {
+                eof_ = true;
+                break;
+            }
+            
+            // The carried bytes hold no newline, so only the new data
+            // needs scanning.
+            const char* arrived = buffer_.data() + filled_;
+            filled_ += n;
+            const void* last_newline = memrchr(arrived, '\n', n);
+            if (last_newline) {
+                current_ = buffer_.data();
+                end_ = static_cast<const char*>(last_newline) + 1;
+                return true;
+            }
+        }
+        
+        // The input has ended; a last record without a newline is complete.
+        current_ = buffer_.data();
+        end_ = buffer_.data() + filled_;
+        return current_ < end_;
+    }
+};
+
+// Streaming parser over stdin ("-"), a FIFO or a (followed) file.
+class StreamingCSVParser : public BasicStreamingCSVParser<FdSource> {
+public:
+    explicit StreamingCSVParser(const char* path, bool follow = false,
+                                size_t buffer_size = DEFAULT_BUFFER_SIZE)
+        : BasicStreamingCSVParser(FdSource(path, follow), buffer_size) {}
+    
+    explicit StreamingCSVParser(int fd, bool follow = false,
+                                size_t buffer_size = DEFAULT_BUFFER_SIZE)
+        : BasicStreamingCSVParser(FdSource(fd, follow), buffer_size) {}
+};
+
+} // namespace mbp_reconstructor
@@ -0,0 +1,514 @@
+#pragma once
+
+#include "csv_parser.hpp"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+namespace mbp_reconstructor {
+
+// Minimal io_uring submission/completion ring over the raw syscalls, for
+// the handful of plain reads and writes the backends below need.
+class IoUring {
+private:
+    int ring_fd_;
+    unsigned sq_entries_;
+    unsigned pending_;       // queued SQEs not yet passed to the kernel
+    
+    void*  sq_ring_;
+    size_t sq_ring_size_;
+    void*  cq_ring_;
+    size_t cq_ring_size_;
+    io_uring_sqe* sqes_;
+    size_t sqes_size_;
+    
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    io_uring_cqe* cqes_;
+    
+public:
+    explicit IoUring(unsigned entries)
+        : ring_fd_(-1), sq_entries_(0), pending_(0), sq_ring_(MAP_FAILED), sq_ring_size_(0),
+          cq_ring_(MAP_FAILED), cq_ring_size_(0), sqes_(nullptr), sqes_size_(0) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd_ < 0) {
+            throw std::runtime_error("io_uring is not available");
+        }
+        sq_entries_ = params.sq_entries;
+        
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            teardown();
+            throw std::runtime_error("Failed to map io_uring");
+        }
+        cq_ring_ = single_mmap ? sq_ring_
+                               : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (cq_ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+            teardown();
+            throw std::runtime_error("Failed to map io_uring");
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+        
+        char* sq = static_cast<char*>(sq_ring_);
+        sq_head_  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        
+        char* cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+    
+    ~IoUring() {
+        teardown();
+    }
+    
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    
+    void prepare_read(int fd, void* buf, size_t len, uint64_t offset, uint64_t user_data) {
+        prepare(IORING_OP_READ, fd, buf, len, offset, user_data);
+    }
+    
+    // offset UINT64_MAX writes at (and advances) the file position.
+    void prepare_write(int fd, const void* buf, size_t len, uint64_t offset, uint64_t user_data) {
+        prepare(IORING_OP_WRITE, fd, buf, len, offset, user_data);
+    }
+    
+    // Hands queued SQEs to the kernel, optionally waiting for completions.
+    void submit(unsigned wait_for = 0) {
+        while (pending_ > 0 || wait_for > 0) {
+            long ret = syscall(__NR_io_uring_enter, ring_fd_, pending_, wait_for,
+                               wait_for ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("io_uring_enter failed");
+            }
+            pending_ -= static_cast<unsigned>(ret);
+            wait_for = 0;
+        }
+    }
+    
+    bool pop_completion(uint64_t& user_data, int32_t& result) noexcept {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+        user_data = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    
+    void wait_completion(uint64_t& user_data, int32_t& result) {
+        while (!pop_completion(user_data, result)) {
+            submit(1);
+        }
+    }
+    
+private:
+    void prepare(uint8_t opcode, int fd, const void* buf, size_t len, uint64_t offset,
+                 uint64_t user_data) {
+        unsigned tail = *sq_tail_;
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+            submit();
+        }
+        
+        unsigned index = tail & *sq_mask_;
+        io_uring_sqe& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.off = offset;
+        sqe.addr = reinterpret_cast<uint64_t>(buf);
+        sqe.len = static_cast<uint32_t>(len);
+        sqe.user_data = user_data;
+        
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        ++pending_;
+    }
+    
+    void teardown() noexcept {
+        if (sqes_) munmap(sqes_, sqes_size_);
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+        if (ring_fd_ >= 0) close(ring_fd_);
+        sqes_ = nullptr;
+        cq_ring_ = sq_ring_ = MAP_FAILED;
+        ring_fd_ = -1;
+    }
+};
+
+// MBO file parser that keeps READS_IN_FLIGHT chunk reads queued ahead of
+// the record cursor instead of taking page faults on an mmap.
+//
+// Every chunk buffer has CARRY_ROOM bytes in front of the read target: the
+// record split across a chunk boundary is copied there from the previous
+// chunk, so parsing never crosses buffers and the data is never moved as a
+// whole.
+class UringCSVParser : private CSVRecordCursor {
+public:
+    static constexpr size_t   READ_CHUNK_SIZE = 1 << 20;
+    static constexpr unsigned READS_IN_FLIGHT = 4;
+    
+private:
+    static constexpr size_t CARRY_ROOM = 64 * 1024;   // longest record carried over
+    
+    struct Chunk {
+        std::unique_ptr<char[]> memory;   // CARRY_ROOM + READ_CHUNK_SIZE
+        uint64_t offset = 0;
+        size_t   length = 0;              // 0 once the file has no more chunks
+        size_t   filled = 0;
+        
+        char* data() noexcept { return memory.get() + CARRY_ROOM; }
+        bool ready() const noexcept { return filled == length; }
+    };
+    
+    int fd_;
+    uint64_t file_size_;
+    uint64_t next_offset_;
+    IoUring ring_;
+    Chunk chunks_[READS_IN_FLIGHT];
+    unsigned head_;             // chunk under the cursor
+    const char* data_end_;      // end of the head chunk's bytes
+    bool started_;
+    bool first_line_skipped_;
+    
+public:
+    explicit UringCSVParser(const char* filename)
+        : fd_(open_input(filename)), file_size_(0), next_offset_(0), ring_(READS_IN_FLIGHT * 2),
+          head_(0), data_end_(nullptr), started_(false), first_line_skipped_(false) {
+        struct stat sb;
+        if (fstat(fd_, &sb) == -1) {
+            close(fd_);
+            throw std::runtime_error("Failed to get file size");
+        }
+        file_size_ = sb.st_size;
+        
+        for (unsigned i = 0; i < READS_IN_FLIGHT; ++i) {
+            chunks_[i].memory = std::make_unique<char[]>(CARRY_ROOM + READ_CHUNK_SIZE);
+            queue_read(i);
+        }
+        ring_.submit();
+    }
+    
+    ~UringCSVParser() {
+        // Reads still in flight target our buffers; let them land first.
+        try {
+            for (unsigned i = 0; i < READS_IN_FLIGHT; ++i) {
+                while (!chunks_[i].ready()) {
+                    reap();
+                }
+            }
+        } catch (...) {
+        }
+        close(fd_);
+    }
+    
+    UringCSVParser(const UringCSVParser&) = delete;
+    UringCSVParser& operator=(const UringCSVParser&) = delete;
+    
+    using CSVRecordCursor::set_filter;
+    using CSVRecordCursor::stop_after;
+    
+    bool parse_next_event(Event& event) {
+        while (at_record()) {
+            if (take_record(event)) return true;
+        }
+        return false;
+    }
+    
+    size_t parse_events(Event* events, size_t max_events) {
+        size_t count = 0;
+        while (count < max_events && parse_next_event(events[count])) {
+            ++count;
+        }
+        return count;
+    }
+    
+    // Refills the block with up to CAPACITY events; 0 at the end of the file.
+    size_t parse_events(EventBlock& block) {
+        block.count = 0;
+        while (!block.full() && at_record()) {
+            take_record(block);
+        }
+        return block.count;
+    }
+    
+private:
+    // Moves to the next chunk when the cursor's is used up and skips the
+    // header line on first use; false at the end of the file or once
+    // stopped.
+    bool at_record() {
+        if (stopped_ || (current_ >= end_ && !next_chunk())) {
+            return false;
+        }
+        
+        if (!first_line_skipped_) {
+            skip_to_next_line();
+            first_line_skipped_ = true;
+            if (current_ >= end_ && !next_chunk()) return false;
+        }
+        return true;
+    }
+    
+    static int open_input(const char* filename) {
+        int fd = open(filename, O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open file");
+        }
+        return fd;
+    }
+    
+    void queue_read(unsigned index) {
+        Chunk& chunk = chunks_[index];
+        chunk.offset = next_offset_;
+        chunk.length = static_cast<size_t>(std::min<uint64_t>(READ_CHUNK_SIZE, file_size_ - next_offset_));
+        chunk.filled = 0;
+        next_offset_ += chunk.length;
+        if (chunk.length > 0) {
+            ring_.prepare_read(fd_, chunk.data(), chunk.length, chunk.offset, index);
+        }
+    }
+    
+    // Takes one completion, re-queueing the rest of a short read.
+    void reap() {
+        uint64_t index;
+        int32_t result;
+        ring_.wait_completion(index, result);
+        
+        Chunk& chunk = chunks_[index];
+        if (result < 0) {
+            if (result != -EINTR && result != -EAGAIN) {
+                throw std::runtime_error("io_uring read failed");
+            }
+        } else if (result == 0) {
+            chunk.length = chunk.filled;      // file shrank underneath us
+            return;
+        } else {
+            chunk.filled += static_cast<size_t>(result);
+            if (chunk.ready()) return;
+        }
+        ring_.prepare_read(fd_, chunk.data() + chunk.filled, chunk.length - chunk.filled,
+                           chunk.offset + chunk.filled, index);
+        ring_.submit();
+    }
+    
+    // Moves the cursor onto the next chunk, prefixed with the partial record
+    // left at the end of the current one, and refills the freed buffer.
+    bool next_chunk() {
+        unsigned next = started_ ? (head_ + 1) % READS_IN_FLIGHT : head_;
+        Chunk& chunk = chunks_[next];
+        if (chunk.length == 0) {
+            return false;
+        }
+        while (!chunk.ready()) {
+            reap();
+        }
+        
+        size_t carry_len = 0;
+        if (started_) {
+            carry_len = static_cast<size_t>(data_end_ - current_);
+            if (carry_len > CARRY_ROOM) {
+                throw std::runtime_error("CSV record longer than the carry-over buffer");
+            }
+            std::memcpy(chunk.data() - carry_len, current_, carry_len);
+            queue_read(head_);
+            ring_.submit();
+        }
+        char* start = chunk.data() - carry_len;
+        head_ = next;
+        started_ = true;
+        
+        data_end_ = chunk.data() + chunk.length;
+        current_ = start;
+        if (chunk.offset + chunk.length == file_size_) {
+            end_ = data_end_;                 // last chunk: the final record needs no newline
+        } else {
+            const void* last_newline = memrchr(start, '\n', static_cast<size_t>(data_end_ - start));
+            end_ = last_newline ? static_cast<const char*>(last_newline) + 1 : start;
+        }
+        
+        return current_ < end_ || next_chunk();
+    }
+};
+
+// Output sink that hands full buffers to io_uring and keeps filling the
+// next one while the write is in flight. Regular files are written at
+// explicit offsets so several writes can be outstanding; pipes, terminals
+// and O_APPEND files keep one write in flight to preserve order.
+class UringWriter {
+public:
+    static constexpr size_t   BUFFER_SIZE = 1 << 20;
+    static constexpr unsigned WRITES_IN_FLIGHT = 4;
+    
+private:
+    static constexpr uint64_t CURRENT_POSITION = UINT64_MAX;
+    static constexpr unsigned MAX_RETRIES = 16;      // EINTR/EAGAIN in a row, per buffer
+    
+    struct Buffer {
+        std::unique_ptr<char[]> data;
+        size_t   size = 0;
+        size_t   written = 0;
+        uint64_t offset = 0;
+        unsigned retries = 0;
+        bool     busy = false;
+    };
+    
+    int fd_;
+    bool positional_;
+    uint64_t offset_;
+    unsigned max_in_flight_;
+    unsigned in_flight_;
+    IoUring ring_;
+    Buffer buffers_[WRITES_IN_FLIGHT];
+    unsigned current_;
+    
+public:
+    explicit UringWriter(int fd)
+        : fd_(fd), positional_(false), offset_(0), max_in_flight_(1), in_flight_(0),
+          ring_(WRITES_IN_FLIGHT * 2), current_(0) {
+        struct stat sb;
+        off_t position = lseek(fd_, 0, SEEK_CUR);
+        int flags = fcntl(fd_, F_GETFL);
+        if (fstat(fd_, &sb) == 0 && S_ISREG(sb.st_mode) && position >= 0 &&
+            flags != -1 && !(flags & O_APPEND)) {
+            positional_ = true;
+            offset_ = static_cast<uint64_t>(position);
+            max_in_flight_ = WRITES_IN_FLIGHT;
+        }
+        
+        for (Buffer& buffer : buffers_) {
+            buffer.data = std::make_unique<char[]>(BUFFER_SIZE);
+        }
+    }
+    
+    ~UringWriter() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+    
+    UringWriter(const UringWriter&) = delete;
+    UringWriter& operator=(const UringWriter&) = delete;
+    
+    void write(std::string_view text) {
+        while (!text.empty()) {
+            Buffer& buffer = buffers_[current_];
+            size_t n = std::min(text.size(), BUFFER_SIZE - buffer.size);
+            std::memcpy(buffer.data.get() + buffer.size, text.data(), n);
+            buffer.size += n;
+            text.remove_prefix(n);
+            if (buffer.size == BUFFER_SIZE) {
+                flush();
+            }
+        }
+    }
+    
+    // Submits whatever is buffered without waiting for it to be written.
+    void flush() {
+        Buffer& buffer = buffers_[current_];
+        if (buffer.size == 0) return;
+        
+        while (in_flight_ >= max_in_flight_) {
+            reap();
+        }
+        buffer.busy = true;
+        buffer.written = 0;
+        buffer.retries = 0;
+        buffer.offset = positional_ ? offset_ : CURRENT_POSITION;
+        offset_ += buffer.size;
+        ++in_flight_;
+        ring_.prepare_write(fd_, buffer.data.get(), buffer.size, buffer.offset, current_);
+        ring_.submit();
+        
+        current_ = (current_ + 1) % WRITES_IN_FLIGHT;
+        while (buffers_[current_].busy) {
+            reap();
+        }
+    }
+    
+    // Writes everything out and leaves the file position after it, so
+    // ordinary writes to the same descriptor can follow.
+    void finish() {
+        flush();
+        while (in_flight_ > 0) {
+            reap();
+        }
+        if (positional_) {
+            lseek(fd_, static_cast<off_t>(offset_), SEEK_SET);
+        }
+    }
+    
+private:
+    void reap() {
+        uint64_t index;
+        int32_t result;
+        ring_.wait_completion(index, result);
+        
+        // A write that makes no progress (0 bytes, e.g. a full device) or
+        // keeps being interrupted would otherwise be resubmitted forever.
+        Buffer& buffer = buffers_[index];
+        if (result > 0) {
+            buffer.written += static_cast<size_t>(result);
+            buffer.retries = 0;
+        } else if (result == 0 || (result != -EINTR && result != -EAGAIN) ||
+                   ++buffer.retries > MAX_RETRIES) {
+            // Drop the buffer, so the destructor's finish() has nothing
+            // left to wait for.
+            buffer.busy = false;
+            buffer.size = 0;
+            --in_flight_;
+            throw std::runtime_error("io_uring write failed");
+        }
+        if (buffer.written < buffer.size) {
+            uint64_t offset = positional_ ? buffer.offset + buffer.written : CURRENT_POSITION;
+            ring_.prepare_write(fd_, buffer.data.get() + buffer.written,
+                                buffer.size - buffer.written, offset, index);
+            ring_.submit();
+            return;
+        }
+        
+        buffer.busy = false;
+        buffer.size = 0;
+        --in_flight_;
+    }
+};
+
+} // namespace mbp_reconstructor
@@ -3,6 +3,22 @@
 #include "../src/order_book.hpp"
 #include "../src/action_engine.hpp"
 #include "../src/csv_parser.hpp"
+#include "../src/stream_parser.hpp"
+#include "../src/uring_io.hpp"
+#include "../src/compressed_input.hpp"
+#include "../src/compressed_output.hpp"
+#include "../src/shm_publisher.hpp"
+#include "../src/reconstructor.hpp"
+#include "../src/l3_dump.hpp"
+#include "../src/bars.hpp"
+#include "../src/features.hpp"
+#include "../src/arrow_writer.hpp"
+#include "../src/metrics.hpp"
+#include "../src/shadow_verifier.hpp"
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
 
 using namespace mbp_reconstructor;
 
@@ -58,6 +74,32 @@ TEST_CASE("OrderBook Basic Operations", "[orderbook]") {
         REQUIRE(empty_bid_px == 0);
         REQUIRE(empty_bid_sz == 0);
     }
+    
+    SECTION("Clear reuses the order arena") {
+        for (uint64_t id = 1; id <= 1000; ++id) {
+            REQUIRE(book.add_order(id, 10000 + static_cast<int64_t>(id % 50) * (id % 2 ? -1 : 1),
+                                   100, id % 2 ? 'B' : 'A', id));
+        }
+        REQUIRE(book.cancel_order(500));
+        size_t high_water = book.get_pool_high_water();
+        
+        book.clear();
+        REQUIRE(book.get_active_orders() == 0);
+        REQUIRE(book.get_price_levels() == 0);
+        REQUIRE(book.get_best_bid().first == 0);
+        REQUIRE_FALSE(book.cancel_order(1));
+        
+        // The rebuilt book starts over from the first slot.
+        for (uint64_t id = 1; id <= 1000; ++id) {
+            REQUIRE(book.add_order(id, 10000 + static_cast<int64_t>(id % 50) * (id % 2 ? -1 : 1),
+                                   200, id % 2 ? 'B' : 'A', id));
+        }
+        REQUIRE(book.get_pool_high_water() == high_water);
+        REQUIRE(book.get_active_orders() == 1000);
+        REQUIRE(book.get_best_bid() == std::make_pair(int64_t{9999}, uint64_t{4000}));
+        REQUIRE(book.cancel_order(1));
+        REQUIRE(book.modify_order(2, 10100, 50));
+    }
 }
 
 TEST_CASE("Trade Execution", "[orderbook][trades]") {
@@ -96,6 +138,31 @@ TEST_CASE("Trade Execution", "[orderbook][trades]") {
         REQUIRE(ask_px == 10100);
         REQUIRE(ask_sz == 50);  // 250 - 200 = 50 remaining from second order
     }
+    
+    SECTION("FIFO priority preserved across cancels") {
+        REQUIRE(book.add_order(1001, 10100, 100, 'A', 1000));
+        REQUIRE(book.add_order(1002, 10100, 100, 'A', 2000));
+        REQUIRE(book.add_order(1003, 10100, 100, 'A', 3000));
+        REQUIRE(book.add_order(1004, 10100, 100, 'A', 4000));
+        
+        // Remove from the middle of the queue, then fill across the front
+        REQUIRE(book.cancel_order(1002));
+        uint32_t orders_filled = 0;
+        REQUIRE(book.execute_trade(10100, 150, 'B', &orders_filled));
+        REQUIRE(orders_filled == 2);
+        
+        // 1001 filled, 1003 partially filled, 1004 untouched
+        REQUIRE_FALSE(book.cancel_order(1001));
+        REQUIRE(book.modify_order(1004, 10100, 100));
+        auto [ask_px, ask_sz] = book.get_best_ask();
+        REQUIRE(ask_px == 10100);
+        REQUIRE(ask_sz == 150);
+        
+        REQUIRE(book.cancel_order(1003));
+        auto [last_px, last_sz] = book.get_best_ask();
+        REQUIRE(last_sz == 100);
+        REQUIRE(book.get_active_orders() == 1);
+    }
 }
 
 TEST_CASE("MBP-10 Snapshot Generation", "[orderbook][snapshot]") {
@@ -291,4 +358,1552 @@ TEST_CASE("Order Book Invariants", "[properties]") {
         auto [same_px, new_sz] = book.get_best_bid();
         REQUIRE(new_sz == 350);  // 200 + 150
     }
-} 
\ No newline at end of file
+}
+
+TEST_CASE("Dense Order Id Index", "[order_index]") {
+    OrderIdIndex index(OrderIndexKind::Dense);
+    
+    SECTION("Sequential ids resolve through the window") {
+        for (uint64_t id = 5000000; id < 5020000; ++id) {
+            index.insert(id, static_cast<OrderIndex>(id - 5000000));
+        }
+        REQUIRE(index.size() == 20000);
+        REQUIRE(index.fallback_size() == 0);
+        REQUIRE(index.find(5012345) == 12345);
+        REQUIRE(index.find(5020000) == NULL_ORDER);
+        
+        REQUIRE(index.erase(5012345));
+        REQUIRE_FALSE(index.erase(5012345));
+        REQUIRE(index.find(5012345) == NULL_ORDER);
+        REQUIRE(index.size() == 19999);
+    }
+    
+    SECTION("Outliers fall back to the hash map") {
+        index.insert(1000000, 1);
+        index.insert(999, 2);                    // below the window
+        index.insert(UINT64_C(1) << 60, 3);      // far ahead of it
+        
+        REQUIRE(index.fallback_size() == 2);
+        REQUIRE(index.find(1000000) == 1);
+        REQUIRE(index.find(999) == 2);
+        REQUIRE(index.find(UINT64_C(1) << 60) == 3);
+        
+        REQUIRE(index.erase(999));
+        REQUIRE(index.find(999) == NULL_ORDER);
+    }
+    
+    SECTION("Window slides past long-lived stragglers") {
+        index.insert(1000, 1);                   // pins the oldest page
+        REQUIRE(index.fallback_size() == 0);
+        
+        // Just past the window top (2^26 ids), well short of the outlier
+        // cutoff, so the window slides up by one page.
+        uint64_t far = 1000 + (UINT64_C(1) << 26);
+        index.insert(far, 2);
+        REQUIRE(index.find(far) == 2);
+        REQUIRE(index.fallback_size() == 1);     // the straggler was spilled
+        REQUIRE(index.find(1000) == 1);
+        
+        // The window moved: another id on the old base page is now below it.
+        index.insert(2000, 3);
+        REQUIRE(index.fallback_size() == 2);
+        
+        size_t visited = 0;
+        index.for_each([&](uint64_t, OrderIndex) { ++visited; });
+        REQUIRE(visited == 3);
+        
+        // 1000 is served from the fallback, and the window still has far.
+        REQUIRE(index.erase(1000));
+        REQUIRE(index.fallback_size() == 1);
+        REQUIRE(index.find(1000) == NULL_ORDER);
+        REQUIRE(index.find(far) == 2);
+        
+        index.clear();
+        REQUIRE(index.size() == 0);
+        REQUIRE(index.find(far) == NULL_ORDER);
+    }
+    
+    SECTION("Order book runs on the dense index") {
+        OrderBook book(OrderIndexKind::Dense);
+        REQUIRE(book.add_order(1001, 10100, 100, 'A', 1000));
+        REQUIRE(book.add_order(1002, 10100, 150, 'A', 2000));
+        REQUIRE_FALSE(book.add_order(1002, 10100, 150, 'A', 3000));
+        
+        REQUIRE(book.execute_trade(10100, 120, 'B'));
+        REQUIRE_FALSE(book.cancel_order(1001));
+        REQUIRE(book.get_active_orders() == 1);
+        
+        book.clear();
+        REQUIRE(book.get_active_orders() == 0);
+        REQUIRE(book.add_order(1001, 10100, 100, 'A', 4000));
+    }
+}
+
+TEST_CASE("Incremental Hash Map", "[order_index]") {
+    IncrementalHashMap<uint32_t> map;
+    
+    SECTION("Matches a reference map across incremental migrations") {
+        std::unordered_map<uint64_t, uint32_t> reference;
+        std::mt19937_64 rng(5);
+        bool saw_migration = false;
+        
+        for (uint32_t i = 0; i < 200000; ++i) {
+            uint64_t key = (i % 3 == 0) ? rng() : 7000000 + i;
+            map.insert(key, i);
+            reference[key] = i;
+            saw_migration |= map.migrating();
+            
+            if (i % 4 == 0) {
+                uint64_t victim = 7000000 + (rng() % (i + 1));
+                REQUIRE(map.erase(victim) == (reference.erase(victim) == 1));
+            }
+        }
+        
+        REQUIRE(saw_migration);
+        REQUIRE(map.size() == reference.size());
+        for (const auto& [key, value] : reference) {
+            const uint32_t* found = map.find(key);
+            REQUIRE(found != nullptr);
+            REQUIRE(*found == value);
+        }
+        
+        size_t visited = 0;
+        map.for_each([&](uint64_t, uint32_t) { ++visited; });
+        REQUIRE(visited == reference.size());
+    }
+    
+    SECTION("for_each during a migration skips the drained prefix") {
+        // The drained prefix of the old table is unmapped 64 KiB at a time,
+        // so this needs an old table of thousands of buckets, well into its
+        // migration.
+        std::unordered_map<uint64_t, uint32_t> reference;
+        size_t steps_migrating = 0;
+        for (uint64_t key = 1; steps_migrating < 100 || map.size() < 10000; ++key) {
+            map.insert(key, static_cast<uint32_t>(key * 3));
+            reference[key] = static_cast<uint32_t>(key * 3);
+            steps_migrating = map.migrating() ? steps_migrating + 1 : 0;
+        }
+        REQUIRE(map.migrating());
+        
+        size_t visited = 0;
+        map.for_each([&](uint64_t key, uint32_t value) {
+            REQUIRE(reference.at(key) == value);
+            ++visited;
+        });
+        REQUIRE(visited == reference.size());
+    }
+    
+    SECTION("Probe runs that wrap through migrated buckets") {
+        // Keys whose home is the last buckets of the first 1024-bucket table
+        // (Fibonacci hashing, top 10 bits), enough that their run wraps past
+        // the first MIGRATE_STEP buckets.
+        auto home = [](uint64_t key) { return (key * UINT64_C(0x9E3779B97F4A7C15)) >> 54; };
+        std::vector<uint64_t> tail_keys;
+        std::vector<uint64_t> other_keys;
+        for (uint64_t key = 1; tail_keys.size() < 80 || other_keys.size() < 700; ++key) {
+            uint64_t h = home(key);
+            if (h >= 1020 && tail_keys.size() < 80) {
+                tail_keys.push_back(key);
+            } else if (h >= 200 && h < 900 && other_keys.size() < 700) {
+                other_keys.push_back(key);
+            }
+        }
+        for (uint64_t key : tail_keys) map.insert(key, 1);
+        
+        // Filling past the load limit starts a migration, and the insert
+        // that starts it drains the first 64 old buckets.
+        size_t i = 0;
+        while (!map.migrating()) {
+            map.insert(other_keys[i++], 2);
+        }
+        size_t expected = tail_keys.size() + i;
+        REQUIRE(map.size() == expected);
+        
+        // The last tail keys sit past the drained buckets, reached only by
+        // wrapping through them.
+        for (uint64_t key : tail_keys) {
+            REQUIRE(map.find(key) != nullptr);
+        }
+        REQUIRE(map.migrating());
+        uint64_t last = tail_keys.back();
+        map.insert(last, 3);
+        REQUIRE(map.size() == expected);
+        REQUIRE(*map.find(last) == 3);
+        REQUIRE(map.erase(last));
+        REQUIRE(map.find(last) == nullptr);
+        REQUIRE(map.size() == expected - 1);
+    }
+    
+    SECTION("Sentinel-valued keys") {
+        map.insert(0, 1);
+        map.insert(UINT64_MAX, 2);
+        REQUIRE(*map.find(0) == 1);
+        REQUIRE(*map.find(UINT64_MAX) == 2);
+        REQUIRE(map.size() == 2);
+        
+        REQUIRE(map.erase(0));
+        REQUIRE(map.find(0) == nullptr);
+        
+        map.clear();
+        REQUIRE(map.empty());
+    }
+}
+
+TEST_CASE("Streaming CSV Parser", "[parser]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    
+    auto feed = [&](const std::string& bytes) {
+        REQUIRE(write(fds[1], bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+    };
+    
+    SECTION("Records split across reads") {
+        // A 16-byte buffer forces every record to span several reads.
+        StreamingCSVParser parser(fds[0], false, 16);
+        feed("ts_event,action,side,price,size,order_id,flags,ts_recv,ts_in_delta,sequence\n");
+        feed("1000,A,B,100.25,50,42,130,1001,10,1\n2000,C,B,100.2");
+        
+        Event events[8];
+        REQUIRE(parser.parse_events(events, 8) == 1);
+        REQUIRE(events[0].timestamp_ns == 1000);
+        REQUIRE(events[0].action == 'A');
+        REQUIRE(events[0].price_raw == 10025);
+        REQUIRE(events[0].size == 50);
+        REQUIRE(events[0].order_id == 42);
+        REQUIRE(events[0].flags == 130);
+        REQUIRE(events[0].is_last_in_event());
+        
+        feed("5,50,42,130,2001,10,2\n3000,R,N,0,0,0,8,3001,10,3");
+        close(fds[1]);
+        
+        REQUIRE(parser.parse_events(events, 8) == 1);
+        REQUIRE(events[0].action == 'C');
+        REQUIRE(events[0].price_raw == 10025);
+        REQUIRE(events[0].order_id == 42);
+        
+        REQUIRE(parser.parse_events(events, 8) == 1);
+        REQUIRE(events[0].action == 'R');   // final record without a newline
+        REQUIRE(events[0].timestamp_ns == 3000);
+        REQUIRE_FALSE(events[0].is_last_in_event());
+        
+        REQUIRE(parser.parse_events(events, 8) == 0);
+    }
+    
+    SECTION("Buffered records are returned without waiting for more input") {
+        StreamingCSVParser parser(fds[0]);
+        feed("header\n1000,A,B,100.00,10,1,0,0,0,1\n2000,A,A,101.00,10,2,0,0,0,2\n");
+        
+        Event event;
+        REQUIRE(parser.parse_next_event(event));
+        REQUIRE(event.order_id == 1);
+        REQUIRE(parser.parse_next_event(event));
+        REQUIRE(event.order_id == 2);
+        
+        close(fds[1]);
+        REQUIRE_FALSE(parser.parse_next_event(event));
+    }
+    
+    SECTION("Records into a column block") {
+        StreamingCSVParser parser(fds[0], false, 16);
+        feed("header\n1000,A,B,100.25,50,42,130,0,0,1\n2000,M,A,99.5,7,43,0,0,0,2\n");
+        feed("3000,C,B,100.25,50,42,128,0,0,3\n");
+        close(fds[1]);
+        
+        auto block = std::make_unique<EventBlock>();
+        size_t parsed = 0;
+        size_t count;
+        while ((count = parser.parse_events(*block)) > 0) {
+            REQUIRE(block->count == count);
+            Event event = (*block)[0];
+            REQUIRE(event.timestamp_ns == 1000 * (parsed + 1));
+            parsed += count;
+            if (event.action == 'M') {
+                REQUIRE(block->sides[0] == 'A');
+                REQUIRE(block->prices[0] == 9950);
+                REQUIRE(block->sizes[0] == 7);
+                REQUIRE(block->order_ids[0] == 43);
+                REQUIRE(block->flags[0] == 0);
+            }
+        }
+        REQUIRE(parsed == 3);
+        REQUIRE(block->count == 0);
+    }
+    
+    close(fds[0]);
+}
+
+TEST_CASE("Record Filter", "[parser]") {
+    // 19-digit timestamps take the textual comparison, the short ones at
+    // the end are parsed; the last record has no newline.
+    std::string text = "ts_event,action,side,price,size,order_id,flags,ts_recv,ts_in_delta,sequence\n";
+    const char actions[] = {'A', 'C', 'T', 'F', 'M'};
+    std::vector<Event> all;
+    for (uint64_t i = 0; i < 40; ++i) {
+        uint64_t ts = i < 30 ? 1700000000000000000ULL + i * 1000 : 5000 + i;
+        char action = actions[i % 5];
+        text += std::to_string(ts) + "," + action + ",B,100.25,10," + std::to_string(i) + ",128,0,0," +
+                std::to_string(i) + (i < 39 ? "\n" : "");
+        all.emplace_back(ts, action, 'B', 10025, 10, i);
+    }
+    
+    char path[] = "/tmp/mbp_filter_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd != -1);
+    REQUIRE(write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+    close(fd);
+    
+    auto expected = [&](const RecordFilter& filter) {
+        std::vector<uint64_t> ids;
+        for (const Event& event : all) {
+            if (filter.keeps(event.timestamp_ns, event.action)) ids.push_back(event.order_id);
+        }
+        return ids;
+    };
+    
+    RecordFilter filters[] = {
+        RecordFilter().between(1700000000000005000ULL, 1700000000000012000ULL),
+        RecordFilter().only_actions("TF"),
+        RecordFilter().between(0, 1700000000000003000ULL).only_actions("AM"),
+        RecordFilter().between(5030, 5035),
+        RecordFilter().between(UINT64_MAX - 1, UINT64_MAX),
+    };
+    for (const RecordFilter& filter : filters) {
+        std::vector<uint64_t> want = expected(filter);
+        
+        FastCSVParser parser(path);
+        parser.set_filter(filter);
+        std::vector<uint64_t> got;
+        Event event;
+        while (parser.parse_next_event(event)) {
+            got.push_back(event.order_id);
+            REQUIRE(event.price_raw == 10025);
+        }
+        REQUIRE(got == want);
+        
+        FastCSVParser block_parser(path);
+        block_parser.set_filter(filter);
+        auto block = std::make_unique<EventBlock>();
+        got.clear();
+        while (block_parser.parse_events(*block) > 0) {
+            for (size_t i = 0; i < block->count; ++i) got.push_back(block->order_ids[i]);
+        }
+        REQUIRE(got == want);
+        
+        // A small buffer puts skipped rows across reads.
+        StreamingCSVParser stream(path, false, 32);
+        stream.set_filter(filter);
+        got.clear();
+        while (stream.parse_next_event(event)) {
+            got.push_back(event.order_id);
+        }
+        REQUIRE(got == want);
+    }
+    
+    REQUIRE(expected(filters[0]).size() == 8);
+    REQUIRE(expected(filters[3]).size() == 6);
+    REQUIRE(expected(filters[4]).empty());
+    REQUIRE_THROWS_AS(RecordFilter().between(5035, 5030), std::runtime_error);
+    
+    SECTION("stop_after ends the input at the first later record") {
+        // Records 0-10 are stamped up to the stop; 11 is past it. The short
+        // timestamps of 30-39 are earlier again but come after 11.
+        const uint64_t stop = 1700000000000010000ULL;
+        std::vector<uint64_t> want;
+        for (uint64_t i = 0; i <= 10; ++i) want.push_back(i);
+        
+        FastCSVParser parser(path);
+        parser.stop_after(stop);
+        std::vector<uint64_t> got;
+        Event event;
+        while (parser.parse_next_event(event)) {
+            got.push_back(event.order_id);
+        }
+        REQUIRE(got == want);
+        REQUIRE_FALSE(parser.parse_next_event(event));
+        
+        // With a filter as well, the stop still ends the input.
+        FastCSVParser block_parser(path);
+        block_parser.set_filter(RecordFilter().only_actions("AC"));
+        block_parser.stop_after(stop);
+        auto block = std::make_unique<EventBlock>();
+        got.clear();
+        while (block_parser.parse_events(*block) > 0) {
+            for (size_t i = 0; i < block->count; ++i) got.push_back(block->order_ids[i]);
+        }
+        REQUIRE(got == std::vector<uint64_t>{0, 1, 5, 6, 10});
+        
+        // A followed file would be waited on at its end; the stop returns
+        // before that.
+        StreamingCSVParser stream(path, true, 32);
+        stream.stop_after(stop);
+        got.clear();
+        while (stream.parse_next_event(event)) {
+            got.push_back(event.order_id);
+        }
+        REQUIRE(got == want);
+    }
+    unlink(path);
+}
+
+TEST_CASE("io_uring Backend", "[parser][io_uring]") {
+    char path[] = "/tmp/mbp_uring_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd != -1);
+    
+    std::unique_ptr<UringWriter> writer;
+    try {
+        writer = std::make_unique<UringWriter>(fd);
+    } catch (const std::runtime_error&) {
+        close(fd);
+        unlink(path);
+        WARN("io_uring unavailable, skipping");
+        return;
+    }
+    
+    // Enough records to span several read chunks, so some straddle a
+    // chunk boundary, written through the io_uring writer in small pieces.
+    const size_t records = 3 * UringCSVParser::READ_CHUNK_SIZE / 40;
+    writer->write("ts_event,action,side,price,size,order_id,flags,ts_recv,ts_in_delta,sequence\n");
+    for (size_t i = 0; i < records; ++i) {
+        writer->write(std::to_string(1000 + i) + ",A,B,100.25," + std::to_string(i % 500) + "," +
+                      std::to_string(i) + ",0,0,0," + std::to_string(i));
+        if (i + 1 < records) writer->write("\n");     // last record without a newline
+    }
+    writer->finish();
+    close(fd);
+    
+    FastCSVParser reference(path);
+    UringCSVParser parser(path);
+    Event expected, actual;
+    size_t parsed = 0;
+    while (reference.parse_next_event(expected)) {
+        REQUIRE(parser.parse_next_event(actual));
+        REQUIRE(actual.timestamp_ns == expected.timestamp_ns);
+        REQUIRE(actual.size == expected.size);
+        REQUIRE(actual.order_id == expected.order_id);
+        ++parsed;
+    }
+    REQUIRE_FALSE(parser.parse_next_event(actual));
+    REQUIRE(parsed == records);
+    
+    unlink(path);
+    
+    // A write that cannot make progress ends in an error, not a retry loop.
+    int full = open("/dev/full", O_WRONLY);
+    if (full != -1) {
+        UringWriter stuck(full);
+        stuck.write("no room\n");
+        REQUIRE_THROWS_AS(stuck.finish(), std::runtime_error);
+        close(full);
+    }
+}
+
+TEST_CASE("Compressed Input", "[parser][compressed]") {
+    std::string csv = "ts_event,action,side,price,size,order_id,flags,ts_recv,ts_in_delta,sequence\n";
+    for (int i = 0; i < 20000; ++i) {
+        csv += std::to_string(1000 + i) + ",A,B,100.25," + std::to_string(i % 500 + 1) + "," +
+               std::to_string(i) + ",0,0,0," + std::to_string(i) + "\n";
+    }
+    
+    char path[] = "/tmp/mbp_compressed_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd != -1);
+    
+    auto check_events = [&](auto& parser) {
+        Event event;
+        for (int i = 0; i < 20000; ++i) {
+            REQUIRE(parser.parse_next_event(event));
+            REQUIRE(event.timestamp_ns == static_cast<uint64_t>(1000 + i));
+            REQUIRE(event.order_id == static_cast<uint64_t>(i));
+        }
+        REQUIRE_FALSE(parser.parse_next_event(event));
+    };
+    
+    SECTION("Concatenated gzip members") {
+        // Split mid-record, so one record spans the two members.
+        size_t split = csv.size() / 2 + 7;
+        for (const std::string& part : {csv.substr(0, split), csv.substr(split)}) {
+            gzFile gz = gzdopen(dup(fd), "ab");
+            REQUIRE(gz != nullptr);
+            REQUIRE(gzwrite(gz, part.data(), static_cast<unsigned>(part.size())) == static_cast<int>(part.size()));
+            gzclose(gz);
+        }
+        
+        REQUIRE(detect_compression(path) == Compression::Gzip);
+        BasicStreamingCSVParser<GzipSource> parser{GzipSource(FdSource(path))};
+        check_events(parser);
+    }
+    
+#ifdef MBP_HAVE_ZSTD
+    SECTION("Multi-frame zstd") {
+        const size_t frame_size = 64 * 1024;
+        std::vector<char> frame(ZSTD_compressBound(frame_size));
+        for (size_t pos = 0; pos < csv.size(); pos += frame_size) {
+            size_t n = std::min(frame_size, csv.size() - pos);
+            size_t written = ZSTD_compress(frame.data(), frame.size(), csv.data() + pos, n, 1);
+            REQUIRE_FALSE(ZSTD_isError(written));
+            REQUIRE(write(fd, frame.data(), written) == static_cast<ssize_t>(written));
+        }
+        
+        REQUIRE(detect_compression(path) == Compression::Zstd);
+        for (bool parallel : {true, false}) {
+            BasicStreamingCSVParser<ZstdSource> parser{ZstdSource(FdSource(path), parallel)};
+            check_events(parser);
+        }
+    }
+#endif
+    
+    close(fd);
+    unlink(path);
+}
+
+TEST_CASE("Compressed Output", "[compressed]") {
+    std::vector<OutputCodec> codecs = {OutputCodec::Gzip};
+#ifdef MBP_HAVE_ZSTD
+    codecs.push_back(OutputCodec::Zstd);
+#endif
+    
+    for (OutputCodec codec : codecs) {
+        char path[] = "/tmp/mbp_output_XXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE(fd != -1);
+        
+        // Flushing every few rows produces many small frames, which the
+        // threads may finish out of order; the file must still be in order.
+        std::string written;
+        {
+            CompressedWriter writer(fd, codec, 1, 3);
+            for (int i = 0; i < 5000; ++i) {
+                std::string row = std::to_string(i) + ",100.25,50,100.50,75\n";
+                writer.write(row);
+                written += row;
+                if (i % 37 == 0) writer.flush();
+            }
+            writer.finish();
+        }
+        close(fd);
+        
+        std::string decoded(written.size() + 1, '\0');
+        size_t total = 0, n = 0;
+        auto read_all = [&](auto source) {
+            while ((n = source.read(decoded.data() + total, decoded.size() - total)) > 0) {
+                total += n;
+            }
+        };
+        if (codec == OutputCodec::Gzip) {
+            read_all(GzipSource(FdSource(path)));
+        }
+#ifdef MBP_HAVE_ZSTD
+        else {
+            read_all(ZstdSource(FdSource(path)));
+        }
+#endif
+        decoded.resize(total);
+        REQUIRE(decoded == written);
+        
+        unlink(path);
+    }
+}
+
+TEST_CASE("Shared Memory Feed", "[shm]") {
+    const std::string name = "/mbp_test_feed_" + std::to_string(getpid());
+    ShmPublisher publisher(name.c_str(), 8);
+    ShmSubscriber subscriber(name.c_str());
+    
+    MBPSnapshot snapshot, received;
+    REQUIRE(subscriber.read_next(received) == ShmSubscriber::ReadResult::Empty);
+    REQUIRE_FALSE(subscriber.read_latest(received));
+    
+    auto publish = [&](uint64_t ts) {
+        snapshot.timestamp_ns = ts;
+        snapshot.bid_px[0] = static_cast<int64_t>(ts * 100);
+        publisher.publish(snapshot);
+    };
+    
+    SECTION("Snapshots arrive in order") {
+        for (uint64_t ts = 1; ts <= 3; ++ts) publish(ts);
+        for (uint64_t ts = 1; ts <= 3; ++ts) {
+            REQUIRE(subscriber.read_next(received) == ShmSubscriber::ReadResult::Ok);
+            REQUIRE(received.timestamp_ns == ts);
+            REQUIRE(received.bid_px[0] == static_cast<int64_t>(ts * 100));
+        }
+        REQUIRE(subscriber.read_next(received) == ShmSubscriber::ReadResult::Empty);
+    }
+    
+    SECTION("A lapped reader resyncs to the oldest kept snapshot") {
+        for (uint64_t ts = 1; ts <= 20; ++ts) publish(ts);
+        
+        REQUIRE(subscriber.read_next(received) == ShmSubscriber::ReadResult::Overrun);
+        REQUIRE(received.timestamp_ns > 12);
+        uint64_t last = received.timestamp_ns;
+        while (subscriber.read_next(received) == ShmSubscriber::ReadResult::Ok) {
+            REQUIRE(received.timestamp_ns == ++last);
+        }
+        REQUIRE(last == 20);
+        
+        REQUIRE(subscriber.read_latest(received));
+        REQUIRE(received.timestamp_ns == 20);
+        REQUIRE(subscriber.published() == 20);
+    }
+    
+    SECTION("A new publisher leaves readers of the old segment mapped") {
+        for (uint64_t ts = 1; ts <= 3; ++ts) publish(ts);
+        
+        ShmPublisher restarted(name.c_str(), 8);
+        REQUIRE(subscriber.read_latest(received));      // no SIGBUS
+        REQUIRE(received.timestamp_ns == 3);
+        
+        ShmSubscriber fresh(name.c_str());
+        REQUIRE(fresh.published() == 0);
+        REQUIRE(fresh.read_next(received) == ShmSubscriber::ReadResult::Empty);
+    }
+}
+
+TEST_CASE("Book Reconstructor Callbacks", "[reconstructor]") {
+    struct Recorder : BookListener {
+        std::vector<MBPSnapshot> snapshots;
+        std::vector<uint32_t> masks;
+        std::vector<TradeInfo> trades;
+        
+        void on_book_change(const MBPSnapshot& snapshot, uint32_t changed_mask) override {
+            snapshots.push_back(snapshot);
+            masks.push_back(changed_mask);
+        }
+        
+        void on_trade(const TradeInfo& trade) override {
+            trades.push_back(trade);
+        }
+    };
+    
+    Recorder recorder;
+    BookReconstructor reconstructor(recorder);
+    
+    reconstructor.on_event(Event(1000, 'A', 'B', 10000, 100, 1));
+    REQUIRE(recorder.snapshots.size() == 1);
+    REQUIRE(recorder.masks[0] == ALL_LEVELS_MASK);
+    
+    SECTION("The mask names the levels that changed") {
+        reconstructor.on_event(Event(2000, 'A', 'B', 10100, 50, 2));
+        REQUIRE(recorder.masks.back() == (bid_level_bit(0) | bid_level_bit(1)));
+        REQUIRE(recorder.snapshots.back().bid_px[0] == 10100);
+        
+        reconstructor.on_event(Event(3000, 'A', 'A', 10200, 70, 3));
+        REQUIRE(recorder.masks.back() == ask_level_bit(0));
+        REQUIRE(recorder.snapshots.back().timestamp_ns == 3000);
+    }
+    
+    SECTION("Changes below the top 10 are not reported") {
+        for (uint64_t i = 0; i < 10; ++i) {
+            reconstructor.on_event(Event(2000 + i, 'A', 'B', 10100 + i, 10, 10 + i));
+        }
+        size_t reported = recorder.snapshots.size();
+        
+        reconstructor.on_event(Event(3000, 'A', 'B', 9000, 10, 100));
+        REQUIRE(recorder.snapshots.size() == reported);
+        REQUIRE(reconstructor.snapshot_manager().get_snapshots_skipped() == 1);
+    }
+    
+    SECTION("A T+F+C sequence reports the trade before the book change") {
+        reconstructor.on_event(Event(2000, 'A', 'A', 10100, 200, 2));
+        size_t reported = recorder.snapshots.size();
+        
+        Event events[] = {
+            Event(3000, 'T', 'B', 10100, 80, 9),
+            Event(3000, 'F', 'B', 10100, 80, 9),
+            Event(3000, 'C', 'B', 10100, 0, 9),
+        };
+        reconstructor.on_events(events, 3);
+        
+        REQUIRE(recorder.trades.size() == 1);
+        REQUIRE(recorder.trades[0].price_raw == 10100);
+        REQUIRE(recorder.trades[0].size == 80);
+        REQUIRE(recorder.trades[0].side == 'B');
+        REQUIRE(recorder.trades[0].orders_filled == 1);
+        REQUIRE(recorder.snapshots.size() == reported + 1);
+        REQUIRE(recorder.masks.back() == ask_level_bit(0));
+        REQUIRE(recorder.snapshots.back().ask_sz[0] == 120);
+        REQUIRE(reconstructor.events_processed() == 5);
+    }
+    
+    SECTION("Conflation reports an exchange event once, after its last record") {
+        reconstructor.conflate_events(true);
+        size_t reported = recorder.snapshots.size();
+        
+        reconstructor.on_event(Event(2000, 'C', 'B', 10000, 100, 1, 0));
+        reconstructor.on_event(Event(2000, 'A', 'B', 10100, 60, 2, 0));
+        REQUIRE(recorder.snapshots.size() == reported);
+        
+        reconstructor.on_event(Event(2000, 'A', 'A', 10200, 70, 3, F_LAST));
+        REQUIRE(recorder.snapshots.size() == reported + 1);
+        REQUIRE(recorder.masks.back() == (bid_level_bit(0) | ask_level_bit(0)));
+        REQUIRE(recorder.snapshots.back().bid_px[0] == 10100);
+        REQUIRE(reconstructor.records_conflated() == 2);
+        REQUIRE(recorder.snapshots.back().timestamp_ns == 2000);
+        
+        // The snapshot carries the closing record's time, even when that
+        // record leaves the book alone.
+        reconstructor.on_event(Event(2500, 'C', 'B', 10100, 60, 2, 0));
+        reconstructor.on_event(Event(2600, 'T', 'N', 10100, 5, 0, F_LAST));
+        REQUIRE(recorder.snapshots.size() == reported + 2);
+        REQUIRE(recorder.snapshots.back().timestamp_ns == 2600);
+        REQUIRE(recorder.snapshots.back().bid_px[0] == 0);
+        
+        // An event cut off before its last record is reported by finish().
+        reconstructor.on_event(Event(3000, 'C', 'A', 10200, 70, 3, 0));
+        REQUIRE(recorder.snapshots.size() == reported + 2);
+        reconstructor.finish();
+        REQUIRE(recorder.snapshots.size() == reported + 3);
+        REQUIRE(recorder.snapshots.back().timestamp_ns == 3000);
+        REQUIRE(recorder.snapshots.back().ask_px[0] == 0);
+    }
+    
+    SECTION("Column blocks apply like the same events in rows") {
+        // Random records over a few hundred ids, stray ones included, so
+        // adds, cancels, modifies, trades and errors all occur.
+        std::mt19937_64 rng(17);
+        const char actions[] = {'A', 'A', 'A', 'C', 'C', 'M', 'T', 'F', 'N'};
+        std::vector<Event> events;
+        for (size_t i = 0; i < 2 * EventBlock::CAPACITY + 123; ++i) {
+            uint64_t id = 1 + rng() % 300;
+            char action = actions[rng() % sizeof(actions)];
+            char side = action == 'N' || rng() % 50 == 0 ? 'N' : (id % 2 ? 'B' : 'A');
+            int64_t price = side == 'B' ? 9990 - static_cast<int64_t>(rng() % 20)
+                                        : 10010 + static_cast<int64_t>(rng() % 20);
+            events.emplace_back(5000 + i, action, side, price, 1 + rng() % 100, id);
+        }
+        
+        Recorder rows;
+        BookReconstructor by_rows(rows);
+        Recorder columns;
+        BookReconstructor by_columns(columns);
+        auto block = std::make_unique<EventBlock>();
+        for (size_t base = 0; base < events.size(); base += EventBlock::CAPACITY) {
+            size_t count = std::min(EventBlock::CAPACITY, events.size() - base);
+            by_rows.on_events(events.data() + base, count);
+            block->count = 0;
+            for (size_t i = 0; i < count; ++i) {
+                block->push_back(events[base + i]);
+            }
+            by_columns.on_events(*block);
+        }
+        
+        REQUIRE(by_columns.events_processed() == events.size());
+        REQUIRE(columns.snapshots.size() == rows.snapshots.size());
+        REQUIRE(columns.masks == rows.masks);
+        REQUIRE(columns.trades.size() == rows.trades.size());
+        for (size_t i = 0; i < rows.snapshots.size(); ++i) {
+            const MBPSnapshot& a = columns.snapshots[i];
+            const MBPSnapshot& b = rows.snapshots[i];
+            REQUIRE(a.timestamp_ns == b.timestamp_ns);
+            for (int level = 0; level < 10; ++level) {
+                REQUIRE(a.bid_px[level] == b.bid_px[level]);
+                REQUIRE(a.bid_sz[level] == b.bid_sz[level]);
+                REQUIRE(a.ask_px[level] == b.ask_px[level]);
+                REQUIRE(a.ask_sz[level] == b.ask_sz[level]);
+            }
+        }
+        REQUIRE(by_columns.action_engine().get_errors_encountered() ==
+                by_rows.action_engine().get_errors_encountered());
+    }
+}
+
+TEST_CASE("Order Counts and Derived Fields", "[snapshot]") {
+    SECTION("Counts are snapshotted and a count-only change is reported when compared") {
+        for (bool counts : {false, true}) {
+            OrderBook book;
+            SnapshotManager manager;
+            manager.compare_order_counts(counts);
+            REQUIRE(book.add_order(1, 10000, 100, 'B', 1000));
+            REQUIRE(book.add_order(2, 10100, 40, 'A', 1000));
+            REQUIRE(book.add_order(3, 10100, 60, 'A', 1000));
+            REQUIRE(manager.update(book, 1000) == ALL_LEVELS_MASK);
+            REQUIRE(manager.get_current_snapshot().bid_ct[0] == 1);
+            REQUIRE(manager.get_current_snapshot().ask_ct[0] == 2);
+            
+            // Same size at the bid, now from two orders: only a change
+            // when counts are compared.
+            REQUIRE(book.modify_order(1, 10000, 50));
+            REQUIRE(book.add_order(4, 10000, 50, 'B', 2000));
+            REQUIRE(manager.update(book, 2000) == (counts ? bid_level_bit(0) : 0u));
+            REQUIRE(manager.get_snapshots_skipped() == (counts ? 0u : 1u));
+            REQUIRE(manager.get_current_snapshot().bid_sz[0] == 100);
+            REQUIRE(manager.get_current_snapshot().bid_ct[0] == 2);
+        }
+    }
+    
+    SECTION("Derived fields follow the book") {
+        struct Recorder : BookListener {
+            const BookReconstructor* reconstructor = nullptr;
+            std::vector<DerivedFields> fields;
+            
+            void on_book_change(const MBPSnapshot&, uint32_t) override {
+                fields.push_back(*reconstructor->snapshot_manager().derived_fields());
+            }
+        };
+        
+        Recorder recorder;
+        BookReconstructor reconstructor(recorder);
+        recorder.reconstructor = &reconstructor;
+        reconstructor.enable_derived_fields(2);
+        
+        reconstructor.on_event(Event(1000, 'A', 'B', 10000, 100, 1));
+        REQUIRE_FALSE(recorder.fields.back().two_sided);
+        
+        reconstructor.on_event(Event(2000, 'A', 'A', 10010, 300, 2));
+        DerivedFields fields = recorder.fields.back();
+        REQUIRE(fields.two_sided);
+        REQUIRE(fields.spread_raw == 10);
+        REQUIRE(fields.mid == Approx(100.05));
+        REQUIRE(fields.microprice == Approx(100.025));
+        REQUIRE(fields.imbalance == Approx(-0.5));
+        
+        reconstructor.on_event(Event(3000, 'A', 'B', 9990, 200, 3));
+        REQUIRE(recorder.fields.back().imbalance == Approx(0.0));
+        REQUIRE(recorder.fields.back().mid == Approx(100.05));
+        
+        // Below the imbalance depth.
+        reconstructor.on_event(Event(4000, 'A', 'B', 9980, 500, 4));
+        REQUIRE(recorder.fields.back().imbalance == Approx(0.0));
+        
+        // The third level moves up into the depth.
+        reconstructor.on_event(Event(5000, 'C', 'B', 10000, 100, 1));
+        fields = recorder.fields.back();
+        REQUIRE(fields.imbalance == Approx((700.0 - 300.0) / 1000.0));
+        REQUIRE(fields.spread_raw == 20);
+        REQUIRE(fields.mid == Approx(100.0));
+        REQUIRE(fields.microprice == Approx((99.90 * 300 + 100.10 * 200) / 500.0));
+        
+        reconstructor.on_event(Event(6000, 'C', 'A', 10010, 300, 2));
+        REQUIRE_FALSE(recorder.fields.back().two_sided);
+        REQUIRE(recorder.fields.back().imbalance == Approx(1.0));
+    }
+    
+    SECTION("Formatter columns match the header") {
+        MBPSnapshot snapshot;
+        snapshot.timestamp_ns = 1000;
+        snapshot.bid_px[0] = 10000;
+        snapshot.bid_sz[0] = 100;
+        snapshot.bid_ct[0] = 3;
+        snapshot.ask_px[0] = 10010;
+        snapshot.ask_sz[0] = 300;
+        snapshot.ask_ct[0] = 1;
+        
+        DerivedFields derived;
+        derived.two_sided = true;
+        derived.spread_raw = 10;
+        derived.mid = 100.05;
+        derived.microprice = 100.025;
+        derived.imbalance = -0.5;
+        
+        auto columns = [](const std::string& line) {
+            return std::count(line.begin(), line.end(), ',') + 1;
+        };
+        
+        MBPFormatter plain;
+        REQUIRE(plain.format_snapshot(snapshot).rfind("1000,100,100,,,", 0) == 0);
+        REQUIRE(columns(plain.format_snapshot(snapshot)) == columns(CSVHeader::generate_mbp_header()));
+        
+        MBPFormatter counted(true);
+        std::string row = counted.format_snapshot(snapshot, &derived);
+        REQUIRE(columns(row) == columns(CSVHeader::generate_mbp_header(true, true)));
+        REQUIRE(row.rfind("1000,100,100,3,,,", 0) == 0);
+        REQUIRE(row.find(",100.10,300,1,") != std::string::npos);
+        REQUIRE(row.ends_with(",100.050,100.0250,0.10,-0.5000\n"));
+        
+        derived.two_sided = false;
+        row = counted.format_snapshot(snapshot, &derived);
+        REQUIRE(row.ends_with(",,,,-0.5000\n"));
+    }
+}
+
+TEST_CASE("Book Images", "[orderbook][l3]") {
+    OrderBook book;
+    std::mt19937_64 rng(5);
+    for (uint64_t id = 1; id <= 5000; ++id) {
+        char side = id % 2 ? 'B' : 'A';
+        int64_t price = 10000 + (side == 'B' ? -1 : 1) * static_cast<int64_t>(1 + rng() % 20);
+        REQUIRE(book.add_order(id, price, 1 + rng() % 100, side, id));
+    }
+    
+    // Every level's price, then its queue as (order id, size) pairs.
+    auto walk = [](const BookImage& image) {
+        std::vector<std::pair<uint64_t, uint64_t>> queues;
+        for (const auto* side : {&image.bids, &image.asks}) {
+            for (const Level& level : *side) {
+                queues.emplace_back(level.price_raw, level.order_count);
+                for (OrderIndex idx = level.first_order; idx != NULL_ORDER;
+                     idx = image.orders[idx].next) {
+                    queues.emplace_back(image.orders.info(idx).order_id, image.orders[idx].size);
+                }
+            }
+        }
+        return queues;
+    };
+    auto change = [&](uint64_t first_id) {
+        for (uint64_t id = first_id; id < first_id + 2000; ++id) {
+            book.cancel_order(1 + rng() % 5000);
+            book.modify_order(1 + rng() % 5000, 10000 - 1, 1 + rng() % 100);
+            REQUIRE(book.add_order(id, 10000 + 1 + static_cast<int64_t>(rng() % 20), 10, 'A', id));
+        }
+        book.execute_trade(10000 - 1, 500, 'A');
+    };
+    
+    BookImage first;
+    book.copy_image(first);
+    auto first_queues = walk(first);
+    
+    // The book's writes go to chunks of its own, not the ones the image
+    // shares, and a later image of the same book shares them again.
+    change(10000);
+    REQUIRE(walk(first) == first_queues);
+    
+    BookImage second;
+    book.copy_image(second);
+    auto second_queues = walk(second);
+    REQUIRE(second_queues != first_queues);
+    
+    change(20000);
+    book.clear();
+    REQUIRE(book.add_order(1, 9000, 10, 'B', 1));
+    REQUIRE(walk(first) == first_queues);
+    REQUIRE(walk(second) == second_queues);
+    
+    // Reusing an image drops what it shared before.
+    book.copy_image(first);
+    REQUIRE(first.bids.size() == 1);
+    REQUIRE(first.bids[0].order_count == 1);
+    REQUIRE(first.orders.info(first.bids[0].first_order).order_id == 1);
+    REQUIRE(walk(second) == second_queues);
+}
+
+TEST_CASE("L3 Book Dumps", "[l3]") {
+    const std::string path = "/tmp/mbp_test_l3_" + std::to_string(getpid()) + ".bin";
+    
+    OrderBook book;
+    REQUIRE(book.add_order(1, 10000, 100, 'B', 1000));
+    REQUIRE(book.add_order(2, 10000, 50, 'B', 2000));
+    REQUIRE(book.add_order(3, 9900, 70, 'B', 3000));
+    REQUIRE(book.add_order(4, 10100, 30, 'A', 4000));
+    REQUIRE(book.add_order(5, 10000, 20, 'B', 5000));
+    
+    {
+        L3Dumper dumper(path.c_str());
+        dumper.dump(book, 6000);
+        
+        // Changes after dump() returns must not reach the dump in flight.
+        REQUIRE(book.cancel_order(2));
+        REQUIRE(book.execute_trade(10100, 10, 'B'));
+        dumper.dump(book, 7000);
+        dumper.finish();
+        REQUIRE(dumper.dumps_written() == 2);
+    }
+    
+    L3DumpReader reader(path.c_str());
+    L3DumpReader::Dump dump;
+    
+    REQUIRE(reader.next(dump));
+    REQUIRE(dump.timestamp_ns == 6000);
+    REQUIRE(dump.bids.size() == 2);
+    REQUIRE(dump.bids[0].price_raw == 10000);
+    REQUIRE(dump.bids[0].orders.size() == 3);
+    REQUIRE(dump.bids[0].orders[0].order_id == 1);
+    REQUIRE(dump.bids[0].orders[1].order_id == 2);
+    REQUIRE(dump.bids[0].orders[2].order_id == 5);
+    REQUIRE(dump.bids[0].orders[2].timestamp_ns == 5000);
+    REQUIRE(dump.bids[1].price_raw == 9900);
+    REQUIRE(dump.asks.size() == 1);
+    REQUIRE(dump.asks[0].orders[0].size == 30);
+    
+    REQUIRE(reader.next(dump));
+    REQUIRE(dump.timestamp_ns == 7000);
+    REQUIRE(dump.bids[0].orders.size() == 2);
+    REQUIRE(dump.bids[0].orders[1].order_id == 5);
+    REQUIRE(dump.asks[0].orders[0].size == 20);
+    
+    REQUIRE_FALSE(reader.next(dump));
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Book Reconstructor Checkpoints", "[reconstructor][l3]") {
+    struct Checkpoints : BookListener {
+        std::vector<std::pair<uint64_t, size_t>> seen;   // time, resting orders
+        
+        uint64_t on_checkpoint(uint64_t time, const OrderBook& book, uint64_t /*next_event_ts*/) override {
+            seen.emplace_back(time, book.get_active_orders());
+            return time == 150 ? 160 : NO_CHECKPOINT;
+        }
+    };
+    
+    Checkpoints listener;
+    BookReconstructor reconstructor(listener);
+    reconstructor.set_checkpoint(150);
+    
+    reconstructor.on_event(Event(100, 'A', 'B', 10000, 10, 1));
+    reconstructor.on_event(Event(150, 'A', 'B', 10000, 10, 2));
+    REQUIRE(listener.seen.empty());   // 150 is not past yet
+    
+    // Both checkpoints fall before this event and see the book without it.
+    reconstructor.on_event(Event(200, 'A', 'B', 10000, 10, 3));
+    REQUIRE(listener.seen.size() == 2);
+    REQUIRE(listener.seen[0] == std::make_pair<uint64_t, size_t>(150, 2));
+    REQUIRE(listener.seen[1] == std::make_pair<uint64_t, size_t>(160, 2));
+    
+    reconstructor.on_event(Event(300, 'A', 'B', 10000, 10, 4));
+    REQUIRE(listener.seen.size() == 2);
+}
+
+TEST_CASE("Book Reconstructor Sampling", "[reconstructor]") {
+    struct Samples : BookListener {
+        std::vector<MBPSnapshot> snapshots;
+        std::vector<uint32_t> masks;
+        
+        void on_book_change(const MBPSnapshot& snapshot, uint32_t changed_mask) override {
+            snapshots.push_back(snapshot);
+            masks.push_back(changed_mask);
+        }
+    };
+    
+    Samples listener;
+    BookReconstructor reconstructor(listener);
+    reconstructor.sample_every(100);
+    
+    reconstructor.on_event(Event(150, 'A', 'B', 10000, 10, 1));
+    reconstructor.on_event(Event(200, 'A', 'B', 10000, 20, 2));
+    REQUIRE(listener.snapshots.empty());
+    
+    // 200 is the first boundary; the book as of it includes the event at 200.
+    reconstructor.on_event(Event(210, 'C', 'B', 10000, 20, 2));
+    REQUIRE(listener.snapshots.size() == 1);
+    REQUIRE(listener.snapshots[0].timestamp_ns == 200);
+    REQUIRE(listener.snapshots[0].bid_sz[0] == 30);
+    REQUIRE(listener.masks[0] == ALL_LEVELS_MASK);
+    
+    reconstructor.on_event(Event(450, 'A', 'A', 10100, 5, 3));
+    REQUIRE(listener.snapshots.size() == 3);
+    REQUIRE(listener.snapshots[1].timestamp_ns == 300);
+    REQUIRE(listener.snapshots[1].bid_sz[0] == 10);
+    REQUIRE(listener.masks[1] == bid_level_bit(0));
+    REQUIRE(listener.snapshots[2].timestamp_ns == 400);
+    REQUIRE(listener.masks[2] == 0);   // quiet interval
+    
+    reconstructor.finish();
+    REQUIRE(listener.snapshots.size() == 4);
+    REQUIRE(listener.snapshots[3].timestamp_ns == 500);
+    REQUIRE(listener.snapshots[3].ask_px[0] == 10100);
+    REQUIRE(listener.masks[3] == ask_level_bit(0));
+}
+
+TEST_CASE("Time Bars", "[bars]") {
+    BarBuilder bars(100);
+    
+    auto quote = [](uint64_t ts, int64_t bid, int64_t ask) {
+        MBPSnapshot snapshot;
+        snapshot.timestamp_ns = ts;
+        snapshot.bid_px[0] = bid;
+        snapshot.bid_sz[0] = bid ? 10 : 0;
+        snapshot.ask_px[0] = ask;
+        snapshot.ask_sz[0] = ask ? 10 : 0;
+        return snapshot;
+    };
+    
+    REQUIRE(bars.on_quote(quote(120, 10000, 10010)) == nullptr);
+    REQUIRE(bars.on_trade(TradeInfo(130, 1, 10010, 30, 'B')) == nullptr);
+    REQUIRE(bars.on_trade(TradeInfo(140, 2, 10000, 10, 'A')) == nullptr);
+    REQUIRE(bars.on_quote(quote(160, 10000, 10030)) == nullptr);
+    REQUIRE(bars.on_trade(TradeInfo(170, 3, 10020, 20, 'B')) == nullptr);
+    
+    // A quiet interval in between produces no bar.
+    const Bar* bar = bars.on_trade(TradeInfo(350, 4, 10030, 5, 'B'));
+    REQUIRE(bar != nullptr);
+    REQUIRE(bar->start_ns == 100);
+    REQUIRE(bar->trades == 3);
+    REQUIRE(bar->open_raw == 10010);
+    REQUIRE(bar->high_raw == 10020);
+    REQUIRE(bar->low_raw == 10000);
+    REQUIRE(bar->close_raw == 10020);
+    REQUIRE(bar->volume == 60);
+    REQUIRE(bar->vwap == Approx((100.10 * 30 + 100.00 * 10 + 100.20 * 20) / 60));
+    REQUIRE(bar->two_sided_close);
+    REQUIRE(bar->mid_close == Approx(100.15));
+    REQUIRE(bar->spread_min_raw == 10);
+    REQUIRE(bar->spread_max_raw == 30);
+    REQUIRE(bar->spread_avg_raw == Approx((10.0 * 40 + 30.0 * 40) / 80));
+    
+    BarFormatter formatter;
+    REQUIRE(formatter.format_bar(*bar) == "100,100.10,100.20,100,100.20,60,3,100.1167,100.150,0.2000,0.10,0.30\n");
+    
+    // The quote carries over into the later bar.
+    bar = bars.finish();
+    REQUIRE(bar != nullptr);
+    REQUIRE(bar->start_ns == 300);
+    REQUIRE(bar->trades == 1);
+    REQUIRE(bar->spread_avg_raw == Approx(30.0));
+    REQUIRE(bars.finish() == nullptr);
+    
+    // An out-of-order quote is applied but does not rewind the clock, so
+    // no stretch is credited twice: 10 over [110, 150), 20 over [150, 200).
+    BarBuilder late(100);
+    late.on_quote(quote(110, 10000, 10010));
+    late.on_quote(quote(150, 10000, 10030));
+    late.on_quote(quote(130, 10000, 10020));
+    bar = late.finish();
+    REQUIRE(bar != nullptr);
+    REQUIRE(bar->spread_avg_raw == Approx((10.0 * 40 + 20.0 * 50) / 90));
+    REQUIRE(bar->mid_close == Approx(100.10));
+}
+
+TEST_CASE("Feature Vectors", "[features]") {
+    SECTION("Side sums match the scalar reference at every depth") {
+        // The test build has no -march, so side_depth() is the scalar loop
+        // here; the AVX2 kernel is called directly when the CPU has it.
+#ifdef __x86_64__
+        const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+        std::mt19937_64 rng(3);
+        for (int round = 0; round < 200; ++round) {
+            MBPSnapshot snapshot;
+            int levels = static_cast<int>(rng() % 11);
+            for (int i = 0; i < levels; ++i) {
+                snapshot.bid_px[i] = 100000 - i * 5;
+                snapshot.bid_sz[i] = 1 + rng() % 100000;
+            }
+            for (int depth = 1; depth <= 10; ++depth) {
+                SideDepth reference = side_depth_scalar(snapshot.bid_px, snapshot.bid_sz, depth);
+                std::vector<SideDepth> paths{side_depth(snapshot.bid_px, snapshot.bid_sz, depth)};
+#ifdef __x86_64__
+                if (avx2) {
+                    paths.push_back(side_depth_avx2(snapshot.bid_px, snapshot.bid_sz, depth));
+                }
+#endif
+                for (const SideDepth& fast : paths) {
+                    REQUIRE(fast.size == reference.size);
+                    REQUIRE(fast.levels == reference.levels);
+                    REQUIRE(fast.notional_raw == Approx(reference.notional_raw));
+                }
+            }
+        }
+    }
+    
+    SECTION("Feature values") {
+        FeatureComputer features(FeatureConfig{ALL_FEATURES, 2});
+        REQUIRE(features.column_names() == std::vector<std::string>{
+            "imbalance", "weighted_mid", "bid_slope", "ask_slope", "bid_depletion", "ask_depletion"});
+        
+        MBPSnapshot snapshot;
+        snapshot.bid_px[0] = 10000; snapshot.bid_sz[0] = 100;
+        snapshot.bid_px[1] = 9990;  snapshot.bid_sz[1] = 300;
+        snapshot.bid_px[2] = 9980;  snapshot.bid_sz[2] = 999;   // below the depth
+        snapshot.ask_px[0] = 10010; snapshot.ask_sz[0] = 200;
+        
+        const double* v = features.update(snapshot, ALL_LEVELS_MASK);
+        double bid_px = (100.00 * 100 + 99.90 * 300) / 400;
+        REQUIRE(v[0] == Approx((400.0 - 200.0) / 600.0));
+        REQUIRE(v[1] == Approx((bid_px * 200 + 100.10 * 400) / 600));
+        REQUIRE(v[2] == Approx(400 / 0.10));
+        REQUIRE(std::isnan(v[3]));   // a single ask level
+        REQUIRE(std::isnan(v[4]));   // no previous snapshot
+        REQUIRE(std::isnan(v[5]));
+        
+        // 60 traded off the bid touch; the ask touch is lifted away entirely.
+        MBPSnapshot next = snapshot;
+        next.bid_sz[0] = 40;
+        next.ask_px[0] = 10020;
+        next.ask_sz[0] = 50;
+        v = features.update(next, next.changed_levels(snapshot));
+        REQUIRE(v[4] == Approx(60.0));
+        REQUIRE(v[5] == Approx(200.0));
+        
+        // A change below the depth leaves the sums alone.
+        MBPSnapshot deeper = next;
+        deeper.bid_sz[2] = 5;
+        v = features.update(deeper, deeper.changed_levels(next));
+        REQUIRE(v[0] == Approx((340.0 - 50.0) / 390.0));
+        REQUIRE(v[4] == 0.0);
+    }
+    
+    SECTION("Columns are written as raw arrays") {
+        const std::string dir = "/tmp/mbp_test_features_" + std::to_string(getpid());
+        {
+            FeatureWriter writer(dir, {"a", "b"});
+            for (uint64_t row = 0; row < 70000; ++row) {
+                double values[] = {static_cast<double>(row), -static_cast<double>(row)};
+                writer.append(1000 + row, values);
+            }
+            writer.finish();
+            REQUIRE(writer.rows() == 70000);
+        }
+        
+        auto read_file = [&](const std::string& name) {
+            std::ifstream in(dir + "/" + name, std::ios::binary);
+            return std::string(std::istreambuf_iterator<char>(in), {});
+        };
+        std::string ts = read_file("ts_event.u64");
+        std::string b = read_file("b.f64");
+        REQUIRE(ts.size() == 70000 * sizeof(uint64_t));
+        REQUIRE(b.size() == 70000 * sizeof(double));
+        uint64_t last_ts;
+        double last_b;
+        std::memcpy(&last_ts, ts.data() + ts.size() - 8, 8);
+        std::memcpy(&last_b, b.data() + b.size() - 8, 8);
+        REQUIRE(last_ts == 1000 + 69999);
+        REQUIRE(last_b == -69999.0);
+        REQUIRE(read_file("schema.json").find("\"rows\": 70000") != std::string::npos);
+        
+        for (const char* name : {"ts_event.u64", "a.f64", "b.f64", "schema.json"}) {
+            std::remove((dir + "/" + name).c_str());
+        }
+        rmdir(dir.c_str());
+    }
+}
+
+TEST_CASE("Arrow IPC Output", "[arrow]") {
+    auto read_file = [](const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), {});
+    };
+    auto u32_at = [](const std::string& bytes, size_t at) {
+        uint32_t value;
+        std::memcpy(&value, bytes.data() + at, sizeof(value));
+        return value;
+    };
+    auto u64_at = [](const std::string& bytes, size_t at) {
+        uint64_t value;
+        std::memcpy(&value, bytes.data() + at, sizeof(value));
+        return value;
+    };
+    
+    SECTION("File format: batches with their buffers as written") {
+        const std::string path = "/tmp/mbp_test_arrow_" + std::to_string(getpid()) + ".arrow";
+        {
+            MBPArrowWriter writer(path, false, false, false, 2);
+            MBPSnapshot snapshot;
+            snapshot.bid_px[0] = 10050;
+            snapshot.bid_sz[0] = 7;
+            for (uint64_t ts = 100; ts < 103; ++ts) {
+                snapshot.timestamp_ns = ts;
+                writer.append(snapshot);
+            }
+            writer.finish();
+            REQUIRE(writer.rows() == 3);
+        }
+        std::string file = read_file(path);
+        std::remove(path.c_str());
+        
+        REQUIRE(file.compare(0, 8, std::string("ARROW1\0\0", 8)) == 0);
+        REQUIRE(file.compare(file.size() - 6, 6, "ARROW1") == 0);
+        
+        // The schema message, then the first batch's metadata and body.
+        size_t at = 8;
+        REQUIRE(u32_at(file, at) == 0xFFFFFFFF);
+        REQUIRE(u32_at(file, at + 4) % 8 == 0);
+        at += 8 + u32_at(file, at + 4);
+        REQUIRE(u32_at(file, at) == 0xFFFFFFFF);
+        size_t body = at + 8 + u32_at(file, at + 4);
+        REQUIRE(body % 8 == 0);
+        
+        // ts_event and level 0 have no nulls, so no validity bitmaps.
+        REQUIRE(u64_at(file, body) == 100);
+        REQUIRE(u64_at(file, body + 8) == 101);
+        double px;
+        std::memcpy(&px, file.data() + body + 16, sizeof(px));
+        REQUIRE(px == 100.5);
+        REQUIRE(u64_at(file, body + 32) == 7);
+        // bid_px_01 is empty: a bitmap with both rows null, padded to 8.
+        REQUIRE((file[body + 48] & 0x3) == 0);
+    }
+    
+    SECTION("Stream format: no magic, ends with the end-of-stream marker") {
+        const std::string path = "/tmp/mbp_test_arrow_" + std::to_string(getpid()) + ".arrows";
+        {
+            TradeArrowWriter writer(path, true);
+            TradeInfo trade(100, 1, 10050, 25, 'B');
+            writer.append(trade);
+            writer.append(trade);
+        }
+        std::string file = read_file(path);
+        std::remove(path.c_str());
+        
+        REQUIRE(u32_at(file, 0) == 0xFFFFFFFF);
+        REQUIRE(file.size() % 8 == 0);
+        REQUIRE(u32_at(file, file.size() - 8) == 0xFFFFFFFF);
+        REQUIRE(u32_at(file, file.size() - 4) == 0);
+    }
+}
+
+TEST_CASE("Metrics Reporter", "[metrics]") {
+    ReplayMetrics metrics;
+    ReplayMetrics::set(metrics.events, 1000);
+    ReplayMetrics::set(metrics.snapshots, 400);
+    ReplayMetrics::set(metrics.active_orders, 12);
+    
+    SECTION("Prometheus text") {
+        MetricsSample sample = MetricsSample::read(metrics);
+        sample.events_per_second = 2500.5;
+        std::string text = sample.to_prometheus();
+        REQUIRE(text.find("# TYPE mbp_events_total counter\nmbp_events_total 1000\n") != std::string::npos);
+        REQUIRE(text.find("mbp_snapshots_total 400\n") != std::string::npos);
+        REQUIRE(text.find("# TYPE mbp_active_orders gauge\nmbp_active_orders 12\n") != std::string::npos);
+        REQUIRE(text.find("mbp_events_per_second 2500.5\n") != std::string::npos);
+    }
+    
+    SECTION("The file holds the figures as of stop()") {
+        const std::string path = "/tmp/mbp_test_metrics_" + std::to_string(getpid()) + ".prom";
+        {
+            MetricsReporter reporter(metrics, std::chrono::milliseconds(1), false, path);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            ReplayMetrics::set(metrics.events, 5000);
+            reporter.stop();
+        }
+        std::ifstream in(path);
+        std::string text((std::istreambuf_iterator<char>(in)), {});
+        std::remove(path.c_str());
+        REQUIRE(text.find("mbp_events_total 5000\n") != std::string::npos);
+        REQUIRE(text.find("mbp_active_orders 12\n") != std::string::npos);
+    }
+}
+
+TEST_CASE("Shadow Verification", "[verify]") {
+    // Random flow over a few crowded levels: adds, cancels, resizes and
+    // price moves, T+F+C trades at the touch, stray records and a clear.
+    std::mt19937_64 rng(17);
+    std::vector<Event> events;
+    std::vector<uint64_t> live;
+    uint64_t next_id = 1;
+    uint64_t ts = 1;
+    for (int step = 0; step < 20000; ++step, ++ts) {
+        // Odd ids bid, even ids offer, so moves stay on their side.
+        auto side_of = [](uint64_t id) { return (id & 1) ? 'B' : 'A'; };
+        auto price_for = [&](char side) {
+            return 10000 + (side == 'B' ? -1 : 1) * static_cast<int64_t>(1 + rng() % 6);
+        };
+        int op = static_cast<int>(rng() % 20);
+        char side = (rng() & 1) ? 'B' : 'A';
+        if (op < 8 || live.empty()) {
+            events.emplace_back(ts, 'A', side_of(next_id), price_for(side_of(next_id)),
+                                1 + rng() % 100, next_id);
+            live.push_back(next_id++);
+        } else if (op < 11) {
+            size_t pick = rng() % live.size();
+            events.emplace_back(ts, 'C', 'N', 0, 0, live[pick]);
+            live[pick] = live.back();
+            live.pop_back();
+        } else if (op < 15) {
+            uint64_t id = live[rng() % live.size()];
+            events.emplace_back(ts, 'M', side_of(id), price_for(side_of(id)), 1 + rng() % 100, id);
+        } else if (op < 19) {
+            uint64_t trade_id = 1000000 + step;
+            int64_t touch = 10000 + (side == 'B' ? 1 : -1);
+            events.emplace_back(ts, 'T', side, touch, 1 + rng() % 150, trade_id);
+            events.emplace_back(ts, 'F', side, touch, 0, rng() % 8 ? trade_id : 0);
+            events.emplace_back(ts, 'C', side, touch, 0, live[rng() % live.size()]);
+        } else {
+            events.emplace_back(ts, rng() % 50 ? 'F' : 'R', 'N', 0, 0, 0);
+        }
+    }
+    
+    BookListener listener;
+    BookReconstructor reconstructor(listener);
+    
+    SECTION("An agreeing book passes") {
+        ShadowVerifier verifier(1);
+        for (size_t at = 0; at < events.size(); at += 100) {
+            size_t count = std::min<size_t>(100, events.size() - at);
+            reconstructor.on_events(events.data() + at, count);
+            verifier.submit(events.data() + at, count, reconstructor.book());
+        }
+        verifier.finish();
+        
+        const ShadowVerifier::Report& report = verifier.report();
+        REQUIRE(report.passed());
+        REQUIRE(report.events == events.size());
+        REQUIRE(report.images == report.blocks);
+        REQUIRE(reconstructor.action_engine().get_trades_aggregated() > 100);
+    }
+    
+    SECTION("A book that went its own way is caught") {
+        ShadowVerifier verifier(4);
+        reconstructor.on_events(events.data(), 1000);
+        verifier.submit(events.data(), 1000, reconstructor.book());
+        
+        // Behind the verifier's back, an order joins the back of the best
+        // bid: only the level's size and count show it.
+        OrderBook& book = const_cast<OrderBook&>(reconstructor.book());
+        auto [bid_px, bid_sz] = book.get_best_bid();
+        REQUIRE(bid_sz > 0);
+        REQUIRE(book.add_order(999999999, bid_px, 1, 'B', 0));
+        verifier.submit(events.data(), 0, book);
+        verifier.finish();
+        
+        REQUIRE(verifier.report().top_mismatches == 1);
+        REQUIRE_FALSE(verifier.report().passed());
+    }
+    
+    SECTION("Full-book checks see queue order") {
+        reconstructor.on_events(events.data(), 2000);
+        BookImage image;
+        reconstructor.book().copy_image(image);
+        
+        ReferenceBook reference;
+        for (size_t i = 0; i < 2000; ++i) {
+            reference.apply(events[i]);
+        }
+        REQUIRE(reference.compare(image) == "");
+        
+        // Swap the first two orders of a level with at least two.
+        for (Level& level : image.bids) {
+            if (level.order_count >= 2) {
+                OrderIndex first = level.first_order;
+                OrderIndex second = image.orders[first].next;
+                OrderIndex third = image.orders[second].next;
+                image.orders[second].next = first;
+                image.orders[first].next = third;
+                level.first_order = second;
+                break;
+            }
+        }
+        REQUIRE(reference.compare(image).find("queue position 0") != std::string::npos);
+    }
+}
+
+TEST_CASE("Queue Position Tracking", "[orderbook][queue]") {
+    OrderBook book;
+    
+    SECTION("Position follows cancels, fills and modifies ahead") {
+        REQUIRE(book.add_order(1, 10000, 100, 'B', 1));
+        REQUIRE(book.add_order(2, 10000, 50, 'B', 2));
+        book.watch_order(3);                      // not arrived yet
+        REQUIRE(book.add_order(3, 10000, 30, 'B', 3));
+        REQUIRE(book.add_order(4, 10000, 40, 'B', 4));
+        
+        const QueuePosition* position = book.queue_position(3);
+        REQUIRE(position);
+        REQUIRE(position->resting);
+        REQUIRE(position->size_ahead == 150);
+        REQUIRE(position->orders_ahead == 2);
+        
+        REQUIRE(book.modify_order(2, 10000, 20));     // shrinks in place
+        REQUIRE(position->size_ahead == 120);
+        REQUIRE(book.cancel_order(4));                // behind: no effect
+        REQUIRE(position->size_ahead == 120);
+        
+        REQUIRE(book.execute_trade(10000, 110, 'A'));  // fills 1, 10 of 2
+        REQUIRE(position->size_ahead == 10);
+        REQUIRE(position->orders_ahead == 1);
+        
+        REQUIRE(book.execute_trade(10000, 25, 'A'));   // fills 2, 15 of 3
+        REQUIRE(position->size_ahead == 0);
+        REQUIRE(position->orders_ahead == 0);
+        REQUIRE(position->size == 15);
+        
+        REQUIRE(book.modify_order(3, 10100, 15));      // re-queued at a new price
+        REQUIRE(position->resting);
+        REQUIRE(position->price_raw == 10100);
+        
+        REQUIRE(book.cancel_order(3));
+        REQUIRE_FALSE(position->resting);
+        book.unwatch_order(3);
+        REQUIRE(book.queue_position(3) == nullptr);
+    }
+    
+    SECTION("Tracked positions match a walk of the queue") {
+        std::mt19937_64 rng(11);
+        std::vector<uint64_t> live;
+        std::unordered_set<uint64_t> watched;
+        uint64_t next_id = 1;
+        
+        auto check = [&] {
+            BookImage image;
+            book.copy_image(image);
+            size_t found = 0;
+            for (const auto* side : {&image.bids, &image.asks}) {
+                for (const Level& level : *side) {
+                    uint64_t size_ahead = 0;
+                    uint32_t orders_ahead = 0;
+                    uint32_t watchers = 0;
+                    for (OrderIndex idx = level.first_order; idx != NULL_ORDER;
+                         idx = image.orders[idx].next) {
+                        uint64_t id = image.orders.info(idx).order_id;
+                        if (watched.count(id)) {
+                            const QueuePosition* position = book.queue_position(id);
+                            REQUIRE(position);
+                            REQUIRE(position->resting);
+                            REQUIRE(position->price_raw == level.price_raw);
+                            REQUIRE(position->size == image.orders[idx].size);
+                            REQUIRE(position->size_ahead == size_ahead);
+                            REQUIRE(position->orders_ahead == orders_ahead);
+                            ++watchers;
+                        }
+                        size_ahead += image.orders[idx].size;
+                        ++orders_ahead;
+                    }
+                    REQUIRE(level.watchers == watchers);
+                    found += watchers;
+                }
+            }
+            
+            // Everything else watched is gone; unwatched ids have no position.
+            size_t resting = 0;
+            for (uint64_t id = 1; id < next_id; ++id) {
+                const QueuePosition* position = book.queue_position(id);
+                REQUIRE((position != nullptr) == (watched.count(id) != 0));
+                if (position && position->resting) ++resting;
+            }
+            REQUIRE(resting == found);
+        };
+        
+        std::unordered_map<uint64_t, int64_t> prices;
+        auto forget = [&](size_t pick) {
+            live[pick] = live.back();
+            live.pop_back();
+        };
+        
+        for (int step = 0; step < 3000; ++step) {
+            int op = static_cast<int>(rng() % 12);
+            if (op < 5 || live.empty()) {
+                uint64_t id = next_id++;
+                if (id % 7 == 1) {
+                    book.watch_order(id);
+                    watched.insert(id);
+                }
+                char side = (rng() & 1) ? 'B' : 'A';
+                int64_t price = 10000 + (side == 'B' ? -1 : 1) * static_cast<int64_t>(rng() % 5);
+                REQUIRE(book.add_order(id, price, 1 + rng() % 100, side, step));
+                live.push_back(id);
+                prices[id] = price;
+            } else if (op < 7) {
+                size_t pick = rng() % live.size();
+                book.cancel_order(live[pick]);
+                forget(pick);
+            } else if (op < 9) {
+                // Resize in place, or move one tick and lose priority.
+                size_t pick = rng() % live.size();
+                uint64_t id = live[pick];
+                int64_t price = prices[id] + ((rng() & 1) ? 0 : 1);
+                if (book.modify_order(id, price, 1 + rng() % 100)) {
+                    prices[id] = price;
+                } else {
+                    forget(pick);   // filled earlier
+                }
+            } else if (op < 10) {
+                auto [bid_px, bid_sz] = book.get_best_bid();
+                if (bid_sz > 0) {
+                    book.execute_trade(bid_px, 1 + rng() % 150, 'A');
+                }
+            } else {
+                // Toggle the watch on an order already mid-queue, or drop
+                // one on any id, resting or long gone.
+                uint64_t id = op == 10 ? live[rng() % live.size()] : 1 + rng() % (next_id - 1);
+                if (watched.erase(id)) {
+                    book.unwatch_order(id);
+                } else if (op == 10) {
+                    book.watch_order(id);
+                    watched.insert(id);
+                }
+            }
+            
+            if (step % 50 == 0) check();
+        }
+        check();
+    }
+}
+